@@ -103,6 +103,7 @@ int main(int argc, char** argv)
             width,
             height,
             format,
+            90,
             encode_work_buffer,
             encode_work_buffer_size);
 
@@ -9,11 +9,17 @@ extern "C" {
 # include <string.h>
 # include <stdlib.h>
 # include <stdint.h>
+# include <stdio.h>
 # include <math.h>
+# if defined( _MSC_VER )
+#  include <intrin.h>
+# endif /* _MSC_VER */
 
 /* data type definitions */
 typedef bool (*mameJpeg_stream_read_callback_ptr)( void* param, uint8_t* byte );
 typedef bool (*mameJpeg_stream_write_callback_ptr)( void* param, uint8_t byte );
+typedef bool (*mameJpeg_stream_write_block_callback_ptr)( void* param, const uint8_t* data, size_t size );
+typedef bool (*mameJpeg_stream_skip_callback_ptr)( void* param, size_t size );
 
 struct mameJpeg_context_t;
 typedef struct mameJpeg_context_t mameJpeg_context;
@@ -31,6 +37,13 @@ typedef enum {
     MAMEJPEG_FORMAT_Y_444      = 4,
 } mameJpeg_format;
 
+typedef enum {
+    MAMEJPEG_STATUS_OK             = 0,
+    MAMEJPEG_STATUS_NEED_MORE_DATA = 1,
+    MAMEJPEG_STATUS_ERROR          = 2,
+    MAMEJPEG_STATUS_OUTPUT_FULL    = 3,
+} mameJpeg_status;
+
 /* prototype definitions of mameJpeg API. */
 bool mameJpeg_getEncodeBufferSize( size_t width, size_t height, mameJpeg_format format, size_t* encode_buffer_size );
 bool mameJpeg_initializeEncode( mameJpeg_context* context,
@@ -41,9 +54,64 @@ bool mameJpeg_initializeEncode( mameJpeg_context* context,
                                 size_t width,
                                 size_t height,
                                 mameJpeg_format format,
+                                uint8_t quality,
                                 uint8_t* work_buffer,
                                 size_t work_buffer_size );
 bool mameJpeg_encode( mameJpeg_context* context );
+bool mameJpeg_encodeMultiQuality( mameJpeg_context* contexts, size_t context_num );
+/* contexts after the first of mameJpeg_encodeMultiQuality, they never read pixels and need no line buffer */
+bool mameJpeg_getMultiQualityBufferSize( size_t width, size_t height, mameJpeg_format format, size_t* encode_buffer_size );
+bool mameJpeg_initializeMultiQualityEncode( mameJpeg_context* context,
+                                            mameJpeg_stream_write_callback_ptr output_callback,
+                                            void* output_callback_param,
+                                            size_t width,
+                                            size_t height,
+                                            mameJpeg_format format,
+                                            uint8_t quality,
+                                            uint8_t* work_buffer,
+                                            size_t work_buffer_size );
+bool mameJpeg_setOutputBlockCallback( mameJpeg_context* context, mameJpeg_stream_write_block_callback_ptr output_block_callback );
+bool mameJpeg_getOptimizeBufferSize( size_t width, size_t height, mameJpeg_format format, size_t* optimize_buffer_size );
+bool mameJpeg_setOptimizeHuffman( mameJpeg_context* context, bool is_enabled );
+bool mameJpeg_setQuantTables( mameJpeg_context* context, const uint8_t* luma_table, const uint8_t* chroma_table );
+bool mameJpeg_getTargetSizeBufferSize( size_t width, size_t height, mameJpeg_format format, size_t* target_size_buffer_size );
+bool mameJpeg_setTargetSize( mameJpeg_context* context, size_t target_bytes );
+bool mameJpeg_getSelectedQuality( mameJpeg_context* context, uint8_t* quality );
+
+bool mameJpeg_getPushEncodeBufferSize( size_t width, size_t height, mameJpeg_format format, size_t* push_encode_buffer_size );
+bool mameJpeg_initializePushEncode( mameJpeg_context* context,
+                                    mameJpeg_stream_read_callback_ptr input_callback,
+                                    void* input_callback_param,
+                                    size_t width,
+                                    size_t height,
+                                    mameJpeg_format format,
+                                    uint8_t quality,
+                                    uint8_t* work_buffer,
+                                    size_t work_buffer_size );
+mameJpeg_status mameJpeg_encodePush( mameJpeg_context* context, uint8_t* dst, size_t dst_size, size_t* written_ptr );
+
+bool mameJpeg_initializeRowEncode( mameJpeg_context* context,
+                                   mameJpeg_stream_write_callback_ptr output_callback,
+                                   void* output_callback_param,
+                                   size_t width,
+                                   size_t height,
+                                   mameJpeg_format format,
+                                   uint8_t quality,
+                                   uint8_t* work_buffer,
+                                   size_t work_buffer_size );
+bool mameJpeg_encodeRows( mameJpeg_context* context, const uint8_t* rows, size_t stride, size_t count );
+
+bool mameJpeg_initializeSurfaceEncode( mameJpeg_context* context,
+                                       const uint8_t* pixels,
+                                       size_t stride,
+                                       mameJpeg_stream_write_callback_ptr output_callback,
+                                       void* output_callback_param,
+                                       size_t width,
+                                       size_t height,
+                                       mameJpeg_format format,
+                                       uint8_t quality,
+                                       uint8_t* work_buffer,
+                                       size_t work_buffer_size );
 
 bool mameJpeg_getDecodeBufferSize( mameJpeg_stream_read_callback_ptr read_callback_ptr,
                                    void* read_callback_param,
@@ -60,6 +128,95 @@ bool mameJpeg_initializeDecode( mameJpeg_context* context,
                                 size_t work_buffer_size );
 bool mameJpeg_decode( mameJpeg_context* context );
 
+bool mameJpeg_setInputSkipCallback( mameJpeg_context* context, mameJpeg_stream_skip_callback_ptr input_skip_callback );
+bool mameJpeg_readHeader( mameJpeg_context* context );
+bool mameJpeg_getImageInfo( mameJpeg_context* context,
+                            uint16_t* width_ptr,
+                            uint16_t* height_ptr,
+                            uint8_t* component_num_ptr );
+bool mameJpeg_readScanlines( mameJpeg_context* context, uint8_t* dst, size_t max_rows, size_t* read_rows_ptr );
+bool mameJpeg_finish( mameJpeg_context* context );
+
+bool mameJpeg_initializePushDecode( mameJpeg_context* context,
+                                    mameJpeg_stream_write_callback_ptr output_callback,
+                                    void* output_callback_param,
+                                    uint8_t* work_buffer,
+                                    size_t work_buffer_size );
+mameJpeg_status mameJpeg_decodePush( mameJpeg_context* context, const uint8_t* data, size_t size, size_t* consumed_ptr );
+/* no input follows the bytes of the next mameJpeg_decodePush, running out of them ends the stream */
+bool mameJpeg_finishPush( mameJpeg_context* context );
+
+/* checks segments, every huffman code, coefficient ranges, RSTn order and EOI without producing pixels */
+bool mameJpeg_validate( mameJpeg_context* context, size_t* error_offset_ptr );
+
+/* one pixel per 8x8 luma block from the DC terms only, ceil( width / 8 ) x ceil( height / 8 ) */
+bool mameJpeg_getPreviewSize( mameJpeg_context* context, uint16_t* width_ptr, uint16_t* height_ptr, size_t* preview_buffer_size_ptr );
+bool mameJpeg_decodePreview( mameJpeg_context* context, uint8_t* preview_buffer, size_t preview_buffer_size );
+
+/* fingerprint and sample statistics of a baseline image, computed from its coefficients */
+typedef struct {
+    /* one bit per cell of an 8x8 luma grid, brighter than the median and changing more across than down */
+    uint64_t dc_hash;
+    uint64_t ac_hash;
+    uint8_t component_num;
+    /* over whole blocks, the padding at the right and bottom edges included */
+    struct {
+        double mean;
+        double variance;
+    } component[3];
+} mameJpeg_signature;
+bool mameJpeg_computeSignature( mameJpeg_context* context, mameJpeg_signature* signature );
+uint8_t mameJpeg_getSignatureDistance( const mameJpeg_signature* a, const mameJpeg_signature* b );
+
+/* extra 1/2, 1/4 or 1/8 outputs filled by the full decode from the same coefficients */
+bool mameJpeg_getScaledOutputSize( mameJpeg_context* context, uint8_t scale, uint16_t* width_ptr, uint16_t* height_ptr, size_t* output_buffer_size_ptr );
+bool mameJpeg_setScaledOutput( mameJpeg_context* context, uint8_t scale, uint8_t* output_buffer, size_t output_buffer_size );
+
+/* quantized DCT coefficients of a baseline image, each block is 64 values in natural order */
+typedef struct {
+    uint16_t width;
+    uint16_t height;
+    mameJpeg_format format;
+    uint8_t component_num;
+    struct {
+        uint16_t hor_block_num;
+        uint16_t ver_block_num;
+        uint8_t quant_table[64];
+        int16_t* blocks;
+    } component[3];
+} mameJpeg_coefficients;
+bool mameJpeg_setCropWindow( mameJpeg_context* context, size_t x, size_t y, size_t width, size_t height );
+bool mameJpeg_getCoefficientBufferSize( mameJpeg_context* context, size_t* coefficient_buffer_size );
+bool mameJpeg_readCoefficients( mameJpeg_context* context,
+                                mameJpeg_coefficients* coefficients,
+                                uint8_t* coefficient_buffer,
+                                size_t coefficient_buffer_size );
+bool mameJpeg_initializeCoefficientEncode( mameJpeg_context* context,
+                                           mameJpeg_stream_write_callback_ptr output_callback,
+                                           void* output_callback_param,
+                                           const mameJpeg_coefficients* coefficients,
+                                           uint8_t* work_buffer,
+                                           size_t work_buffer_size );
+bool mameJpeg_writeCoefficients( mameJpeg_context* context );
+
+typedef enum {
+    MAMEJPEG_TRANSFORM_FLIP_H     = 0,
+    MAMEJPEG_TRANSFORM_FLIP_V     = 1,
+    MAMEJPEG_TRANSFORM_TRANSPOSE  = 2,
+    MAMEJPEG_TRANSFORM_TRANSVERSE = 3,
+    MAMEJPEG_TRANSFORM_ROTATE_90  = 4,
+    MAMEJPEG_TRANSFORM_ROTATE_180 = 5,
+    MAMEJPEG_TRANSFORM_ROTATE_270 = 6,
+} mameJpeg_transform;
+bool mameJpeg_transformCoefficients( const mameJpeg_coefficients* src,
+                                     mameJpeg_transform transform,
+                                     mameJpeg_coefficients* dst,
+                                     uint8_t* coefficient_buffer,
+                                     size_t coefficient_buffer_size );
+bool mameJpeg_requantizeCoefficients( mameJpeg_coefficients* coefficients, uint8_t quality );
+/* natural order target tables used as they are, chroma_table is ignored for grayscale */
+bool mameJpeg_requantizeCoefficientsToTables( mameJpeg_coefficients* coefficients, const uint8_t* luma_table, const uint8_t* chroma_table );
+
 /* prototype definitions of refarence callbacks */
 typedef struct {
     void* buffer_ptr;
@@ -68,8 +225,25 @@ typedef struct {
 } mameJpeg_memory_callback_param;
 bool mameJpeg_input_from_memory_callback( void* param, uint8_t* byte );
 bool mameJpeg_output_to_memory_callback( void* param, uint8_t byte );
+bool mameJpeg_output_block_to_memory_callback( void* param, const uint8_t* data, size_t size );
 bool mameJpeg_input_from_file_callback( void* param, uint8_t* byte );
 bool mameJpeg_output_to_file_callback( void* param, uint8_t byte );
+bool mameJpeg_output_block_to_file_callback( void* param, const uint8_t* data, size_t size );
+bool mameJpeg_input_skip_in_memory_callback( void* param, size_t size );
+bool mameJpeg_input_skip_in_file_callback( void* param, size_t size );
+
+/* image parameters from SOF, read without a context */
+typedef struct {
+    uint16_t width;
+    uint16_t height;
+    uint8_t component_num;
+    uint8_t hor_sampling[3];
+    uint8_t ver_sampling[3];
+    bool is_baseline;
+} mameJpeg_probe_info;
+bool mameJpeg_probeMemory( const uint8_t* data, size_t size, mameJpeg_probe_info* info );
+/* points into data at the jpeg thumbnail of EXIF IFD1, decode it like any jpeg in memory */
+bool mameJpeg_findExifThumbnail( const uint8_t* data, size_t size, const uint8_t** thumbnail_ptr, size_t* thumbnail_size_ptr );
 
 #define MAMEJPEG_CHECK( X ) do{if((X)==false )return false;}while(0)
 #define MAMEJPEG_NULL_CHECK( X )  MAMEJPEG_CHECK((X)!=NULL)
@@ -78,6 +252,12 @@ bool mameJpeg_output_to_file_callback( void* param, uint8_t byte );
 #define MAMEJPEG_MIN( VAL1, VAL2 ) ( ( VAL1 < VAL2 ) ? VAL1 : VAL2 )
 #define MAMEJPEG_CLIP( VAL, LOW, HIGH ) MAMEJPEG_MIN( MAMEJPEG_MAX( VAL, LOW ), HIGH )
 
+/* a baseline MCU holds at most 10 blocks */
+#define MAMEJPEG_MAX_MCU_BLOCK_NUM ( 10 )
+
+/* encoded bytes collected before they are handed to the output callback */
+#define MAMEJPEG_OUTPUT_BUFFER_SIZE ( 4096 )
+
 typedef enum
 {
     MAMEBITSTREAM_READ,
@@ -93,6 +273,19 @@ typedef struct {
     uint32_t cache;
     int cache_use_bits;
     mameJpeg_stream_mode mode;
+
+    /* read side: jumps over segment payloads, NULL reads them byte by byte */
+    mameJpeg_stream_skip_callback_ptr skip;
+    /* read side: bytes taken from the source so far */
+    size_t position;
+
+    /* write side: bit accumulator and the byte buffer handed to the sink in chunks */
+    uint64_t bit_buffer;
+    int bit_count;
+    uint8_t* out_buffer;
+    size_t out_capacity;
+    size_t out_length;
+    mameJpeg_stream_write_block_callback_ptr write_block;
 } mameJpeg_stream_context;
 
 static
@@ -108,6 +301,18 @@ bool mameJpeg_stream_input_initialize( mameJpeg_stream_context* context,
     context->cache = 0x0000;
     context->cache_use_bits = 0;
     context->mode = MAMEBITSTREAM_READ;
+    context->position = 0;
+
+    /* the reference sources know how to seek */
+    context->skip = NULL;
+    if( read_callback == mameJpeg_input_from_memory_callback )
+    {
+        context->skip = mameJpeg_input_skip_in_memory_callback;
+    }
+    else if( read_callback == mameJpeg_input_from_file_callback )
+    {
+        context->skip = mameJpeg_input_skip_in_file_callback;
+    }
 
     return true;
 }
@@ -125,6 +330,12 @@ bool mameJpeg_stream_output_initialize( mameJpeg_stream_context* context,
     context->cache = 0x00000000;
     context->cache_use_bits = 0;
     context->mode = MAMEBITSTREAM_WRITE;
+    context->bit_buffer = 0;
+    context->bit_count = 0;
+    context->out_buffer = NULL;
+    context->out_capacity = 0;
+    context->out_length = 0;
+    context->write_block = NULL;
 
     return true;
 }
@@ -136,14 +347,17 @@ bool mameJpeg_stream_tryReadIntoCache( mameJpeg_stream_context* context )
     MAMEJPEG_CHECK( context->mode == MAMEBITSTREAM_READ );
     MAMEJPEG_CHECK( context->cache_use_bits < 8 );
 
-    uint8_t prev_byte = 0;
     uint8_t byte = 0;
-    do
+    MAMEJPEG_CHECK( context->io_callback.read( context->callback_param, &byte ) );
+    context->position++;
+    if( byte == 0xff )
     {
-        prev_byte = byte;
-        MAMEJPEG_CHECK( context->io_callback.read( context->callback_param, &byte ) );
-    } while( byte == 0xff );
-    byte = ( prev_byte == 0xff && byte == 0x00 ) ? 0xff : byte;
+        /* only a stuffed zero may follow, a marker inside the entropy coded data is an error */
+        uint8_t stuffed_byte = 0;
+        MAMEJPEG_CHECK( context->io_callback.read( context->callback_param, &stuffed_byte ) );
+        context->position++;
+        MAMEJPEG_CHECK( stuffed_byte == 0x00 );
+    }
 
     uint32_t bit_shift = 8 * ( sizeof( context->cache ) - 1 ) - context->cache_use_bits;
     context->cache |= ( byte << bit_shift );
@@ -186,55 +400,123 @@ bool mameJpeg_stream_readBits( mameJpeg_stream_context* context,
 }
 
 static
-bool mameJpeg_stream_tryWriteFromCache( mameJpeg_stream_context* context )
+bool mameJpeg_stream_flushBuffer( mameJpeg_stream_context* context )
 {
     MAMEJPEG_NULL_CHECK( context );
     MAMEJPEG_CHECK( context->mode == MAMEBITSTREAM_WRITE );
-    MAMEJPEG_CHECK( 8 <= context->cache_use_bits );
 
-    uint32_t bit_shift = 8 * ( sizeof( context->cache ) - 1 );
-    uint8_t tmp = (uint8_t)( context->cache >> bit_shift );
-    MAMEJPEG_CHECK( context->io_callback.write( context->callback_param, tmp ) );
+    if( context->out_length == 0 )
+    {
+        return true;
+    }
+
+    if( context->write_block != NULL )
+    {
+        MAMEJPEG_CHECK( context->write_block( context->callback_param, context->out_buffer, context->out_length ) );
+    }
+    else
+    {
+        for( size_t i = 0; i < context->out_length; i++ )
+        {
+            MAMEJPEG_CHECK( context->io_callback.write( context->callback_param, context->out_buffer[i] ) );
+        }
+    }
+    context->out_length = 0;
+
+    return true;
+}
 
-    if( tmp == 0xff )
+static
+bool mameJpeg_stream_putByte( mameJpeg_stream_context* context, uint8_t byte )
+{
+    /* without an output buffer every byte goes straight to the callback */
+    if( context->out_buffer == NULL )
     {
-        uint8_t tmp = 0x00;
-        MAMEJPEG_CHECK( context->io_callback.write( context->callback_param, tmp ) );
+        return context->io_callback.write( context->callback_param, byte );
     }
 
-    context->cache <<= 8;
-    context->cache_use_bits -= 8;
+    if( context->out_capacity <= context->out_length )
+    {
+        MAMEJPEG_CHECK( mameJpeg_stream_flushBuffer( context ) );
+    }
+    context->out_buffer[ context->out_length ] = byte;
+    context->out_length++;
 
     return true;
 }
 
 static
-bool mameJpeg_stream_writeBits( mameJpeg_stream_context* context, void* buffer, int bits )
+bool mameJpeg_stream_putStuffedByte( mameJpeg_stream_context* context, uint8_t byte )
+{
+    MAMEJPEG_CHECK( mameJpeg_stream_putByte( context, byte ) );
+    if( byte == 0xff )
+    {
+        MAMEJPEG_CHECK( mameJpeg_stream_putByte( context, 0x00 ) );
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_stream_putWord( mameJpeg_stream_context* context, uint32_t word )
+{
+    /* a byte of the word is 0xff exactly when the same byte of ~word is zero */
+    uint32_t inverted = ~word;
+    bool has_ff = ( ( inverted - 0x01010101u ) & ~inverted & 0x80808080u ) != 0;
+    if( !has_ff && context->out_buffer != NULL && context->out_length + 4 <= context->out_capacity )
+    {
+        uint8_t* dst = context->out_buffer + context->out_length;
+        dst[0] = (uint8_t)( word >> 24 );
+        dst[1] = (uint8_t)( word >> 16 );
+        dst[2] = (uint8_t)( word >> 8 );
+        dst[3] = (uint8_t)( word );
+        context->out_length += 4;
+        return true;
+    }
+
+    for( int shift = 24; 0 <= shift; shift -= 8 )
+    {
+        MAMEJPEG_CHECK( mameJpeg_stream_putStuffedByte( context, (uint8_t)( word >> shift ) ) );
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_stream_writeCode( mameJpeg_stream_context* context, uint32_t bits, int bit_num )
 {
     MAMEJPEG_NULL_CHECK( context );
     MAMEJPEG_CHECK( context->mode == MAMEBITSTREAM_WRITE );
-    MAMEJPEG_NULL_CHECK( buffer );
+    MAMEJPEG_CHECK( 0 <= bit_num && bit_num <= 32 );
 
-    int buffer_pos = ( bits - 1 ) >> 3;
-    while( 0 < bits )
+    /* less than 32 bits are kept between writes, so the accumulator never overflows */
+    uint64_t mask = ( (uint64_t)1 << bit_num ) - 1;
+    context->bit_buffer = ( context->bit_buffer << bit_num ) | ( bits & mask );
+    context->bit_count += bit_num;
+    if( 32 <= context->bit_count )
     {
-        uint8_t remain_bits = bits & 0x07;
-        uint8_t write_bits = ( remain_bits != 0 ) ? remain_bits : 8;
-        uint8_t cache_mask = ( 1 << write_bits ) - 1;
-        uint8_t shift_width = 8 * sizeof( context->cache ) - context->cache_use_bits - write_bits;
-        context->cache |= ( (((uint8_t*)buffer)[ buffer_pos ] ) & cache_mask ) << shift_width;
-        context->cache_use_bits += write_bits;
+        context->bit_count -= 32;
+        MAMEJPEG_CHECK( mameJpeg_stream_putWord( context, (uint32_t)( context->bit_buffer >> context->bit_count ) ) );
+    }
 
-        buffer_pos--;
-        bits -= write_bits;
+    return true;
+}
 
-        if( 8 <= context->cache_use_bits )
-        {
-            MAMEJPEG_CHECK( mameJpeg_stream_tryWriteFromCache( context ) );
-        }
+static
+bool mameJpeg_stream_writeBits( mameJpeg_stream_context* context, void* buffer, int bits )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->mode == MAMEBITSTREAM_WRITE );
+    MAMEJPEG_NULL_CHECK( buffer );
+    MAMEJPEG_CHECK( bits <= 32 );
+
+    uint32_t value = 0;
+    for( int i = ( bits - 1 ) >> 3; 0 <= i; i-- )
+    {
+        value = ( value << 8 ) | ((uint8_t*)buffer)[i];
     }
 
-    return ( bits == 0 );
+    return mameJpeg_stream_writeCode( context, value, bits );
 }
 
 static
@@ -242,20 +524,20 @@ bool mameJpeg_stream_flushBits( mameJpeg_stream_context* context )
 {
     MAMEJPEG_NULL_CHECK( context );
 
-    while( 8 < context->cache_use_bits )
+    while( 8 <= context->bit_count )
     {
-        MAMEJPEG_CHECK( mameJpeg_stream_tryWriteFromCache( context ) );
+        context->bit_count -= 8;
+        MAMEJPEG_CHECK( mameJpeg_stream_putStuffedByte( context, (uint8_t)( context->bit_buffer >> context->bit_count ) ) );
     }
 
-    if( 0 < context->cache_use_bits )
+    if( 0 < context->bit_count )
     {
-        uint32_t bit_shift = 8 * ( sizeof( context->cache ) - 1 );
-        uint8_t tmp = (uint8_t)( context->cache >> bit_shift );
-        MAMEJPEG_CHECK( context->io_callback.write( context->callback_param, tmp ) );
+        uint8_t tmp = (uint8_t)( context->bit_buffer << ( 8 - context->bit_count ) );
+        MAMEJPEG_CHECK( mameJpeg_stream_putByte( context, tmp ) );
     }
 
-    context->cache = 0;
-    context->cache_use_bits = 0;
+    context->bit_buffer = 0;
+    context->bit_count = 0;
 
     return true;
 }
@@ -268,6 +550,28 @@ bool mameJpeg_stream_readByte( mameJpeg_stream_context* context, uint8_t* byte )
     MAMEJPEG_CHECK( context->mode == MAMEBITSTREAM_READ );
 
     MAMEJPEG_CHECK( context->io_callback.read( context->callback_param, byte ) );
+    context->position++;
+    return true;
+}
+
+static
+bool mameJpeg_stream_skipBytes( mameJpeg_stream_context* context, size_t size )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->mode == MAMEBITSTREAM_READ );
+
+    if( context->skip != NULL )
+    {
+        MAMEJPEG_CHECK( context->skip( context->callback_param, size ) );
+        context->position += size;
+        return true;
+    }
+
+    uint8_t dummy;
+    for( size_t i = 0; i < size; i++ )
+    {
+        MAMEJPEG_CHECK( mameJpeg_stream_readByte( context, &dummy ) );
+    }
     return true;
 }
 
@@ -290,7 +594,7 @@ bool mameJpeg_stream_writeByte( mameJpeg_stream_context* context, uint8_t byte )
     MAMEJPEG_CHECK( context->mode == MAMEBITSTREAM_WRITE );
 
     MAMEJPEG_CHECK( mameJpeg_stream_flushBits( context ) );
-    MAMEJPEG_CHECK( context->io_callback.write( context->callback_param, byte ) );
+    MAMEJPEG_CHECK( mameJpeg_stream_putByte( context, byte ) );
     return true;
 }
 
@@ -324,6 +628,44 @@ typedef struct {
     uint8_t value;
 }huffman_element;
 
+typedef struct {
+    uint16_t code;
+    uint8_t size;
+}huffman_code;
+
+typedef enum {
+    MAMEJPEG_PHASE_HEADER  = 0,
+    MAMEJPEG_PHASE_SCAN    = 1,
+    MAMEJPEG_PHASE_TRAILER = 2,
+    MAMEJPEG_PHASE_DONE    = 3,
+} mameJpeg_phase;
+
+typedef struct {
+    mameJpeg_phase phase;
+    uint16_t mcu_col_index;
+    uint16_t mcu_row_index;
+    uint16_t mcu_row_num;
+    uint16_t restart_countdown;
+    uint8_t restart_index;
+    uint16_t buffered_rows;
+    uint16_t consumed_rows;
+} mameJpeg_cursor;
+
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+    size_t pos;
+    bool is_exhausted;
+    bool is_finished;
+} mameJpeg_push_source;
+
+typedef struct {
+    uint8_t* buffer;
+    size_t capacity;
+    size_t length;
+    size_t pos;
+} mameJpeg_push_sink;
+
 struct mameJpeg_context_t {
     uint8_t* line_buffer;
     size_t line_buffer_length;
@@ -342,20 +684,88 @@ struct mameJpeg_context_t {
             uint8_t ver_sampling;
             uint8_t quant_table_index;
             uint8_t huff_table_index[2];
+            uint8_t hor_shift;
+            uint8_t ver_shift;
+            uint8_t block_offset;
             int prev_dc_value;
         } component [3];
         struct {
             uint16_t offsets[17];
             huffman_element* elements;
+            /* encoder only, indexed by symbol, size 0 for symbols without a code */
+            huffman_code* codes;
         } huff_table[2][2];
 
         uint8_t* quant_table[4];
 
-        double* dct_work_buffer;
-        double* mcu_pixels;
+        uint8_t mcu_block_num;
+        uint16_t strip_mcu_num;
+        int16_t* coeff_blocks;
+        uint8_t* mcu_samples;
 
     } info;
 
+    mameJpeg_cursor cursor;
+
+    /* input window and resume point of mameJpeg_decodePush */
+    mameJpeg_push_source push_source;
+    struct {
+        bool is_enabled;
+        size_t input_pos;
+        mameJpeg_stream_context input_stream;
+        int prev_dc_value[3];
+        mameJpeg_cursor cursor;
+        uint8_t* work_buffer_ptr;
+    } checkpoint;
+
+    /* encoded bytes of mameJpeg_encodePush not yet taken by the caller */
+    mameJpeg_push_sink push_sink;
+
+    /* two pass encoding with huffman tables built from the image statistics */
+    struct {
+        bool is_enabled;
+        bool is_gathering;
+        uint32_t* symbol_freq[2][2];
+        uint8_t* code_bits[2][2];
+        uint8_t* code_values[2][2];
+        int16_t* coeff_cache;
+        uint64_t* mask_cache;
+    } huff_optimize;
+
+    /* quality search against a byte budget over the cached forward DCT output */
+    struct {
+        size_t target_bytes;
+        bool is_estimating;
+        size_t estimated_bits;
+        float* dct_cache;
+        uint8_t quality;
+    } rate_control;
+
+    /* blocks mameJpeg_writeCoefficients codes instead of pixels */
+    const mameJpeg_coefficients* coefficients;
+
+    /* MCU aligned part of the image mameJpeg_readCoefficients keeps */
+    struct {
+        bool is_enabled;
+        size_t x;
+        size_t y;
+        size_t width;
+        size_t height;
+    } crop_window;
+
+    /* reduced size copies of the decoded image, indexed 1/2, 1/4, 1/8 */
+    uint8_t* scaled_output[3];
+
+    /* pixels the encoder gathers MCUs from, either line_buffer or a caller surface */
+    struct {
+        const uint8_t* pixels;
+        size_t stride;
+        size_t first_row;
+        bool is_surface;
+        /* takes its DCT blocks from another context */
+        bool is_output_only;
+    } source;
+
     uint8_t* work_buffer_beg;
     uint8_t* work_buffer_end;
     uint8_t* work_buffer_ptr;
@@ -374,6 +784,46 @@ bool mameJpeg_assignBuffer( mameJpeg_context* context, size_t size, void** buffe
     return true;
 }
 
+static
+bool mameJpeg_saveCheckpoint( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    if( !context->checkpoint.is_enabled )
+    {
+        return true;
+    }
+
+    context->checkpoint.input_pos = context->push_source.pos;
+    context->checkpoint.input_stream = *context->input_stream;
+    for( int i = 0; i < 3; i++ )
+    {
+        context->checkpoint.prev_dc_value[i] = context->info.component[i].prev_dc_value;
+    }
+    context->checkpoint.cursor = context->cursor;
+    context->checkpoint.work_buffer_ptr = context->work_buffer_ptr;
+
+    return true;
+}
+
+static
+bool mameJpeg_restoreCheckpoint( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->checkpoint.is_enabled );
+
+    context->push_source.pos = context->checkpoint.input_pos;
+    *context->input_stream = context->checkpoint.input_stream;
+    for( int i = 0; i < 3; i++ )
+    {
+        context->info.component[i].prev_dc_value = context->checkpoint.prev_dc_value[i];
+    }
+    context->cursor = context->checkpoint.cursor;
+    context->work_buffer_ptr = context->checkpoint.work_buffer_ptr;
+
+    return true;
+}
+
 static
 uint8_t mameJpeg_getComponentNum( mameJpeg_format format )
 {
@@ -395,17 +845,95 @@ uint8_t mameJpeg_getLumaVerSampling( mameJpeg_format format )
 static
 size_t mameJpeg_getLineBufferSize( uint16_t width, uint8_t component_num, uint8_t ver_sampling )
 {
-    size_t hor_bytes = component_num * width;
+    size_t hor_bytes = (size_t)component_num * width;
     size_t ver_bytes = ver_sampling * 8;
     return hor_bytes * ver_bytes;
 }
 
+static
+size_t mameJpeg_getMCUBlockNum( uint8_t component_num, uint8_t luma_hor_sampling, uint8_t luma_ver_sampling )
+{
+    return luma_hor_sampling * luma_ver_sampling + ( component_num - 1 );
+}
+
+static
+size_t mameJpeg_getImageBlockNum( size_t width, size_t height, mameJpeg_format format )
+{
+    uint8_t component_num = mameJpeg_getComponentNum( format );
+    size_t mcu_width = 8 * mameJpeg_getLumaHorSampling( format );
+    size_t mcu_height = 8 * mameJpeg_getLumaVerSampling( format );
+    size_t mcu_num = ( ( width + mcu_width - 1 ) / mcu_width ) * ( ( height + mcu_height - 1 ) / mcu_height );
+    return mcu_num * mameJpeg_getMCUBlockNum( component_num, mcu_width / 8, mcu_height / 8 );
+}
+
+static
+size_t mameJpeg_getCoeffBufferSize( size_t block_num )
+{
+    return sizeof( int16_t ) * 64 * block_num;
+}
+
+static
+size_t mameJpeg_getSampleBufferSize( size_t block_num )
+{
+    return sizeof( uint8_t ) * 64 * block_num;
+}
+
 static
 size_t mameJpeg_getMCUBufferSize( uint16_t width, uint8_t component_num, uint8_t luma_hor_sampling, uint8_t luma_ver_sampling )
 {
-    size_t hor_bytes = component_num * luma_hor_sampling * 8;
-    size_t ver_bytes = luma_ver_sampling * 8;
-    return sizeof( double ) * hor_bytes * ver_bytes;
+    size_t block_num = mameJpeg_getMCUBlockNum( component_num, luma_hor_sampling, luma_ver_sampling );
+    return mameJpeg_getCoeffBufferSize( block_num ) + mameJpeg_getSampleBufferSize( block_num );
+}
+
+static
+bool mameJpeg_setupMCULayout( mameJpeg_context* context, uint16_t strip_mcu_num )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( 0 < strip_mcu_num );
+
+    uint8_t block_offset = 0;
+    for( uint8_t i = 0; i < context->info.component_num; i++ )
+    {
+        uint8_t hor_sampling = context->info.component[i].hor_sampling;
+        uint8_t ver_sampling = context->info.component[i].ver_sampling;
+        MAMEJPEG_CHECK( 0 < hor_sampling && 0 < ver_sampling );
+
+        uint8_t hor_shift = 0;
+        while( ( hor_sampling << hor_shift ) < context->info.component[0].hor_sampling )
+        {
+            hor_shift++;
+        }
+        uint8_t ver_shift = 0;
+        while( ( ver_sampling << ver_shift ) < context->info.component[0].ver_sampling )
+        {
+            ver_shift++;
+        }
+        MAMEJPEG_CHECK( ( hor_sampling << hor_shift ) == context->info.component[0].hor_sampling );
+        MAMEJPEG_CHECK( ( ver_sampling << ver_shift ) == context->info.component[0].ver_sampling );
+
+        context->info.component[i].hor_shift = hor_shift;
+        context->info.component[i].ver_shift = ver_shift;
+        context->info.component[i].block_offset = block_offset;
+        block_offset += hor_sampling * ver_sampling;
+    }
+    context->info.mcu_block_num = block_offset;
+    context->info.strip_mcu_num = strip_mcu_num;
+
+    return true;
+}
+
+static
+uint8_t* mameJpeg_getComponentSamples( mameJpeg_context* context, uint8_t component_index, size_t* stride )
+{
+    size_t strip_mcu_num = context->info.strip_mcu_num;
+    *stride = 8 * context->info.component[ component_index ].hor_sampling * strip_mcu_num;
+    return context->info.mcu_samples + 64 * context->info.component[ component_index ].block_offset * strip_mcu_num;
+}
+
+static
+uint8_t mameJpeg_roundToSample( double value )
+{
+    return (uint8_t)MAMEJPEG_CLIP( value + 0.5, 0.0, 255.0 );
 }
 
 static
@@ -423,6 +951,26 @@ bool mameJpeg_getNumOfMCU( mameJpeg_context* context, uint16_t* hor_mcu_num, uin
     return true;
 }
 
+static
+uint8_t mameJpeg_countTrailingZeros( uint64_t value )
+{
+#if defined( __GNUC__ ) || defined( __clang__ )
+    return (uint8_t)__builtin_ctzll( value );
+#elif defined( _MSC_VER ) && defined( _M_X64 )
+    unsigned long index;
+    _BitScanForward64( &index, value );
+    return (uint8_t)index;
+#else
+    uint8_t count = 0;
+    while( ( value & 1 ) == 0 )
+    {
+        value >>= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
 static
 uint8_t mameJpeg_getZigZagIndex( mameJpeg_context* context, uint8_t index )
 {
@@ -449,8 +997,8 @@ bool mameJpeg_1D_DCT( const double* src_buffer, size_t const element_stride, dou
     static const double s1 = 0.19509032201612825;
     static const double c3 = 0.8314696123025452;
     static const double s3 = 0.5555702330196022;
-    static const double c6 = 0.5555702330196023;
-    static const double s6 = 0.8314696123025451;
+    static const double c6 = 0.38268343236508984;
+    static const double s6 = 0.9238795325112867;
 
     /* load */
     const double src0 = src_buffer[element_stride * 0];
@@ -511,6 +1059,8 @@ bool mameJpeg_1D_DCT( const double* src_buffer, size_t const element_stride, dou
     dst_buffer[element_stride * 3] = s4_5;
     dst_buffer[element_stride * 5] = s4_6;
     dst_buffer[element_stride * 1] = s4_7;
+
+    return true;
 }
 
 static
@@ -521,8 +1071,8 @@ bool mameJpeg_1D_IDCT( const double* src_buffer, size_t const element_stride, do
     static const double s1 = 0.19509032201612825;
     static const double c3 = 0.8314696123025452;
     static const double s3 = 0.5555702330196022;
-    static const double c6 = 0.5555702330196023;
-    static const double s6 = 0.8314696123025451;
+    static const double c6 = 0.38268343236508984;
+    static const double s6 = 0.9238795325112867;
 
     /* shuffle and load */
     const double src0 = dst_buffer[element_stride * 0];
@@ -583,48 +1133,45 @@ bool mameJpeg_1D_IDCT( const double* src_buffer, size_t const element_stride, do
     dst_buffer[element_stride * 5] = s4_5;
     dst_buffer[element_stride * 6] = s4_6;
     dst_buffer[element_stride * 7] = s4_7;
+
+    return true;
 }
 
 static
-bool mameJpeg_applyDCT( mameJpeg_context* context, bool is_forward )
+bool mameJpeg_applyDCT( double* dct_work_buffer, bool is_forward )
 {
-    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( dct_work_buffer );
 
     typedef bool (*dct_func_ptr)( const double*, size_t const, double* );
     const dct_func_ptr func_ptr = is_forward ? mameJpeg_1D_DCT : mameJpeg_1D_IDCT;
 
-    double* dct_work_buffer = context->info.dct_work_buffer;
+    double* row_buffer = dct_work_buffer;
     for( int y = 0; y < 8; y++ )
     {
-        (*func_ptr)( dct_work_buffer, 1, dct_work_buffer );
-        dct_work_buffer += 8;
+        (*func_ptr)( row_buffer, 1, row_buffer );
+        row_buffer += 8;
     }
 
-    dct_work_buffer = context->info.dct_work_buffer;
+    double* column_buffer = dct_work_buffer;
     for( int y = 0; y < 8; y++ )
     {
-        (*func_ptr)( dct_work_buffer, 8, dct_work_buffer );
-        ++dct_work_buffer;
+        (*func_ptr)( column_buffer, 8, column_buffer );
+        ++column_buffer;
     }
 
-    const double scale_factor = is_forward ? 0.17677669529663687 /* 1. / (4 * sqrt(2)) */
-                                           : 0.125; /* 1. / 8. */
-    if( !is_forward )
-    {
-        context->info.dct_work_buffer[0] /= 1.4142135623730951;
-    }
+    const double scale_factor = 0.125; /* 1. / 8. */
     for( int i = 0; i < 64; i++ )
     {
-        context->info.dct_work_buffer[i] *= scale_factor;
+        dct_work_buffer[i] *= scale_factor;
     }
 
     return true;
 }
 
 static const double MAMEJPEG_YCBCR_TO_RGB_COEFF[3][4] = { 
-    { 1.0, 1.0, 1.0, 128.0 },
-    { 0.0, -0.344, 1.772, 0.0 },
-    { 1.402, -0.714, 0.0, 0.0 }
+    { 1.0, 1.0, 1.0, 0.0 },
+    { 0.0, -0.344, 1.772, -128.0 },
+    { 1.402, -0.714, 0.0, -128.0 }
 };
 
 static
@@ -650,8 +1197,12 @@ bool mameJpeg_getNextMarker( mameJpeg_context* context, mameJpeg_marker* marker
     {
         if( prefix == 0xff )
         {
+            /* any number of 0xff fill bytes may precede the marker code */
             uint8_t val;
-            MAMEJPEG_CHECK( mameJpeg_stream_readByte( context->input_stream, &val ) );
+            do
+            {
+                MAMEJPEG_CHECK( mameJpeg_stream_readByte( context->input_stream, &val ) );
+            } while( val == 0xff );
 
             *marker = (mameJpeg_marker)(( prefix << 8 ) | val);
             return true;
@@ -666,6 +1217,19 @@ bool mameJpeg_restartDecode( mameJpeg_context* context )
 {
     MAMEJPEG_NULL_CHECK( context );
 
+    /* the rest of the current byte is padding, RSTn follows and counts up modulo 8 */
+    context->input_stream->cache = 0;
+    context->input_stream->cache_use_bits = 0;
+    uint8_t byte = 0;
+    MAMEJPEG_CHECK( mameJpeg_stream_readByte( context->input_stream, &byte ) );
+    MAMEJPEG_CHECK( byte == 0xff );
+    do
+    {
+        MAMEJPEG_CHECK( mameJpeg_stream_readByte( context->input_stream, &byte ) );
+    } while( byte == 0xff );
+    MAMEJPEG_CHECK( byte == 0xd0 + context->cursor.restart_index );
+    context->cursor.restart_index = ( context->cursor.restart_index + 1 ) & 0x07;
+
     context->info.component[0].prev_dc_value = 0;
     context->info.component[1].prev_dc_value = 0;
     context->info.component[2].prev_dc_value = 0;
@@ -673,24 +1237,38 @@ bool mameJpeg_restartDecode( mameJpeg_context* context )
 }
 
 static
-bool mameJpeg_getOutputBytes( mameJpeg_context* context, uint16_t* output_bytes )
+uint16_t mameJpeg_getMCURowHeight( mameJpeg_context* context, uint16_t ver_mcu_index )
+{
+    size_t mcu_height = 8 * context->info.component[0].ver_sampling;
+    return MAMEJPEG_MIN( mcu_height, context->info.height - ver_mcu_index * mcu_height );
+}
+
+static
+bool mameJpeg_getOutputBytes( mameJpeg_context* context, uint16_t ver_mcu_index, size_t* output_bytes )
 {
     MAMEJPEG_NULL_CHECK( context );
     MAMEJPEG_NULL_CHECK( output_bytes );
 
-    *output_bytes = context->info.component_num * 8 * context->info.component[0].ver_sampling * context->info.width;
+    size_t row_bytes = (size_t)context->info.component_num * context->info.width;
+    *output_bytes = row_bytes * mameJpeg_getMCURowHeight( context, ver_mcu_index );
     return true;
 }
 
 static
-bool mameJpeg_writeBuffer( mameJpeg_context* context )
+bool mameJpeg_writeBuffer( mameJpeg_context* context, uint16_t ver_mcu_index )
 {
-    uint16_t output_bytes = 0;
-    MAMEJPEG_CHECK( mameJpeg_getOutputBytes( context, &output_bytes ) );
+    size_t output_bytes = 0;
+    MAMEJPEG_CHECK( mameJpeg_getOutputBytes( context, ver_mcu_index, &output_bytes ) );
 
-    for( uint16_t i = 0; i < output_bytes; i++ )
+    mameJpeg_stream_context* stream = context->output_stream;
+    if( stream->write_block != NULL )
     {
-        mameJpeg_stream_writeByte( context->output_stream, context->line_buffer[i] );
+        return stream->write_block( stream->callback_param, context->line_buffer, output_bytes );
+    }
+
+    for( size_t i = 0; i < output_bytes; i++ )
+    {
+        MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, context->line_buffer[i] ) );
     }
 
     return true;
@@ -754,15 +1332,16 @@ bool mameJpeg_calcDCValue( mameJpeg_context* context, uint16_t diff_value, uint8
 }
 
 static
-bool mameJpeg_decodeDC( mameJpeg_context* context, uint8_t component_index )
+bool mameJpeg_decodeDC( mameJpeg_context* context, uint8_t component_index, int16_t* coeff_block )
 {
     MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( coeff_block );
 
     uint8_t length = 0;
     MAMEJPEG_CHECK( mameJpeg_getNextDecodedValue( context, 0, component_index, &length ) );
     if( length == 0 )
     {
-        context->info.dct_work_buffer[0] = context->info.component[ component_index ].prev_dc_value;
+        coeff_block[0] = context->info.component[ component_index ].prev_dc_value;
         return true;
     }
 
@@ -772,13 +1351,16 @@ bool mameJpeg_decodeDC( mameJpeg_context* context, uint8_t component_index )
     MAMEJPEG_CHECK( mameJpeg_calcDCValue( context, huffman_dc_value, length, &diff_value ) );
 
     context->info.component[ component_index ].prev_dc_value += diff_value;
-    context->info.dct_work_buffer[0] = context->info.component[ component_index ].prev_dc_value;
+    coeff_block[0] = context->info.component[ component_index ].prev_dc_value;
     return true;
 }
 
 static
-bool mameJpeg_decodeAC( mameJpeg_context* context, uint8_t component_index )
+bool mameJpeg_decodeAC( mameJpeg_context* context, uint8_t component_index, int16_t* coeff_block )
 {
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( coeff_block );
+
     uint8_t elem_num = 1;
     while( elem_num < 64 )
     {
@@ -796,22 +1378,21 @@ bool mameJpeg_decodeAC( mameJpeg_context* context, uint8_t component_index )
             zero_run_length = 16;
         }
 
-        for( uint8_t i = 0; i < zero_run_length; i++ )
-        {
-            uint8_t zigzag_index = mameJpeg_getZigZagIndex( context, elem_num );
-            context->info.dct_work_buffer[zigzag_index] = 0;
-            elem_num++;
-        }
+        /* coeff_block is cleared by the caller, so zero runs are only skipped. */
+        elem_num += zero_run_length;
+        MAMEJPEG_CHECK( elem_num <= 64 );
 
         if( 0 < bit_length  )
         {
+            MAMEJPEG_CHECK( elem_num < 64 );
+
             uint16_t huffman_value = 0;
             MAMEJPEG_CHECK( mameJpeg_stream_readBits( context->input_stream, &huffman_value, 2, bit_length ) );
             int16_t ac_coeff = 0;
             MAMEJPEG_CHECK( mameJpeg_calcDCValue( context, huffman_value, bit_length, &ac_coeff ) );
 
             uint8_t zigzag_index = mameJpeg_getZigZagIndex( context, elem_num );
-            context->info.dct_work_buffer[zigzag_index] = ac_coeff;
+            coeff_block[zigzag_index] = ac_coeff;
 
             elem_num++;
         }
@@ -821,82 +1402,86 @@ bool mameJpeg_decodeAC( mameJpeg_context* context, uint8_t component_index )
 }
 
 static
-bool mameJpeg_applyInverseQunatize( mameJpeg_context* context, uint8_t component_index  )
+bool mameJpeg_applyInverseQunatize( mameJpeg_context* context, uint8_t component_index, const int16_t* coeff_block, double* dct_work_buffer )
 {
     MAMEJPEG_NULL_CHECK( context );
 
     uint8_t table_index = context->info.component[ component_index ].quant_table_index;
+    const uint8_t* quant_table = context->info.quant_table[table_index];
+    MAMEJPEG_NULL_CHECK( quant_table );
     for( int i = 0; i < 64; i++ )
     {
         uint8_t zigzag_index = mameJpeg_getZigZagIndex( context, i );
-        context->info.dct_work_buffer[zigzag_index] *= context->info.quant_table[table_index][i];
+        dct_work_buffer[zigzag_index] = coeff_block[zigzag_index] * quant_table[i];
     }
 
     return true;
 }
 
 static
-bool mameJpeg_applyColorConvert( mameJpeg_context* context, uint16_t hor_block, uint16_t ver_block, uint8_t component_index )
+bool mameJpeg_storeSamples( const double* dct_work_buffer, uint8_t* samples, size_t stride )
 {
-    MAMEJPEG_NULL_CHECK( context );
-
-    int diff_hor_sampling = context->info.component[0].hor_sampling - context->info.component[ component_index ].hor_sampling;
-    int diff_ver_sampling = context->info.component[0].ver_sampling - context->info.component[ component_index ].ver_sampling;
-    int block_width = 8 * ( diff_hor_sampling + 1 );
-    int block_height = 8 * ( diff_ver_sampling + 1 );
-
-    int y_offset = 8 * ver_block;
-    int x_offset = 8 * hor_block;
-    int mcu_width = 8 * context->info.component[0].hor_sampling;
-
-    for( int y = 0; y < block_height; y++ )
+    for( int y = 0; y < 8; y++ )
     {
-        uint16_t dst_index = context->info.component_num * ( ( y + y_offset ) * mcu_width + x_offset );
-        for( int x = 0; x < block_width; x++ )
+        for( int x = 0; x < 8; x++ )
         {
-            uint16_t src_index = 8 * ( y >> diff_ver_sampling ) + ( x >> diff_hor_sampling );
-            for( int i = 0; i < context->info.component_num; i++ )
-            {
-                context->info.mcu_pixels[ dst_index ] += MAMEJPEG_YCBCR_TO_RGB_COEFF[component_index][i] * ( context->info.dct_work_buffer[ src_index ] + MAMEJPEG_YCBCR_TO_RGB_COEFF[component_index][3] );
-                dst_index++;
-            }
+            samples[x] = mameJpeg_roundToSample( dct_work_buffer[ 8 * y + x ] + 128.0 );
         }
+        samples += stride;
     }
 
     return true;
 }
 
 static
-bool mameJpeg_moveMCUToBuffer( mameJpeg_context* context, uint16_t hor_mcu_index, uint16_t ver_mcu_index )
+void mameJpeg_applyColorConvert( const uint8_t* samples, uint8_t* pixel )
+{
+    for( int i = 0; i < 3; i++ )
+    {
+        double value = 0.0;
+        for( int j = 0; j < 3; j++ )
+        {
+            value += MAMEJPEG_YCBCR_TO_RGB_COEFF[j][i] * ( samples[j] + MAMEJPEG_YCBCR_TO_RGB_COEFF[j][3] );
+        }
+        pixel[i] = mameJpeg_roundToSample( value );
+    }
+}
+
+static
+bool mameJpeg_moveMCURowToBuffer( mameJpeg_context* context, uint16_t ver_mcu_index )
 {
     MAMEJPEG_CHECK( context->info.component_num == 1 || context->info.component_num == 3 );
 
-    uint16_t mcu_width = 8 * context->info.component[0].hor_sampling;
-    uint16_t mcu_height = 8 * context->info.component[0].ver_sampling;
-    uint16_t remain_width = MAMEJPEG_MIN( mcu_width, context->info.width - hor_mcu_index * mcu_width );
-    uint16_t remain_height = MAMEJPEG_MIN( mcu_height, context->info.height - ver_mcu_index * mcu_height );
+    const uint8_t* planes[3];
+    size_t strides[3];
+    for( uint8_t i = 0; i < context->info.component_num; i++ )
+    {
+        planes[i] = mameJpeg_getComponentSamples( context, i, &strides[i] );
+    }
+
+    uint16_t remain_height = mameJpeg_getMCURowHeight( context, ver_mcu_index );
     for( uint16_t y = 0; y < remain_height; y++ )
     {
-        uint16_t hor_bytes = context->info.component_num * remain_width;
-        uint16_t src_index = y * context->info.component_num * mcu_width;
-        uint16_t dst_index = context->info.component_num * ( y * context->info.width + mcu_width * hor_mcu_index );
-        for( uint16_t x = 0; x < hor_bytes; x++ )
+        size_t dst_index = (size_t)context->info.component_num * y * context->info.width;
+        uint8_t* dst = context->line_buffer + dst_index;
+        if( context->info.component_num == 1 )
         {
-            context->line_buffer[ dst_index ] = (uint8_t)MAMEJPEG_CLIP( context->info.mcu_pixels[ src_index ], 0.0, 255.0 );
-            context->info.mcu_pixels[ src_index ] = 0.0;
-            src_index++;
-            dst_index++;
+            memcpy( dst, planes[0] + y * strides[0], context->info.width );
+            continue;
         }
-    }
 
-    for( uint16_t y = 0; y < mcu_height; y++ )
-    {
-        uint16_t hor_bytes = context->info.component_num * mcu_width;
-        uint16_t src_index = y * hor_bytes;
-        for( uint16_t x = 0; x < hor_bytes; x++ )
+        const uint8_t* luma = planes[0] + y * strides[0];
+        const uint8_t* cb = planes[1] + ( y >> context->info.component[1].ver_shift ) * strides[1];
+        const uint8_t* cr = planes[2] + ( y >> context->info.component[2].ver_shift ) * strides[2];
+        for( uint16_t x = 0; x < context->info.width; x++ )
         {
-            context->info.mcu_pixels[ src_index ] = 0.0;
-            src_index++;
+            uint8_t samples[3] = {
+                luma[ x ],
+                cb[ x >> context->info.component[1].hor_shift ],
+                cr[ x >> context->info.component[2].hor_shift ]
+            };
+            mameJpeg_applyColorConvert( samples, dst );
+            dst += 3;
         }
     }
 
@@ -904,81 +1489,433 @@ bool mameJpeg_moveMCUToBuffer( mameJpeg_context* context, uint16_t hor_mcu_index
 }
 
 static
-bool mameJpeg_decodeMCU( mameJpeg_context* context, uint16_t hor_mcu_index, uint16_t ver_mcu_index )
+bool mameJpeg_countDecodeRestart( mameJpeg_context* context )
 {
     MAMEJPEG_NULL_CHECK( context );
 
-    for( uint8_t i = 0; i < context->info.component_num; i++ )
+    if( 0 < context->info.restart_interval )
     {
-        uint16_t num_of_hor_8x8blocks = context->info.component[ i ].hor_sampling;
-        uint16_t num_of_ver_8x8blocks = context->info.component[ i ].ver_sampling;
-        for( uint16_t ver_8x8block_index = 0; ver_8x8block_index < num_of_ver_8x8blocks; ver_8x8block_index++ )
-        {
-            for( uint16_t hor_8x8block_index = 0; hor_8x8block_index < num_of_hor_8x8blocks; hor_8x8block_index++ )
-            {
-                MAMEJPEG_CHECK( mameJpeg_decodeDC( context, i ) );
-                MAMEJPEG_CHECK( mameJpeg_decodeAC( context, i ) );
-                MAMEJPEG_CHECK( mameJpeg_applyInverseQunatize( context, i ) );
-                MAMEJPEG_CHECK( mameJpeg_applyDCT( context, false ) );
-                MAMEJPEG_CHECK( mameJpeg_applyColorConvert( context, hor_8x8block_index, ver_8x8block_index, i ) );
-            }
-        }
+        context->cursor.restart_countdown--;
     }
 
-    MAMEJPEG_CHECK( mameJpeg_moveMCUToBuffer( context, hor_mcu_index, ver_mcu_index ) );
-
     return true;
 }
 
 static
-bool mameJpeg_decodeImage( mameJpeg_context* context )
+bool mameJpeg_checkDecodeRestart( mameJpeg_context* context )
 {
     MAMEJPEG_NULL_CHECK( context );
 
-    size_t dct_buffer_size = 64 * sizeof( double );
-    MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, dct_buffer_size, (void**)&context->info.dct_work_buffer ) );
+    /* taken before the next MCU, so no marker is expected after the last one */
+    if( 0 < context->info.restart_interval && context->cursor.restart_countdown == 0 )
+    {
+        MAMEJPEG_CHECK( mameJpeg_restartDecode( context ) );
+        context->cursor.restart_countdown = context->info.restart_interval;
+    }
 
-    size_t mcu_buffer_size = mameJpeg_getMCUBufferSize( context->info.width,
-            context->info.component_num,
-            context->info.component[0].hor_sampling,
-            context->info.component[0].ver_sampling );
-    MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, mcu_buffer_size, (void**)&context->info.mcu_pixels ) );
+    return true;
+}
 
-    context->line_buffer_length = mameJpeg_getLineBufferSize( context->info.width,
-            context->info.component_num,
-            context->info.component[0].ver_sampling );
-    MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, context->line_buffer_length, (void**)&context->line_buffer ) );
+static
+bool mameJpeg_decodeMCU( mameJpeg_context* context, int16_t* coeff_blocks )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( coeff_blocks );
 
-    bool useDRI = 0 < context->info.restart_interval;
-    uint16_t restart_interval = context->info.restart_interval;
+    MAMEJPEG_CHECK( mameJpeg_checkDecodeRestart( context ) );
 
-    uint16_t hor_mcu_num = 0;
-    uint16_t ver_mcu_num = 0;
-    MAMEJPEG_CHECK( mameJpeg_getNumOfMCU( context, &hor_mcu_num, &ver_mcu_num ) );
+    /* cleared per MCU so that a resumed MCU starts from zero again */
+    memset( coeff_blocks, 0x00, sizeof( int16_t ) * 64 * context->info.mcu_block_num );
 
-    for( uint16_t ver_mcu_index = 0; ver_mcu_index < ver_mcu_num; ver_mcu_index++ )
+    int16_t* coeff_block = coeff_blocks;
+    for( uint8_t i = 0; i < context->info.component_num; i++ )
     {
-        for( uint16_t hor_mcu_index = 0; hor_mcu_index < hor_mcu_num; hor_mcu_index++)
+        uint16_t num_of_8x8blocks = context->info.component[ i ].hor_sampling * context->info.component[ i ].ver_sampling;
+        for( uint16_t block_index = 0; block_index < num_of_8x8blocks; block_index++ )
         {
-            MAMEJPEG_CHECK( mameJpeg_decodeMCU( context, hor_mcu_index, ver_mcu_index ) );
+            MAMEJPEG_CHECK( mameJpeg_decodeDC( context, i, coeff_block ) );
+            MAMEJPEG_CHECK( mameJpeg_decodeAC( context, i, coeff_block ) );
+            coeff_block += 64;
+        }
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_decodeMCURow( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    size_t mcu_coeff_num = 64 * context->info.mcu_block_num;
+    while( context->cursor.mcu_col_index < context->info.strip_mcu_num )
+    {
+        int16_t* coeff_blocks = context->info.coeff_blocks + mcu_coeff_num * context->cursor.mcu_col_index;
+        MAMEJPEG_CHECK( mameJpeg_decodeMCU( context, coeff_blocks ) );
+        context->cursor.mcu_col_index++;
+        MAMEJPEG_CHECK( mameJpeg_countDecodeRestart( context ) );
+
+        MAMEJPEG_CHECK( mameJpeg_saveCheckpoint( context ) );
+    }
+    context->cursor.mcu_col_index = 0;
+
+    return true;
+}
+
+static
+bool mameJpeg_transformMCURow( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    uint8_t* planes[3];
+    size_t strides[3];
+    for( uint8_t i = 0; i < context->info.component_num; i++ )
+    {
+        planes[i] = mameJpeg_getComponentSamples( context, i, &strides[i] );
+    }
 
-            if( useDRI )
+    const int16_t* coeff_block = context->info.coeff_blocks;
+    for( uint16_t hor_mcu_index = 0; hor_mcu_index < context->info.strip_mcu_num; hor_mcu_index++ )
+    {
+        for( uint8_t i = 0; i < context->info.component_num; i++ )
+        {
+            uint16_t num_of_hor_8x8blocks = context->info.component[ i ].hor_sampling;
+            uint16_t num_of_ver_8x8blocks = context->info.component[ i ].ver_sampling;
+            uint8_t* samples = planes[i] + 8 * hor_mcu_index * num_of_hor_8x8blocks;
+            for( uint16_t ver_8x8block_index = 0; ver_8x8block_index < num_of_ver_8x8blocks; ver_8x8block_index++ )
             {
-                restart_interval--;
-                if( restart_interval == 0 )
+                for( uint16_t hor_8x8block_index = 0; hor_8x8block_index < num_of_hor_8x8blocks; hor_8x8block_index++ )
                 {
-                    MAMEJPEG_CHECK( mameJpeg_restartDecode( context ) );
-                    restart_interval = context->info.restart_interval;
+                    double dct_work_buffer[64];
+                    MAMEJPEG_CHECK( mameJpeg_applyInverseQunatize( context, i, coeff_block, dct_work_buffer ) );
+                    MAMEJPEG_CHECK( mameJpeg_applyDCT( dct_work_buffer, false ) );
+
+                    uint8_t* block_samples = samples + 8 * ( ver_8x8block_index * strides[i] + hor_8x8block_index );
+                    MAMEJPEG_CHECK( mameJpeg_storeSamples( dct_work_buffer, block_samples, strides[i] ) );
+                    coeff_block += 64;
                 }
             }
         }
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_getScaledOutputIndex( uint8_t scale, uint8_t* index )
+{
+    MAMEJPEG_NULL_CHECK( index );
 
-        MAMEJPEG_CHECK( mameJpeg_writeBuffer( context ) );
+    switch( scale )
+    {
+        case 2: *index = 0; return true;
+        case 4: *index = 1; return true;
+        case 8: *index = 2; return true;
+        default: return false;
     }
+}
 
-    /* cache invalidate */
-    context->input_stream->cache = 0;
-    context->input_stream->cache_use_bits = 0;
+static
+void mameJpeg_getScaledIDCTBasis( uint8_t scale, double basis[8][8] )
+{
+    /* each output sample is the mean of scale 8 point IDCT basis samples */
+    const double pi = 3.14159265358979323846;
+    for( uint8_t x = 0; x < 8 / scale; x++ )
+    {
+        for( uint8_t u = 0; u < 8; u++ )
+        {
+            double normalize = ( u == 0 ) ? sqrt( 1.0 / 8.0 ) : sqrt( 2.0 / 8.0 );
+            double sum = 0.0;
+            for( uint8_t i = 0; i < scale; i++ )
+            {
+                sum += cos( ( 2 * ( x * scale + i ) + 1 ) * u * pi / 16.0 );
+            }
+            basis[x][u] = normalize * sum / scale;
+        }
+    }
+}
+
+static
+bool mameJpeg_applyScaledIDCT( const double* dct_work_buffer, uint8_t scale, const double basis[8][8], uint8_t* samples, size_t stride )
+{
+    MAMEJPEG_NULL_CHECK( dct_work_buffer );
+    MAMEJPEG_NULL_CHECK( samples );
+
+    /* a lone DC term inverse-transforms to a flat DC / 8 */
+    if( scale == 8 )
+    {
+        samples[0] = mameJpeg_roundToSample( dct_work_buffer[0] * 0.125 + 128.0 );
+        return true;
+    }
+
+    /* box average of the 8x8 IDCT output, rows then columns */
+    const uint8_t size = 8 / scale;
+    double row_work_buffer[8][8];
+    for( uint8_t v = 0; v < 8; v++ )
+    {
+        for( uint8_t x = 0; x < size; x++ )
+        {
+            double value = 0.0;
+            for( uint8_t u = 0; u < 8; u++ )
+            {
+                value += basis[x][u] * dct_work_buffer[ 8 * v + u ];
+            }
+            row_work_buffer[v][x] = value;
+        }
+    }
+
+    for( uint8_t y = 0; y < size; y++ )
+    {
+        for( uint8_t x = 0; x < size; x++ )
+        {
+            double value = 0.0;
+            for( uint8_t v = 0; v < 8; v++ )
+            {
+                value += basis[y][v] * row_work_buffer[v][x];
+            }
+            samples[ y * stride + x ] = mameJpeg_roundToSample( value + 128.0 );
+        }
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_storeScaledMCU( mameJpeg_context* context,
+                              const int16_t* coeff_blocks,
+                              uint16_t hor_mcu_index,
+                              uint16_t ver_mcu_index,
+                              uint8_t scale,
+                              const double basis[8][8],
+                              uint8_t* output_buffer )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( coeff_blocks );
+    MAMEJPEG_NULL_CHECK( output_buffer );
+
+    uint16_t output_width = 0;
+    uint16_t output_height = 0;
+    MAMEJPEG_CHECK( mameJpeg_getScaledOutputSize( context, scale, &output_width, &output_height, NULL ) );
+
+    /* every block shrinks to block_size x block_size samples of its own component */
+    const uint8_t block_size = 8 / scale;
+    uint8_t samples[3][ 16 * 16 ];
+    size_t strides[3];
+    const int16_t* coeff_block = coeff_blocks;
+    for( uint8_t i = 0; i < context->info.component_num; i++ )
+    {
+        uint16_t num_of_hor_8x8blocks = context->info.component[ i ].hor_sampling;
+        uint16_t num_of_ver_8x8blocks = context->info.component[ i ].ver_sampling;
+        MAMEJPEG_CHECK( block_size * num_of_hor_8x8blocks <= 16 && block_size * num_of_ver_8x8blocks <= 16 );
+        strides[i] = block_size * num_of_hor_8x8blocks;
+        for( uint16_t ver_8x8block_index = 0; ver_8x8block_index < num_of_ver_8x8blocks; ver_8x8block_index++ )
+        {
+            for( uint16_t hor_8x8block_index = 0; hor_8x8block_index < num_of_hor_8x8blocks; hor_8x8block_index++ )
+            {
+                double dct_work_buffer[64];
+                if( block_size == 1 )
+                {
+                    const uint8_t* quant_table = context->info.quant_table[ context->info.component[i].quant_table_index ];
+                    MAMEJPEG_NULL_CHECK( quant_table );
+                    dct_work_buffer[0] = coeff_block[0] * quant_table[0];
+                }
+                else
+                {
+                    MAMEJPEG_CHECK( mameJpeg_applyInverseQunatize( context, i, coeff_block, dct_work_buffer ) );
+                }
+
+                uint8_t* block_samples = samples[i] + block_size * ( ver_8x8block_index * strides[i] + hor_8x8block_index );
+                MAMEJPEG_CHECK( mameJpeg_applyScaledIDCT( dct_work_buffer, scale, basis, block_samples, strides[i] ) );
+                coeff_block += 64;
+            }
+        }
+    }
+
+    uint8_t mcu_width = block_size * context->info.component[0].hor_sampling;
+    uint8_t mcu_height = block_size * context->info.component[0].ver_sampling;
+    for( uint8_t y = 0; y < mcu_height; y++ )
+    {
+        size_t output_y = (size_t)ver_mcu_index * mcu_height + y;
+        for( uint8_t x = 0; x < mcu_width; x++ )
+        {
+            size_t output_x = (size_t)hor_mcu_index * mcu_width + x;
+            if( output_height <= output_y || output_width <= output_x )
+            {
+                continue;
+            }
+
+            uint8_t* pixel = output_buffer + context->info.component_num * ( output_y * output_width + output_x );
+            if( context->info.component_num == 1 )
+            {
+                pixel[0] = samples[0][ y * strides[0] + x ];
+                continue;
+            }
+
+            /* subsampled components take the nearest sample like the full size output */
+            uint8_t pixel_samples[3];
+            for( uint8_t i = 0; i < 3; i++ )
+            {
+                uint8_t sample_x = x * context->info.component[i].hor_sampling / context->info.component[0].hor_sampling;
+                uint8_t sample_y = y * context->info.component[i].ver_sampling / context->info.component[0].ver_sampling;
+                pixel_samples[i] = samples[i][ sample_y * strides[i] + sample_x ];
+            }
+            mameJpeg_applyColorConvert( pixel_samples, pixel );
+        }
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_storeScaledMCURow( mameJpeg_context* context, uint16_t ver_mcu_index )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    const uint8_t scales[3] = { 2, 4, 8 };
+    size_t mcu_coeff_num = 64 * context->info.mcu_block_num;
+    for( uint8_t output_index = 0; output_index < 3; output_index++ )
+    {
+        if( context->scaled_output[ output_index ] == NULL )
+        {
+            continue;
+        }
+
+        double basis[8][8];
+        mameJpeg_getScaledIDCTBasis( scales[ output_index ], basis );
+
+        for( uint16_t hor_mcu_index = 0; hor_mcu_index < context->info.strip_mcu_num; hor_mcu_index++ )
+        {
+            MAMEJPEG_CHECK( mameJpeg_storeScaledMCU( context,
+                        context->info.coeff_blocks + mcu_coeff_num * hor_mcu_index,
+                        hor_mcu_index,
+                        ver_mcu_index,
+                        scales[ output_index ],
+                        basis,
+                        context->scaled_output[ output_index ] ) );
+        }
+    }
+
+    return true;
+}
+
+bool mameJpeg_getScaledOutputSize( mameJpeg_context* context, uint8_t scale, uint16_t* width_ptr, uint16_t* height_ptr, size_t* output_buffer_size_ptr )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_DECODE );
+    MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_SCAN );
+    MAMEJPEG_CHECK( context->info.component_num == 1 || context->info.component_num == 3 );
+
+    uint8_t output_index = 0;
+    MAMEJPEG_CHECK( mameJpeg_getScaledOutputIndex( scale, &output_index ) );
+    uint16_t output_width = ( context->info.width + scale - 1 ) / scale;
+    uint16_t output_height = ( context->info.height + scale - 1 ) / scale;
+
+    if( width_ptr != NULL )
+    {
+        *width_ptr = output_width;
+    }
+
+    if( height_ptr != NULL )
+    {
+        *height_ptr = output_height;
+    }
+
+    if( output_buffer_size_ptr != NULL )
+    {
+        *output_buffer_size_ptr = (size_t)context->info.component_num * output_width * output_height;
+    }
+
+    return true;
+}
+
+bool mameJpeg_setScaledOutput( mameJpeg_context* context, uint8_t scale, uint8_t* output_buffer, size_t output_buffer_size )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_DECODE );
+    MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_SCAN );
+    MAMEJPEG_CHECK( context->cursor.mcu_row_index == 0 && context->cursor.mcu_col_index == 0 );
+
+    uint8_t output_index = 0;
+    MAMEJPEG_CHECK( mameJpeg_getScaledOutputIndex( scale, &output_index ) );
+
+    /* NULL turns the output off again */
+    if( output_buffer != NULL )
+    {
+        size_t required_size = 0;
+        MAMEJPEG_CHECK( mameJpeg_getScaledOutputSize( context, scale, NULL, NULL, &required_size ) );
+        MAMEJPEG_CHECK( required_size <= output_buffer_size );
+    }
+    context->scaled_output[ output_index ] = output_buffer;
+
+    return true;
+}
+
+static
+bool mameJpeg_startDecodeImage( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_HEADER );
+
+    uint16_t hor_mcu_num = 0;
+    uint16_t ver_mcu_num = 0;
+    MAMEJPEG_CHECK( mameJpeg_getNumOfMCU( context, &hor_mcu_num, &ver_mcu_num ) );
+    MAMEJPEG_CHECK( mameJpeg_setupMCULayout( context, hor_mcu_num ) );
+
+    size_t coeff_buffer_size = mameJpeg_getCoeffBufferSize( context->info.mcu_block_num * hor_mcu_num );
+    MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, coeff_buffer_size, (void**)&context->info.coeff_blocks ) );
+
+    size_t sample_buffer_size = mameJpeg_getSampleBufferSize( context->info.mcu_block_num * hor_mcu_num );
+    MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, sample_buffer_size, (void**)&context->info.mcu_samples ) );
+
+    context->line_buffer_length = mameJpeg_getLineBufferSize( context->info.width,
+            context->info.component_num,
+            context->info.component[0].ver_sampling );
+    MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, context->line_buffer_length, (void**)&context->line_buffer ) );
+
+    context->cursor.phase = MAMEJPEG_PHASE_SCAN;
+    context->cursor.mcu_col_index = 0;
+    context->cursor.mcu_row_index = 0;
+    context->cursor.mcu_row_num = ver_mcu_num;
+    context->cursor.restart_countdown = context->info.restart_interval;
+    context->cursor.restart_index = 0;
+    context->cursor.buffered_rows = 0;
+    context->cursor.consumed_rows = 0;
+
+    return true;
+}
+
+static
+bool mameJpeg_decodeNextMCURow( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_SCAN );
+    MAMEJPEG_CHECK( context->cursor.mcu_row_index < context->cursor.mcu_row_num );
+
+    uint16_t ver_mcu_index = context->cursor.mcu_row_index;
+    MAMEJPEG_CHECK( mameJpeg_decodeMCURow( context ) );
+    MAMEJPEG_CHECK( mameJpeg_storeScaledMCURow( context, ver_mcu_index ) );
+    MAMEJPEG_CHECK( mameJpeg_transformMCURow( context ) );
+    MAMEJPEG_CHECK( mameJpeg_moveMCURowToBuffer( context, ver_mcu_index ) );
+
+    context->cursor.mcu_row_index++;
+    context->cursor.buffered_rows = mameJpeg_getMCURowHeight( context, ver_mcu_index );
+    context->cursor.consumed_rows = 0;
+
+    return true;
+}
+
+static
+bool mameJpeg_decodeImage( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    while( context->cursor.mcu_row_index < context->cursor.mcu_row_num )
+    {
+        uint16_t ver_mcu_index = context->cursor.mcu_row_index;
+        MAMEJPEG_CHECK( mameJpeg_decodeNextMCURow( context ) );
+        MAMEJPEG_CHECK( mameJpeg_writeBuffer( context, ver_mcu_index ) );
+        context->cursor.consumed_rows = context->cursor.buffered_rows;
+    }
 
     return true;
 }
@@ -999,7 +1936,7 @@ bool mameJpeg_decodeDQTSegment( mameJpeg_context* context )
     MAMEJPEG_CHECK( mameJpeg_getSegmentSize( context, &dqt_size ) );
     MAMEJPEG_CHECK( ( dqt_size % ( 64 + 1 ) ) == 0 );
 
-    uint8_t remain_bytes = dqt_size;
+    size_t remain_bytes = dqt_size;
     while( 0 < remain_bytes )
     {
         uint8_t info;
@@ -1007,6 +1944,7 @@ bool mameJpeg_decodeDQTSegment( mameJpeg_context* context )
         MAMEJPEG_CHECK( ( info >> 4 ) == 0 );
 
         uint8_t table_no = info & 0x0f;
+        MAMEJPEG_CHECK( table_no < 4 );
         MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, 64, (void**)&(context->info.quant_table[table_no]) ) );
         for( int i = 0; i < 64; i++ )
         {
@@ -1049,6 +1987,7 @@ bool mameJpeg_decodeSOF0Segment( mameJpeg_context* context )
 
         uint8_t quant_table_index;
         MAMEJPEG_CHECK( mameJpeg_stream_readByte( context->input_stream, &quant_table_index ) );
+        MAMEJPEG_CHECK( quant_table_index < 4 );
         context->info.component[ component_index ].quant_table_index = quant_table_index;
     }
 
@@ -1068,6 +2007,7 @@ bool mameJpeg_decodeDHTSegment( mameJpeg_context* context )
     MAMEJPEG_CHECK( mameJpeg_stream_readByte( context->input_stream, &info ) );
     uint8_t ac_dc = info >> 4;
     uint8_t luma_chroma = info & 0x0f;
+    MAMEJPEG_CHECK( ac_dc < 2 && luma_chroma < 2 );
 
     size_t huffman_table_buffer_size = ( dht_size - 17 ) * sizeof(huffman_element);
     void** huffman_code_table_ptr = (void**)&context->info.huff_table[ac_dc][luma_chroma].elements;
@@ -1118,13 +2058,16 @@ bool mameJpeg_decodeSOSSegment( mameJpeg_context* context )
 
     uint8_t num_of_components;
     MAMEJPEG_CHECK( mameJpeg_stream_readByte( context->input_stream, &num_of_components ) );
+    MAMEJPEG_CHECK( num_of_components <= context->info.component_num );
 
     for( int i = 0; i < num_of_components; i++ )
     {
         uint8_t component_index;
         MAMEJPEG_CHECK( mameJpeg_stream_readByte( context->input_stream, &component_index ) );
+        MAMEJPEG_CHECK( 0 < component_index && component_index <= context->info.component_num );
         uint8_t info;
         MAMEJPEG_CHECK( mameJpeg_stream_readByte( context->input_stream, &info ) );
+        MAMEJPEG_CHECK( ( info & 0xf ) < 2 && ( info >> 4 ) < 2 );
         context->info.component[component_index - 1].huff_table_index[0] = info & 0xf;
         context->info.component[component_index - 1].huff_table_index[1] = info >> 4;
     }
@@ -1137,7 +2080,7 @@ bool mameJpeg_decodeSOSSegment( mameJpeg_context* context )
     MAMEJPEG_CHECK( mameJpeg_stream_readByte( context->input_stream, &dummy ) );
     MAMEJPEG_CHECK( dummy == 0 );
 
-    MAMEJPEG_CHECK( mameJpeg_decodeImage( context ) );
+    MAMEJPEG_CHECK( mameJpeg_startDecodeImage( context ) );
     return true;
 }
 
@@ -1166,9 +2109,22 @@ static
 bool mameJpeg_decodeUnknownSegment( mameJpeg_context* context )
 {
     MAMEJPEG_NULL_CHECK( context );
+
+    /* APPn, COM and the like are stepped over by their length, their payload may contain 0xff */
+    uint16_t segment_size;
+    MAMEJPEG_CHECK( mameJpeg_getSegmentSize( context, &segment_size ) );
+    MAMEJPEG_CHECK( mameJpeg_stream_skipBytes( context->input_stream, segment_size ) );
+
     return true;
 }
 
+static
+bool mameJpeg_isStandaloneMarker( mameJpeg_marker marker )
+{
+    /* TEM and RSTn carry no length field */
+    return ( marker == 0xff01 ) || ( 0xffd0 <= marker && marker <= 0xffd7 );
+}
+
 typedef bool (*mameJpeg_decodeSegmentFuncPtr)(mameJpeg_context*);
 
 struct {
@@ -1241,41 +2197,35 @@ bool mameJpeg_getDecodeBufferSize( mameJpeg_stream_read_callback_ptr read_callba
             uint16_t dht_size;
             MAMEJPEG_CHECK( mameJpeg_getSegmentSize( context, &dht_size ) );
             buffer_size += ( dht_size - 17 ) * sizeof( huffman_element );
-
-            uint8_t dummy;
-            for( uint16_t i = 0; i < dht_size; i++ )
-            {
-                MAMEJPEG_CHECK( mameJpeg_stream_readByte( context->input_stream, &dummy ) );
-            }
+            MAMEJPEG_CHECK( mameJpeg_stream_skipBytes( context->input_stream, dht_size ) );
         }
         else if( marker == MAMEJPEG_MARKER_DQT )
         {
             uint16_t dqt_size;
             MAMEJPEG_CHECK( mameJpeg_getSegmentSize( context, &dqt_size ) );
             buffer_size += 64 * dqt_size / 65;
-
-
-            uint8_t dummy;
-            for( uint16_t i = 0; i < dqt_size; i++ )
-            {
-                MAMEJPEG_CHECK( mameJpeg_stream_readByte( context->input_stream, &dummy ) );
-            }
+            MAMEJPEG_CHECK( mameJpeg_stream_skipBytes( context->input_stream, dqt_size ) );
         }
         else if( marker == MAMEJPEG_MARKER_SOS )
         {
             break;
         }
+        else if( marker != MAMEJPEG_MARKER_SOI && marker != MAMEJPEG_MARKER_EOI && !mameJpeg_isStandaloneMarker( marker ) )
+        {
+            MAMEJPEG_CHECK( mameJpeg_decodeUnknownSegment( context ) );
+        }
     }
 
-    size_t dct_buffer_size = 64 * sizeof( double );
-    size_t mcu_buffer_size = mameJpeg_getMCUBufferSize( context->info.width,
-            context->info.component_num,
-            context->info.component[0].hor_sampling,
-            context->info.component[0].ver_sampling );
+    uint16_t hor_mcu_num = 0;
+    uint16_t ver_mcu_num = 0;
+    MAMEJPEG_CHECK( mameJpeg_getNumOfMCU( context, &hor_mcu_num, &ver_mcu_num ) );
+    MAMEJPEG_CHECK( mameJpeg_setupMCULayout( context, hor_mcu_num ) );
+    size_t mcu_buffer_size = mameJpeg_getCoeffBufferSize( context->info.mcu_block_num * hor_mcu_num )
+                           + mameJpeg_getSampleBufferSize( context->info.mcu_block_num * hor_mcu_num );
     size_t line_buffer_size = mameJpeg_getLineBufferSize( context->info.width,
             context->info.component_num,
             context->info.component[0].ver_sampling );
-    buffer_size += dct_buffer_size + mcu_buffer_size + line_buffer_size;
+    buffer_size += mcu_buffer_size + line_buffer_size;
 
     if( width_ptr != NULL )
     {
@@ -1300,409 +2250,385 @@ bool mameJpeg_getDecodeBufferSize( mameJpeg_stream_read_callback_ptr read_callba
     return true;
 }
 
-bool mameJpeg_decode( mameJpeg_context* context )
+static
+bool mameJpeg_nextMemorySegment( const uint8_t* data,
+                                 size_t size,
+                                 size_t* pos_ptr,
+                                 uint8_t* code_ptr,
+                                 const uint8_t** payload_ptr,
+                                 size_t* payload_size_ptr )
 {
-    MAMEJPEG_NULL_CHECK( context );
-    MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_DECODE );
-
-    mameJpeg_marker marker;
-    while( mameJpeg_getNextMarker( context, &marker ) )
+    /* steps over one segment by its length, stops at SOS and EOI */
+    size_t pos = *pos_ptr;
+    while( pos + 4 <= size )
     {
-        int func_index = 0;
-        while( ( decode_func_table[ func_index ].marker != marker )
-                && ( decode_func_table[ func_index ].marker != MAMEJPEG_MARKER_UNKNOWN ) )
+        MAMEJPEG_CHECK( data[pos] == 0xff );
+        uint8_t code = data[ pos + 1 ];
+        if( code == 0xff )
+        {
+            pos++;
+            continue;
+        }
+        MAMEJPEG_CHECK( code != 0xd9 && code != 0xda );
+        if( code == 0x01 || ( 0xd0 <= code && code <= 0xd7 ) )
         {
-            func_index++;
+            pos += 2;
+            continue;
         }
 
-        MAMEJPEG_CHECK( decode_func_table[ func_index ].decode_func( context ) );
+        size_t segment_size = ( data[ pos + 2 ] << 8 ) | data[ pos + 3 ];
+        MAMEJPEG_CHECK( 2 <= segment_size );
+        MAMEJPEG_CHECK( pos + 2 + segment_size <= size );
+
+        *code_ptr = code;
+        *payload_ptr = data + pos + 4;
+        *payload_size_ptr = segment_size - 2;
+        *pos_ptr = pos + 2 + segment_size;
+        return true;
     }
 
-    return true;
+    return false;
 }
 
-static const double MAMEJPEG_RGB_TO_YCBCR_COEFF[4][3] = { 
-    { 0.299, -0.169,  0.500 },
-    { 0.587, -0.331, -0.419 },
-    { 0.114,  0.500, -0.081 },
-    { -128 ,      0,      0},
-
-};
-
-static const uint8_t MAMEJPEG_DEFAULT_QUANT_TABLE[2][64] = {
-    {
-        /*
-           16,  11,  10,  16,  24,  40,  51,  61,
-           12,  12,  14,  19,  26,  58,  60,  55,
-           14,  13,  16,  24,  40,  57,  69,  56,
-           14,  17,  22,  29,  51,  87,  80,  62,
-           18,  22,  37,  56,  68, 109, 103,  77,
-           24,  35,  55,  64,  81, 104, 113,  92,
-           49,  64,  78,  87, 103, 121, 120, 101,
-           72,  92,  95,  98, 112, 100, 103,  99
-           */
-        1,  1, 1, 1, 1, 1, 1, 1,
-        1,  1, 1, 1, 1, 1, 1, 1,
-        1,  1, 1, 1, 1, 1, 1, 1,
-        1,  1, 1, 1, 1, 1, 1, 1,
-        1,  1, 1, 1, 1, 1, 1, 1,
-        1,  1, 1, 1, 1, 1, 1, 1,
-        1,  1, 1, 1, 1, 1, 1, 1,
-        1,  1, 1, 1, 1, 1, 1, 1
-    },
+bool mameJpeg_probeMemory( const uint8_t* data, size_t size, mameJpeg_probe_info* info )
+{
+    MAMEJPEG_NULL_CHECK( data );
+    MAMEJPEG_NULL_CHECK( info );
+    MAMEJPEG_CHECK( 4 <= size && data[0] == 0xff && data[1] == 0xd8 );
+
+    /* walks the segment lengths directly, the payloads are never read */
+    size_t pos = 2;
+    uint8_t code = 0;
+    const uint8_t* sof = NULL;
+    size_t sof_size = 0;
+    while( mameJpeg_nextMemorySegment( data, size, &pos, &code, &sof, &sof_size ) )
     {
-        /*
-           17, 18, 24, 47, 99, 99, 99, 99,
-           18, 21, 26, 66, 99, 99, 99, 99,
-           24, 26, 56, 99, 99, 99, 99, 99,
-           47, 66, 99, 99, 99, 99, 99, 99,
-           99, 99, 99, 99, 99, 99, 99, 99,
-           99, 99, 99, 99, 99, 99, 99, 99,
-           99, 99, 99, 99, 99, 99, 99, 99,
-           99, 99, 99, 99, 99, 99, 99, 99
-           */
-        1,  1, 1, 1, 1, 1, 1, 1,
-        1,  1, 1, 1, 1, 1, 1, 1,
-        1,  1, 1, 1, 1, 1, 1, 1,
-        1,  1, 1, 1, 1, 1, 1, 1,
-        1,  1, 1, 1, 1, 1, 1, 1,
-        1,  1, 1, 1, 1, 1, 1, 1,
-        1,  1, 1, 1, 1, 1, 1, 1,
-        1,  1, 1, 1, 1, 1, 1, 1
+        /* SOF0 to SOF15 except DHT, JPG and DAC */
+        bool is_sof = ( 0xc0 <= code && code <= 0xcf ) && code != 0xc4 && code != 0xc8 && code != 0xcc;
+        if( is_sof )
+        {
+            MAMEJPEG_CHECK( 6 <= sof_size );
+            uint8_t component_num = sof[5];
+            MAMEJPEG_CHECK( 0 < component_num && component_num <= 3 );
+            MAMEJPEG_CHECK( 6 + 3 * (size_t)component_num <= sof_size );
+
+            memset( info, 0x00, sizeof( mameJpeg_probe_info ) );
+            info->height = ( sof[1] << 8 ) | sof[2];
+            info->width = ( sof[3] << 8 ) | sof[4];
+            info->component_num = component_num;
+            for( uint8_t i = 0; i < component_num; i++ )
+            {
+                info->hor_sampling[i] = sof[ 6 + 3 * i + 1 ] >> 4;
+                info->ver_sampling[i] = sof[ 6 + 3 * i + 1 ] & 0x0f;
+            }
+            info->is_baseline = ( code == 0xc0 );
+            return true;
+        }
     }
-};
 
-static const uint8_t MAMEJPEG_DEFAULT_HUFFMAN_CODE_BITS[2][2][16] = {
-    {
-        { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 },
-        { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 },
-    },
+    return false;
+}
+
+static
+uint32_t mameJpeg_readTiffValue( const uint8_t* data, size_t bytes, bool is_big_endian )
+{
+    uint32_t value = 0;
+    for( size_t i = 0; i < bytes; i++ )
     {
-        { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d },
-        { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 },
+        size_t index = is_big_endian ? i : ( bytes - 1 - i );
+        value = ( value << 8 ) | data[index];
     }
-};
-
-static const uint8_t MAMEJPEG_DEFAULT_DC_LUMA_HUFFMAN_CODE_VALUE[] = {
-    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11
-};
-
-static const uint8_t MAMEJPEG_DEFAULT_DC_CHROMA_HUFFMAN_CODE_VALUE[] = {
-    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11
-};
-
-static const uint8_t MAMEJPEG_DEFAULT_AC_LUMA_HUFFMAN_CODE_VALUE[] = {
-    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
-    0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
-    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
-    0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
-    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
-    0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
-    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
-    0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
-    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
-    0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
-    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
-    0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
-    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
-    0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
-    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
-    0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
-    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4,
-    0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
-    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea,
-    0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
-    0xf9, 0xfa
-};
-
-static const uint8_t MAMEJPEG_DEFAULT_AC_CHROMA_HUFFMAN_CODE_VALUE[] = {
-    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21,
-    0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
-    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
-    0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
-    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34,
-    0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
-    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38,
-    0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
-    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
-    0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
-    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
-    0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
-    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96,
-    0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
-    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
-    0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
-    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2,
-    0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
-    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
-    0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
-    0xf9, 0xfa
-};
+    return value;
+}
 
-static const uint8_t* MAMEJPEG_DEFAULT_HUFFMAN_CODE_VALUE[2][2] = {
+bool mameJpeg_findExifThumbnail( const uint8_t* data, size_t size, const uint8_t** thumbnail_ptr, size_t* thumbnail_size_ptr )
+{
+    MAMEJPEG_NULL_CHECK( data );
+    MAMEJPEG_NULL_CHECK( thumbnail_ptr );
+    MAMEJPEG_NULL_CHECK( thumbnail_size_ptr );
+    MAMEJPEG_CHECK( 4 <= size && data[0] == 0xff && data[1] == 0xd8 );
+
+    /* EXIF must be in APP1 ahead of the frame, the search stops at SOF */
+    size_t pos = 2;
+    uint8_t code = 0;
+    const uint8_t* app1 = NULL;
+    size_t app1_size = 0;
+    static const uint8_t exif_id[6] = { 'E', 'x', 'i', 'f', 0x00, 0x00 };
+    do
     {
-        MAMEJPEG_DEFAULT_DC_LUMA_HUFFMAN_CODE_VALUE,
-        MAMEJPEG_DEFAULT_DC_CHROMA_HUFFMAN_CODE_VALUE
-    },
+        MAMEJPEG_CHECK( mameJpeg_nextMemorySegment( data, size, &pos, &code, &app1, &app1_size ) );
+        MAMEJPEG_CHECK( code < 0xc0 || 0xcf < code || code == 0xc4 || code == 0xc8 || code == 0xcc );
+    } while( code != 0xe1 || app1_size < 6 || memcmp( app1, exif_id, 6 ) != 0 );
+
+    /* TIFF header, IFD offsets are relative to its start */
+    const uint8_t* tiff = app1 + 6;
+    size_t tiff_size = app1_size - 6;
+    MAMEJPEG_CHECK( 8 <= tiff_size );
+    MAMEJPEG_CHECK( ( tiff[0] == 'I' && tiff[1] == 'I' ) || ( tiff[0] == 'M' && tiff[1] == 'M' ) );
+    bool is_big_endian = ( tiff[0] == 'M' );
+    MAMEJPEG_CHECK( mameJpeg_readTiffValue( tiff + 2, 2, is_big_endian ) == 42 );
+
+    /* IFD1 follows the entries of IFD0 */
+    size_t ifd = mameJpeg_readTiffValue( tiff + 4, 4, is_big_endian );
+    MAMEJPEG_CHECK( 8 <= ifd && ifd + 2 <= tiff_size );
+    size_t entry_num = mameJpeg_readTiffValue( tiff + ifd, 2, is_big_endian );
+    MAMEJPEG_CHECK( ifd + 2 + 12 * entry_num + 4 <= tiff_size );
+    ifd = mameJpeg_readTiffValue( tiff + ifd + 2 + 12 * entry_num, 4, is_big_endian );
+    MAMEJPEG_CHECK( 8 <= ifd && ifd + 2 <= tiff_size );
+    entry_num = mameJpeg_readTiffValue( tiff + ifd, 2, is_big_endian );
+    MAMEJPEG_CHECK( ifd + 2 + 12 * entry_num <= tiff_size );
+
+    /* JPEGInterchangeFormat and JPEGInterchangeFormatLength, LONG values */
+    size_t offset = 0;
+    size_t length = 0;
+    for( size_t i = 0; i < entry_num; i++ )
     {
-        MAMEJPEG_DEFAULT_AC_LUMA_HUFFMAN_CODE_VALUE,
-        MAMEJPEG_DEFAULT_AC_CHROMA_HUFFMAN_CODE_VALUE
+        const uint8_t* entry = tiff + ifd + 2 + 12 * i;
+        uint32_t tag = mameJpeg_readTiffValue( entry, 2, is_big_endian );
+        if( tag == 0x0201 )
+        {
+            offset = mameJpeg_readTiffValue( entry + 8, 4, is_big_endian );
+        }
+        else if( tag == 0x0202 )
+        {
+            length = mameJpeg_readTiffValue( entry + 8, 4, is_big_endian );
+        }
     }
-};
+    MAMEJPEG_CHECK( 0 < offset && 4 <= length );
+    MAMEJPEG_CHECK( offset <= tiff_size && length <= tiff_size - offset );
+    MAMEJPEG_CHECK( tiff[offset] == 0xff && tiff[ offset + 1 ] == 0xd8 );
 
-static
-bool mameJpeg_restartEncode( mameJpeg_context* context )
-{
-    MAMEJPEG_NULL_CHECK( context );
+    *thumbnail_ptr = tiff + offset;
+    *thumbnail_size_ptr = length;
 
-    context->info.component[0].prev_dc_value = 0;
-    context->info.component[1].prev_dc_value = 0;
-    context->info.component[2].prev_dc_value = 0;
     return true;
 }
 
 static
-bool mameJpeg_getInputBytes( mameJpeg_context* context, uint16_t* output_bytes )
+bool mameJpeg_decodeSegment( mameJpeg_context* context, mameJpeg_marker marker )
 {
     MAMEJPEG_NULL_CHECK( context );
-    MAMEJPEG_NULL_CHECK( output_bytes );
-
-    *output_bytes = context->info.component_num * 8 * context->info.component[0].ver_sampling * context->info.width;
-    return true;
-}
 
-static
-bool mameJpeg_readIntoBuffer( mameJpeg_context* context )
-{
-    uint16_t output_bytes = 0;
-    MAMEJPEG_CHECK( mameJpeg_getInputBytes( context, &output_bytes ) );
+    int func_index = 0;
+    while( ( decode_func_table[ func_index ].marker != marker )
+            && ( decode_func_table[ func_index ].marker != MAMEJPEG_MARKER_UNKNOWN ) )
+    {
+        func_index++;
+    }
 
-    for( uint16_t i = 0; i < output_bytes; i++ )
+    if( decode_func_table[ func_index ].marker == MAMEJPEG_MARKER_UNKNOWN && mameJpeg_isStandaloneMarker( marker ) )
     {
-        mameJpeg_stream_readByte( context->input_stream, &(context->line_buffer[i]) );
+        return true;
     }
 
-    return true;
+    return decode_func_table[ func_index ].decode_func( context );
 }
 
-static
-bool mameJpeg_applyEncodeColorConvert( mameJpeg_context* context, uint16_t hor_block, uint16_t ver_block, uint8_t component_index )
+bool mameJpeg_setInputSkipCallback( mameJpeg_context* context, mameJpeg_stream_skip_callback_ptr input_skip_callback )
 {
     MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_DECODE );
 
-    int diff_hor_sampling = context->info.component[0].hor_sampling - context->info.component[ component_index ].hor_sampling;
-    int diff_ver_sampling = context->info.component[0].ver_sampling - context->info.component[ component_index ].ver_sampling;
-    int block_width = 8 * ( diff_hor_sampling + 1 );
-    int block_height = 8 * ( diff_ver_sampling + 1 );
+    /* called with the input callback param, NULL falls back to reading the bytes */
+    context->input_stream->skip = input_skip_callback;
 
-    int y_offset = 8 * ver_block;
-    int x_offset = 8 * hor_block;
-    int mcu_width = 8 * context->info.component[0].hor_sampling;
+    return true;
+}
 
-    for( int i = 0; i < 64; i++ )
-    {
-        context->info.dct_work_buffer[i] = 0.0;
-    }
+bool mameJpeg_readHeader( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_DECODE );
 
-    for( int y = 0; y < block_height; y += ( 1 + diff_ver_sampling ) )
+    /* parse segments until SOS has set up the scan */
+    while( context->cursor.phase == MAMEJPEG_PHASE_HEADER )
     {
-        uint16_t src_index = context->info.component_num * ( ( y + y_offset ) * mcu_width + x_offset );
-        for( int x = 0; x < block_width; x++ )
-        {
-            uint16_t dst_index = 8 * ( y >> diff_ver_sampling ) + ( x >> diff_hor_sampling );
-            for( int i = 0; i < context->info.component_num; i++ )
-            {
-                if( context->info.component_num == 1 )
-                {
-                    context->info.dct_work_buffer[ dst_index ] += context->info.mcu_pixels[ src_index ];
-                }
-                else
-                {
-                    context->info.dct_work_buffer[ dst_index ] += MAMEJPEG_RGB_TO_YCBCR_COEFF[i][component_index] * ( context->info.mcu_pixels[ src_index ] ) ;
-                }
-                src_index++;
-            }
-            context->info.dct_work_buffer[ dst_index ] += MAMEJPEG_RGB_TO_YCBCR_COEFF[3][component_index];
-        }
+        mameJpeg_marker marker;
+        MAMEJPEG_CHECK( mameJpeg_getNextMarker( context, &marker ) );
+        MAMEJPEG_CHECK( mameJpeg_decodeSegment( context, marker ) );
     }
 
     return true;
 }
 
-static
-bool mameJpeg_applyQuantize( mameJpeg_context* context, uint8_t component_index  )
+bool mameJpeg_getImageInfo( mameJpeg_context* context,
+        uint16_t* width_ptr,
+        uint16_t* height_ptr,
+        uint8_t* component_num_ptr )
 {
     MAMEJPEG_NULL_CHECK( context );
 
-    uint8_t table_index = context->info.component[ component_index ].quant_table_index;
-    for( int i = 0; i < 64; i++ )
+    if( width_ptr != NULL )
     {
-        uint8_t zigzag_index = mameJpeg_getZigZagIndex( context, i );
-        context->info.dct_work_buffer[zigzag_index] /= context->info.quant_table[table_index][i];
+        *width_ptr = context->info.width;
+    }
+
+    if( height_ptr != NULL )
+    {
+        *height_ptr = context->info.height;
+    }
+
+    if( component_num_ptr != NULL )
+    {
+        *component_num_ptr = context->info.component_num;
     }
 
     return true;
 }
 
-static
-bool mameJpeg_encodeHuffmanCode( mameJpeg_context* context, uint8_t ac_dc, uint8_t table_index, uint16_t value, uint8_t code_length, uint16_t* code )
+bool mameJpeg_readScanlines( mameJpeg_context* context, uint8_t* dst, size_t max_rows, size_t* read_rows_ptr )
 {
     MAMEJPEG_NULL_CHECK( context );
-    MAMEJPEG_CHECK( 0 < code_length );
+    MAMEJPEG_NULL_CHECK( dst );
+    MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_DECODE );
+    MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_SCAN );
 
-    uint16_t from_index = ( code_length == 0 ) ? 0 : context->info.huff_table[ac_dc][table_index].offsets[ code_length - 1 ];
-    uint16_t to_index = context->info.huff_table[ac_dc][table_index].offsets[ code_length ];
-    for( uint16_t i = from_index; i < to_index; i++ )
+    size_t row_bytes = (size_t)context->info.component_num * context->info.width;
+    size_t read_rows = 0;
+    while( read_rows < max_rows )
     {
-        if( context->info.huff_table[ac_dc][table_index].elements[i].value == value )
+        if( context->cursor.consumed_rows == context->cursor.buffered_rows )
         {
-            *code = context->info.huff_table[ac_dc][table_index].elements[i].code;
-            return true;
+            if( context->cursor.mcu_row_num <= context->cursor.mcu_row_index )
+            {
+                break;
+            }
+            MAMEJPEG_CHECK( mameJpeg_decodeNextMCURow( context ) );
         }
+
+        size_t buffered_rows = context->cursor.buffered_rows - context->cursor.consumed_rows;
+        size_t copy_rows = MAMEJPEG_MIN( max_rows - read_rows, buffered_rows );
+        memcpy( dst + read_rows * row_bytes,
+                context->line_buffer + context->cursor.consumed_rows * row_bytes,
+                copy_rows * row_bytes );
+        context->cursor.consumed_rows += copy_rows;
+        read_rows += copy_rows;
     }
 
-    return false;
+    if( read_rows_ptr != NULL )
+    {
+        *read_rows_ptr = read_rows;
+    }
+
+    return true;
 }
 
 static
-bool mameJpeg_putNextEncodedValue( mameJpeg_context* context, uint8_t ac_dc, uint8_t component_index, uint16_t raw_value )
+bool mameJpeg_decodeTrailer( mameJpeg_context* context )
 {
     MAMEJPEG_NULL_CHECK( context );
 
-    for( uint8_t code_length = 1; code_length <= 16; code_length++ )
+    while( context->cursor.phase == MAMEJPEG_PHASE_TRAILER )
     {
-        uint16_t code = 0;
-        bool ret = mameJpeg_encodeHuffmanCode( context, ac_dc, context->info.component[ component_index ].huff_table_index[ac_dc], raw_value, code_length, &code );
-        if( ret )
+        mameJpeg_marker marker;
+        if( !mameJpeg_getNextMarker( context, &marker ) )
         {
-            MAMEJPEG_CHECK( mameJpeg_stream_writeBits( context->output_stream, &code, code_length ) );
-            return true;
+            /* a missing EOI is tolerated unless more input can still be pushed */
+            MAMEJPEG_CHECK( !context->push_source.is_exhausted || context->push_source.is_finished );
+            context->cursor.phase = MAMEJPEG_PHASE_DONE;
+            break;
         }
+
+        MAMEJPEG_CHECK( marker != MAMEJPEG_MARKER_SOS );
+        MAMEJPEG_CHECK( mameJpeg_decodeSegment( context, marker ) );
+        if( marker == MAMEJPEG_MARKER_EOI )
+        {
+            context->cursor.phase = MAMEJPEG_PHASE_DONE;
+        }
+        MAMEJPEG_CHECK( mameJpeg_saveCheckpoint( context ) );
     }
 
-    return false;
+    return true;
 }
 
 static
-bool mameJpeg_calcEncodeDCValue( mameJpeg_context* context, int16_t diff_value, uint16_t* dc_value,  uint8_t* length )
+bool mameJpeg_endDecodeImage( mameJpeg_context* context )
 {
     MAMEJPEG_NULL_CHECK( context );
-    MAMEJPEG_NULL_CHECK( dc_value );
-    MAMEJPEG_NULL_CHECK( length );
+    MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_SCAN );
 
-    *length = 0;
-    int16_t abs_value = abs( diff_value );
-    while( 0 < abs_value )
-    {
-        (*length)++;
-        abs_value >>= 1;
-    }
+    /* cache invalidate */
+    context->input_stream->cache = 0;
+    context->input_stream->cache_use_bits = 0;
+    context->cursor.phase = MAMEJPEG_PHASE_TRAILER;
 
-    int base_value = ( 0 < diff_value ) ? 0 : ( ( 1 << *length ) - 1 );
-    *dc_value = diff_value + base_value;
     return true;
 }
 
-static
-bool mameJpeg_encodeDC( mameJpeg_context* context, uint8_t component_index )
+bool mameJpeg_finish( mameJpeg_context* context )
 {
     MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_DECODE );
 
-    int16_t diff_value = context->info.dct_work_buffer[0] - context->info.component[ component_index ].prev_dc_value ;
-    context->info.component[ component_index ].prev_dc_value += diff_value;
-
-    uint16_t huffman_dc_value;
-    uint8_t length;
-    MAMEJPEG_CHECK( mameJpeg_calcEncodeDCValue( context, diff_value, &huffman_dc_value, &length ) );
+    bool is_completed = ( context->cursor.mcu_row_num <= context->cursor.mcu_row_index )
+                     && ( context->cursor.consumed_rows == context->cursor.buffered_rows );
+    if( !is_completed )
+    {
+        /* stopped early, the rest of the stream is left unread */
+        context->cursor.phase = MAMEJPEG_PHASE_DONE;
+        return true;
+    }
 
-    MAMEJPEG_CHECK( mameJpeg_putNextEncodedValue( context, 0, component_index, length ) );
-    MAMEJPEG_CHECK( mameJpeg_stream_writeBits( context->output_stream, &huffman_dc_value, length ) );
+    MAMEJPEG_CHECK( mameJpeg_endDecodeImage( context ) );
+    MAMEJPEG_CHECK( mameJpeg_decodeTrailer( context ) );
 
     return true;
 }
 
-static
-bool mameJpeg_encodeAC( mameJpeg_context* context, uint8_t component_index )
+bool mameJpeg_decode( mameJpeg_context* context )
 {
-    uint8_t elem_num = 1;
-    while( elem_num < 64 )
-    {
-        uint8_t zero_run_length = 0;
-        uint8_t zigzag_index = mameJpeg_getZigZagIndex( context, elem_num );
-        int16_t current_value = (int16_t)context->info.dct_work_buffer[zigzag_index];
-        while( current_value == 0 && elem_num < 64 )
-        {
-            zero_run_length++;
-            elem_num++;
-            zigzag_index = mameJpeg_getZigZagIndex( context, elem_num );
-            current_value = context->info.dct_work_buffer[zigzag_index];
-        }
-
-        uint8_t bit_length = 0;
-        if( elem_num == 64 &&  0 < zero_run_length )
-        {
-            zero_run_length = 0;
-            bit_length = 0;
-
-            uint8_t value = ( zero_run_length << 4 ) | bit_length;
-            MAMEJPEG_CHECK( mameJpeg_putNextEncodedValue( context, 1, component_index, value ) );
-            break;
-        }
-        else
-        {
-            while( 16 <= zero_run_length )
-            {
-                uint8_t value = ( 15 << 4 ) | 0;
-                MAMEJPEG_CHECK( mameJpeg_putNextEncodedValue( context, 1, component_index, value ) );
-
-                zero_run_length -= 16;
-            }
-        }
-
-        int16_t raw_value = current_value;
-        uint16_t huff_value = 0;
-        MAMEJPEG_CHECK( mameJpeg_calcEncodeDCValue( context, raw_value, &huff_value, &bit_length ) );
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_DECODE );
 
-        uint8_t value = ( zero_run_length << 4 ) | bit_length;
-        MAMEJPEG_CHECK( mameJpeg_putNextEncodedValue( context, 1, component_index, value ) );
+    MAMEJPEG_CHECK( mameJpeg_readHeader( context ) );
+    MAMEJPEG_CHECK( mameJpeg_decodeImage( context ) );
+    MAMEJPEG_CHECK( mameJpeg_finish( context ) );
 
-        MAMEJPEG_CHECK( mameJpeg_stream_writeBits( context->output_stream, &huff_value, bit_length ) );
-        elem_num++;
-    }
     return true;
 }
 
 static
-bool mameJpeg_moveBufferToMCU( mameJpeg_context* context, uint16_t hor_mcu_index, uint16_t ver_mcu_index )
+bool mameJpeg_getFormat( mameJpeg_context* context, mameJpeg_format* format )
 {
-    MAMEJPEG_CHECK( context->info.component_num == 1 || context->info.component_num == 3 );
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( format );
 
-    uint16_t mcu_width = 8 * context->info.component[0].hor_sampling;
-    uint16_t mcu_height = 8 * context->info.component[0].ver_sampling;
-    for( uint16_t y = 0; y < mcu_height; y++ )
+    /* chroma is never subsampled relative to the MCU in the formats the encoder writes */
+    for( uint8_t i = 1; i < context->info.component_num; i++ )
     {
-        uint16_t hor_bytes = context->info.component_num * mcu_width;
-        uint16_t src_index = context->info.component_num * ( y * context->info.width + mcu_width * hor_mcu_index );
-        uint16_t dst_index = y * hor_bytes;
-        for( uint16_t x = 0; x < hor_bytes; x++ )
-        {
-            context->info.mcu_pixels[ dst_index ] = context->line_buffer[ src_index ];
+        MAMEJPEG_CHECK( context->info.component[i].hor_sampling == 1 );
+        MAMEJPEG_CHECK( context->info.component[i].ver_sampling == 1 );
+    }
 
-            src_index++;
-            dst_index++;
+    const mameJpeg_format formats[] = {
+        MAMEJPEG_FORMAT_YCBCR_444,
+        MAMEJPEG_FORMAT_YCBCR_422v,
+        MAMEJPEG_FORMAT_YCBCR_422h,
+        MAMEJPEG_FORMAT_YCBCR_420,
+        MAMEJPEG_FORMAT_Y_444,
+    };
+    for( size_t i = 0; i < sizeof( formats ) / sizeof( formats[0] ); i++ )
+    {
+        if( mameJpeg_getComponentNum( formats[i] ) == context->info.component_num
+                && mameJpeg_getLumaHorSampling( formats[i] ) == context->info.component[0].hor_sampling
+                && mameJpeg_getLumaVerSampling( formats[i] ) == context->info.component[0].ver_sampling )
+        {
+            *format = formats[i];
+            return true;
         }
     }
 
-    return true;
+    return false;
 }
 
 static
-bool mameJpeg_encodeMCU( mameJpeg_context* context, uint16_t hor_mcu_index, uint16_t ver_mcu_index )
+bool mameJpeg_storeCoefficientMCU( mameJpeg_context* context, mameJpeg_coefficients* coefficients, uint16_t hor_mcu_index, uint16_t ver_mcu_index, const int16_t* coeff_blocks )
 {
     MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( coefficients );
+    MAMEJPEG_NULL_CHECK( coeff_blocks );
 
-    MAMEJPEG_CHECK( mameJpeg_moveBufferToMCU( context, hor_mcu_index, ver_mcu_index ) );
-
+    const int16_t* coeff_block = coeff_blocks;
     for( uint8_t i = 0; i < context->info.component_num; i++ )
     {
         uint16_t num_of_hor_8x8blocks = context->info.component[ i ].hor_sampling;
@@ -1711,11 +2637,11 @@ bool mameJpeg_encodeMCU( mameJpeg_context* context, uint16_t hor_mcu_index, uint
         {
             for( uint16_t hor_8x8block_index = 0; hor_8x8block_index < num_of_hor_8x8blocks; hor_8x8block_index++ )
             {
-                MAMEJPEG_CHECK( mameJpeg_applyEncodeColorConvert( context, hor_8x8block_index, ver_8x8block_index, i ) );
-                MAMEJPEG_CHECK( mameJpeg_applyDCT( context, true ) );
-                MAMEJPEG_CHECK( mameJpeg_applyQuantize( context, i ) );
-                MAMEJPEG_CHECK( mameJpeg_encodeDC( context, i ) );
-                MAMEJPEG_CHECK( mameJpeg_encodeAC( context, i ) );
+                size_t block_x = (size_t)hor_mcu_index * num_of_hor_8x8blocks + hor_8x8block_index;
+                size_t block_y = (size_t)ver_mcu_index * num_of_ver_8x8blocks + ver_8x8block_index;
+                size_t block_index = block_y * coefficients->component[i].hor_block_num + block_x;
+                memcpy( coefficients->component[i].blocks + 64 * block_index, coeff_block, sizeof( int16_t ) * 64 );
+                coeff_block += 64;
             }
         }
     }
@@ -1724,318 +2650,2956 @@ bool mameJpeg_encodeMCU( mameJpeg_context* context, uint16_t hor_mcu_index, uint
 }
 
 static
-bool mameJpeg_encodeImage( mameJpeg_context* context )
+bool mameJpeg_getCoefficientWindow( mameJpeg_context* context, uint16_t* first_mcu_col, uint16_t* first_mcu_row, uint16_t* mcu_col_num, uint16_t* mcu_row_num )
 {
     MAMEJPEG_NULL_CHECK( context );
 
-    size_t dct_buffer_size = 64 * sizeof( double );
-    MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, dct_buffer_size, (void**)&context->info.dct_work_buffer ) );
-
-    size_t mcu_buffer_size = mameJpeg_getMCUBufferSize( context->info.width,
-            context->info.component_num,
-            context->info.component[0].hor_sampling,
-            context->info.component[0].ver_sampling );
-    MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, mcu_buffer_size, (void**)&context->info.mcu_pixels ) );
-
-    context->line_buffer_length = mameJpeg_getLineBufferSize( context->info.width,
-            context->info.component_num,
-            context->info.component[0].ver_sampling );
-    MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, context->line_buffer_length, (void**)&context->line_buffer ) );
-
-    bool useDRI = 0 < context->info.restart_interval;
-    uint16_t restart_interval = context->info.restart_interval;
-
     uint16_t hor_mcu_num = 0;
     uint16_t ver_mcu_num = 0;
     MAMEJPEG_CHECK( mameJpeg_getNumOfMCU( context, &hor_mcu_num, &ver_mcu_num ) );
-
-    for( uint16_t ver_mcu_index = 0; ver_mcu_index < ver_mcu_num; ver_mcu_index++ )
+    if( !context->crop_window.is_enabled )
     {
-        MAMEJPEG_CHECK( mameJpeg_readIntoBuffer( context ) );
-        for( uint16_t hor_mcu_index = 0; hor_mcu_index < hor_mcu_num; hor_mcu_index++)
-        {
-            MAMEJPEG_CHECK( mameJpeg_encodeMCU( context, hor_mcu_index, ver_mcu_index ) );
-
-            if( useDRI )
-            {
-                restart_interval--;
-                if( restart_interval == 0 )
-                {
-                    MAMEJPEG_CHECK( mameJpeg_restartEncode( context ) );
-                    restart_interval = context->info.restart_interval;
-                }
-            }
-        }
+        *first_mcu_col = 0;
+        *first_mcu_row = 0;
+        *mcu_col_num = hor_mcu_num;
+        *mcu_row_num = ver_mcu_num;
+        return true;
     }
 
-    mameJpeg_stream_flushBits( context->output_stream );
+    size_t mcu_width = 8 * context->info.component[0].hor_sampling;
+    size_t mcu_height = 8 * context->info.component[0].ver_sampling;
+    *first_mcu_col = context->crop_window.x / mcu_width;
+    *first_mcu_row = context->crop_window.y / mcu_height;
+    *mcu_col_num = ( context->crop_window.width + mcu_width - 1 ) / mcu_width;
+    *mcu_row_num = ( context->crop_window.height + mcu_height - 1 ) / mcu_height;
+
     return true;
 }
 
-static
-bool mameJpeg_encodeSOISegment( mameJpeg_context* context )
+bool mameJpeg_setCropWindow( mameJpeg_context* context, size_t x, size_t y, size_t width, size_t height )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_DECODE );
+    MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_SCAN );
+    MAMEJPEG_CHECK( context->cursor.mcu_row_index == 0 && context->cursor.mcu_col_index == 0 );
+
+    /* the left and top edges sit on MCU boundaries, the right and bottom ones anywhere */
+    size_t mcu_width = 8 * context->info.component[0].hor_sampling;
+    size_t mcu_height = 8 * context->info.component[0].ver_sampling;
+    MAMEJPEG_CHECK( x % mcu_width == 0 && y % mcu_height == 0 );
+    MAMEJPEG_CHECK( 0 < width && x + width <= context->info.width );
+    MAMEJPEG_CHECK( 0 < height && y + height <= context->info.height );
+
+    context->crop_window.is_enabled = true;
+    context->crop_window.x = x;
+    context->crop_window.y = y;
+    context->crop_window.width = width;
+    context->crop_window.height = height;
+
+    return true;
+}
+
+bool mameJpeg_getCoefficientBufferSize( mameJpeg_context* context, size_t* coefficient_buffer_size )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( coefficient_buffer_size );
+    MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_DECODE );
+    MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_SCAN );
+
+    uint16_t first_mcu_col = 0;
+    uint16_t first_mcu_row = 0;
+    uint16_t mcu_col_num = 0;
+    uint16_t mcu_row_num = 0;
+    MAMEJPEG_CHECK( mameJpeg_getCoefficientWindow( context, &first_mcu_col, &first_mcu_row, &mcu_col_num, &mcu_row_num ) );
+
+    /* blocks cover whole MCUs, the padding beyond the image edge is kept */
+    size_t mcu_num = (size_t)mcu_col_num * mcu_row_num;
+    *coefficient_buffer_size = sizeof( int16_t ) * 64 * mcu_num * context->info.mcu_block_num;
+    return true;
+}
+
+bool mameJpeg_readCoefficients( mameJpeg_context* context,
+        mameJpeg_coefficients* coefficients,
+        uint8_t* coefficient_buffer,
+        size_t coefficient_buffer_size )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( coefficients );
+    MAMEJPEG_NULL_CHECK( coefficient_buffer );
+    MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_DECODE );
+
+    if( context->cursor.phase == MAMEJPEG_PHASE_HEADER )
+    {
+        MAMEJPEG_CHECK( mameJpeg_readHeader( context ) );
+    }
+    MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_SCAN );
+    MAMEJPEG_CHECK( context->cursor.mcu_row_index == 0 && context->cursor.mcu_col_index == 0 );
+
+    size_t required_size = 0;
+    MAMEJPEG_CHECK( mameJpeg_getCoefficientBufferSize( context, &required_size ) );
+    MAMEJPEG_CHECK( required_size <= coefficient_buffer_size );
+
+    uint16_t hor_mcu_num = 0;
+    uint16_t ver_mcu_num = 0;
+    MAMEJPEG_CHECK( mameJpeg_getNumOfMCU( context, &hor_mcu_num, &ver_mcu_num ) );
+    uint16_t first_mcu_col = 0;
+    uint16_t first_mcu_row = 0;
+    uint16_t mcu_col_num = 0;
+    uint16_t mcu_row_num = 0;
+    MAMEJPEG_CHECK( mameJpeg_getCoefficientWindow( context, &first_mcu_col, &first_mcu_row, &mcu_col_num, &mcu_row_num ) );
+
+    memset( coefficients, 0x00, sizeof( mameJpeg_coefficients ) );
+    coefficients->width = context->crop_window.is_enabled ? context->crop_window.width : context->info.width;
+    coefficients->height = context->crop_window.is_enabled ? context->crop_window.height : context->info.height;
+    coefficients->component_num = context->info.component_num;
+    MAMEJPEG_CHECK( mameJpeg_getFormat( context, &coefficients->format ) );
+
+    int16_t* blocks = (int16_t*)coefficient_buffer;
+    for( uint8_t i = 0; i < context->info.component_num; i++ )
+    {
+        coefficients->component[i].hor_block_num = mcu_col_num * context->info.component[i].hor_sampling;
+        coefficients->component[i].ver_block_num = mcu_row_num * context->info.component[i].ver_sampling;
+        coefficients->component[i].blocks = blocks;
+        blocks += (size_t)64 * coefficients->component[i].hor_block_num * coefficients->component[i].ver_block_num;
+
+        /* DQT order is zigzag, the blocks are in natural order */
+        const uint8_t* quant_table = context->info.quant_table[ context->info.component[i].quant_table_index ];
+        MAMEJPEG_NULL_CHECK( quant_table );
+        for( uint8_t j = 0; j < 64; j++ )
+        {
+            coefficients->component[i].quant_table[ mameJpeg_getZigZagIndex( context, j ) ] = quant_table[j];
+        }
+    }
+
+    /* entropy decoding only, no dequantization, IDCT or color conversion */
+    uint16_t end_mcu_row = first_mcu_row + mcu_row_num;
+    while( context->cursor.mcu_row_index < end_mcu_row )
+    {
+        /* DC values are absolute here, the writer predicts them again from the new left edge */
+        MAMEJPEG_CHECK( mameJpeg_decodeMCU( context, context->info.coeff_blocks ) );
+        uint16_t hor_mcu_index = context->cursor.mcu_col_index;
+        uint16_t ver_mcu_index = context->cursor.mcu_row_index;
+        if( first_mcu_row <= ver_mcu_index
+                && first_mcu_col <= hor_mcu_index && hor_mcu_index < first_mcu_col + mcu_col_num )
+        {
+            MAMEJPEG_CHECK( mameJpeg_storeCoefficientMCU( context,
+                        coefficients,
+                        hor_mcu_index - first_mcu_col,
+                        ver_mcu_index - first_mcu_row,
+                        context->info.coeff_blocks ) );
+        }
+        MAMEJPEG_CHECK( mameJpeg_countDecodeRestart( context ) );
+
+        context->cursor.mcu_col_index++;
+        if( hor_mcu_num <= context->cursor.mcu_col_index )
+        {
+            context->cursor.mcu_col_index = 0;
+            context->cursor.mcu_row_index++;
+        }
+    }
+
+    if( end_mcu_row < context->cursor.mcu_row_num )
+    {
+        /* stopped below the window, the rest of the scan is left unread */
+        context->cursor.phase = MAMEJPEG_PHASE_DONE;
+        return true;
+    }
+    MAMEJPEG_CHECK( mameJpeg_endDecodeImage( context ) );
+    MAMEJPEG_CHECK( mameJpeg_decodeTrailer( context ) );
+
+    return true;
+}
+
+static
+bool mameJpeg_skipAC( mameJpeg_context* context, uint8_t component_index, uint8_t max_bit_length )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    /* same walk as mameJpeg_decodeAC, the amplitude bits are read and dropped */
+    uint8_t elem_num = 1;
+    while( elem_num < 64 )
+    {
+        uint8_t value;
+        MAMEJPEG_CHECK( mameJpeg_getNextDecodedValue( context, 1, component_index, &value ) );
+
+        uint8_t zero_run_length = value >> 4;
+        uint8_t bit_length = value & 0x0f;
+        if( zero_run_length == 0 && bit_length == 0 )
+        {
+            break;
+        }
+        else if( zero_run_length == 15 && bit_length == 0 )
+        {
+            zero_run_length = 16;
+        }
+
+        elem_num += zero_run_length;
+        MAMEJPEG_CHECK( elem_num <= 64 );
+
+        if( 0 < bit_length )
+        {
+            MAMEJPEG_CHECK( elem_num < 64 );
+            MAMEJPEG_CHECK( bit_length <= max_bit_length );
+
+            uint16_t huffman_value = 0;
+            MAMEJPEG_CHECK( mameJpeg_stream_readBits( context->input_stream, &huffman_value, 2, bit_length ) );
+            elem_num++;
+        }
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_decodeDCOnlyMCU( mameJpeg_context* context, int16_t* coeff_blocks )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( coeff_blocks );
+
+    MAMEJPEG_CHECK( mameJpeg_checkDecodeRestart( context ) );
+
+    /* only the first value of each block is written */
+    int16_t* coeff_block = coeff_blocks;
+    for( uint8_t i = 0; i < context->info.component_num; i++ )
+    {
+        uint16_t num_of_8x8blocks = context->info.component[ i ].hor_sampling * context->info.component[ i ].ver_sampling;
+        for( uint16_t block_index = 0; block_index < num_of_8x8blocks; block_index++ )
+        {
+            MAMEJPEG_CHECK( mameJpeg_decodeDC( context, i, coeff_block ) );
+            /* any size a symbol can carry, like mameJpeg_decodeAC */
+            MAMEJPEG_CHECK( mameJpeg_skipAC( context, i, 15 ) );
+            coeff_block += 64;
+        }
+    }
+
+    return true;
+}
+
+bool mameJpeg_getPreviewSize( mameJpeg_context* context, uint16_t* width_ptr, uint16_t* height_ptr, size_t* preview_buffer_size_ptr )
+{
+    /* luma blocks cover 8x8 pixels whatever the sampling factors are */
+    return mameJpeg_getScaledOutputSize( context, 8, width_ptr, height_ptr, preview_buffer_size_ptr );
+}
+
+bool mameJpeg_decodePreview( mameJpeg_context* context, uint8_t* preview_buffer, size_t preview_buffer_size )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( preview_buffer );
+    MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_DECODE );
+
+    if( context->cursor.phase == MAMEJPEG_PHASE_HEADER )
+    {
+        MAMEJPEG_CHECK( mameJpeg_readHeader( context ) );
+    }
+    MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_SCAN );
+    MAMEJPEG_CHECK( context->cursor.mcu_row_index == 0 && context->cursor.mcu_col_index == 0 );
+    MAMEJPEG_CHECK( !context->crop_window.is_enabled );
+
+    size_t required_size = 0;
+    MAMEJPEG_CHECK( mameJpeg_getPreviewSize( context, NULL, NULL, &required_size ) );
+    MAMEJPEG_CHECK( required_size <= preview_buffer_size );
+
+    uint16_t hor_mcu_num = 0;
+    uint16_t ver_mcu_num = 0;
+    MAMEJPEG_CHECK( mameJpeg_getNumOfMCU( context, &hor_mcu_num, &ver_mcu_num ) );
+
+    /* no AC storage, dequantization or IDCT, only the DC of each block is kept */
+    while( context->cursor.mcu_row_index < context->cursor.mcu_row_num )
+    {
+        MAMEJPEG_CHECK( mameJpeg_decodeDCOnlyMCU( context, context->info.coeff_blocks ) );
+        MAMEJPEG_CHECK( mameJpeg_storeScaledMCU( context,
+                    context->info.coeff_blocks,
+                    context->cursor.mcu_col_index,
+                    context->cursor.mcu_row_index,
+                    8,
+                    NULL,
+                    preview_buffer ) );
+        MAMEJPEG_CHECK( mameJpeg_countDecodeRestart( context ) );
+
+        context->cursor.mcu_col_index++;
+        if( hor_mcu_num <= context->cursor.mcu_col_index )
+        {
+            context->cursor.mcu_col_index = 0;
+            context->cursor.mcu_row_index++;
+        }
+    }
+
+    MAMEJPEG_CHECK( mameJpeg_endDecodeImage( context ) );
+    MAMEJPEG_CHECK( mameJpeg_decodeTrailer( context ) );
+
+    return true;
+}
+
+static
+bool mameJpeg_getComponentBlockNum( mameJpeg_context* context, uint8_t component_index, uint16_t* hor_block_num, uint16_t* ver_block_num )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    /* blocks holding image samples, the MCU padding beyond the edge is left out */
+    uint8_t max_hor_sampling = 1;
+    uint8_t max_ver_sampling = 1;
+    for( uint8_t i = 0; i < context->info.component_num; i++ )
+    {
+        max_hor_sampling = MAMEJPEG_MAX( max_hor_sampling, context->info.component[i].hor_sampling );
+        max_ver_sampling = MAMEJPEG_MAX( max_ver_sampling, context->info.component[i].ver_sampling );
+    }
+    size_t sample_width = ( (size_t)context->info.width * context->info.component[ component_index ].hor_sampling + max_hor_sampling - 1 ) / max_hor_sampling;
+    size_t sample_height = ( (size_t)context->info.height * context->info.component[ component_index ].ver_sampling + max_ver_sampling - 1 ) / max_ver_sampling;
+    *hor_block_num = (uint16_t)( ( sample_width + 7 ) / 8 );
+    *ver_block_num = (uint16_t)( ( sample_height + 7 ) / 8 );
+
+    return true;
+}
+
+bool mameJpeg_computeSignature( mameJpeg_context* context, mameJpeg_signature* signature )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( signature );
+    MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_DECODE );
+
+    if( context->cursor.phase == MAMEJPEG_PHASE_HEADER )
+    {
+        MAMEJPEG_CHECK( mameJpeg_readHeader( context ) );
+    }
+    MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_SCAN );
+    MAMEJPEG_CHECK( context->cursor.mcu_row_index == 0 && context->cursor.mcu_col_index == 0 );
+    MAMEJPEG_CHECK( !context->crop_window.is_enabled );
+    MAMEJPEG_CHECK( context->info.component_num == 1 || context->info.component_num == 3 );
+
+    uint16_t hor_mcu_num = 0;
+    uint16_t ver_mcu_num = 0;
+    MAMEJPEG_CHECK( mameJpeg_getNumOfMCU( context, &hor_mcu_num, &ver_mcu_num ) );
+    uint16_t hor_block_nums[3];
+    uint16_t ver_block_nums[3];
+    for( uint8_t i = 0; i < context->info.component_num; i++ )
+    {
+        MAMEJPEG_CHECK( mameJpeg_getComponentBlockNum( context, i, &hor_block_nums[i], &ver_block_nums[i] ) );
+    }
+
+    /* luma blocks fall into an 8x8 grid of cells, the rest is summed per component */
+    double cell_dc_sums[64] = { 0.0 };
+    double cell_hor_sums[64] = { 0.0 };
+    double cell_ver_sums[64] = { 0.0 };
+    uint32_t cell_block_nums[64] = { 0 };
+    double dc_sums[3] = { 0.0 };
+    double square_sums[3] = { 0.0 };
+    size_t block_nums[3] = { 0 };
+
+    /* entropy decoding and dequantization only, no IDCT or color conversion */
+    while( context->cursor.mcu_row_index < context->cursor.mcu_row_num )
+    {
+        MAMEJPEG_CHECK( mameJpeg_decodeMCU( context, context->info.coeff_blocks ) );
+
+        const int16_t* coeff_block = context->info.coeff_blocks;
+        for( uint8_t i = 0; i < context->info.component_num; i++ )
+        {
+            uint16_t num_of_hor_8x8blocks = context->info.component[ i ].hor_sampling;
+            uint16_t num_of_ver_8x8blocks = context->info.component[ i ].ver_sampling;
+            for( uint16_t ver_8x8block_index = 0; ver_8x8block_index < num_of_ver_8x8blocks; ver_8x8block_index++ )
+            {
+                for( uint16_t hor_8x8block_index = 0; hor_8x8block_index < num_of_hor_8x8blocks; hor_8x8block_index++ )
+                {
+                    size_t block_x = (size_t)context->cursor.mcu_col_index * num_of_hor_8x8blocks + hor_8x8block_index;
+                    size_t block_y = (size_t)context->cursor.mcu_row_index * num_of_ver_8x8blocks + ver_8x8block_index;
+                    if( hor_block_nums[i] <= block_x || ver_block_nums[i] <= block_y )
+                    {
+                        coeff_block += 64;
+                        continue;
+                    }
+
+                    /* the DCT is orthonormal, so the squared coefficients sum to the squared samples */
+                    double dct_work_buffer[64];
+                    MAMEJPEG_CHECK( mameJpeg_applyInverseQunatize( context, i, coeff_block, dct_work_buffer ) );
+                    for( uint8_t j = 0; j < 64; j++ )
+                    {
+                        square_sums[i] += dct_work_buffer[j] * dct_work_buffer[j];
+                    }
+                    dc_sums[i] += dct_work_buffer[0];
+                    block_nums[i]++;
+
+                    if( i == 0 )
+                    {
+                        size_t cell_index = 8 * ( block_y * 8 / ver_block_nums[0] ) + ( block_x * 8 / hor_block_nums[0] );
+                        cell_dc_sums[ cell_index ] += dct_work_buffer[0];
+                        cell_hor_sums[ cell_index ] += dct_work_buffer[1];
+                        cell_ver_sums[ cell_index ] += dct_work_buffer[8];
+                        cell_block_nums[ cell_index ]++;
+                    }
+                    coeff_block += 64;
+                }
+            }
+        }
+        MAMEJPEG_CHECK( mameJpeg_countDecodeRestart( context ) );
+
+        context->cursor.mcu_col_index++;
+        if( hor_mcu_num <= context->cursor.mcu_col_index )
+        {
+            context->cursor.mcu_col_index = 0;
+            context->cursor.mcu_row_index++;
+        }
+    }
+
+    MAMEJPEG_CHECK( mameJpeg_endDecodeImage( context ) );
+    MAMEJPEG_CHECK( mameJpeg_decodeTrailer( context ) );
+
+    memset( signature, 0x00, sizeof( mameJpeg_signature ) );
+    signature->component_num = context->info.component_num;
+    for( uint8_t i = 0; i < context->info.component_num; i++ )
+    {
+        MAMEJPEG_CHECK( 0 < block_nums[i] );
+        double offset = dc_sums[i] / ( 8.0 * block_nums[i] );
+        signature->component[i].mean = offset + 128.0;
+        signature->component[i].variance = MAMEJPEG_MAX( square_sums[i] / ( 64.0 * block_nums[i] ) - offset * offset, 0.0 );
+    }
+
+    /* 8 or more blocks fill every cell, fewer leave gaps that borrow the cell of the block covering them */
+    double cell_means[64];
+    double sorted_means[64];
+    for( uint8_t y = 0; y < 8; y++ )
+    {
+        size_t cell_y = ( ver_block_nums[0] < 8 ) ? ( (size_t)y * ver_block_nums[0] / 8 ) * 8 / ver_block_nums[0] : y;
+        for( uint8_t x = 0; x < 8; x++ )
+        {
+            size_t cell_x = ( hor_block_nums[0] < 8 ) ? ( (size_t)x * hor_block_nums[0] / 8 ) * 8 / hor_block_nums[0] : x;
+            size_t cell_index = 8 * cell_y + cell_x;
+            size_t index = 8 * y + x;
+            cell_means[index] = cell_dc_sums[ cell_index ] / cell_block_nums[ cell_index ];
+
+            bool is_horizontal = fabs( cell_hor_sums[ cell_index ] ) > fabs( cell_ver_sums[ cell_index ] );
+            signature->ac_hash |= (uint64_t)is_horizontal << index;
+
+            /* insertion sort for the median */
+            size_t j = index;
+            while( 0 < j && cell_means[index] < sorted_means[ j - 1 ] )
+            {
+                sorted_means[j] = sorted_means[ j - 1 ];
+                j--;
+            }
+            sorted_means[j] = cell_means[index];
+        }
+    }
+
+    double median = ( sorted_means[31] + sorted_means[32] ) * 0.5;
+    for( uint8_t i = 0; i < 64; i++ )
+    {
+        signature->dc_hash |= (uint64_t)( median < cell_means[i] ) << i;
+    }
+
+    return true;
+}
+
+uint8_t mameJpeg_getSignatureDistance( const mameJpeg_signature* a, const mameJpeg_signature* b )
+{
+    /* hamming distance over both hashes, 0 to 128 */
+    uint64_t hashes[2] = { a->dc_hash ^ b->dc_hash, a->ac_hash ^ b->ac_hash };
+    uint8_t distance = 0;
+    for( int i = 0; i < 2; i++ )
+    {
+        while( hashes[i] != 0 )
+        {
+            hashes[i] &= hashes[i] - 1;
+            distance++;
+        }
+    }
+    return distance;
+}
+
+static
+bool mameJpeg_validateMCU( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    MAMEJPEG_CHECK( mameJpeg_checkDecodeRestart( context ) );
+
+    /* baseline limits, DC differences up to 11 bits and AC values up to 10 bits */
+    for( uint8_t i = 0; i < context->info.component_num; i++ )
+    {
+        uint16_t num_of_8x8blocks = context->info.component[ i ].hor_sampling * context->info.component[ i ].ver_sampling;
+        for( uint16_t block_index = 0; block_index < num_of_8x8blocks; block_index++ )
+        {
+            int16_t dc_value = 0;
+            MAMEJPEG_CHECK( mameJpeg_decodeDC( context, i, &dc_value ) );
+            int prev_dc_value = context->info.component[ i ].prev_dc_value;
+            MAMEJPEG_CHECK( -2047 <= prev_dc_value && prev_dc_value <= 2047 );
+            MAMEJPEG_CHECK( mameJpeg_skipAC( context, i, 10 ) );
+        }
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_validateImage( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_DECODE );
+
+    if( context->cursor.phase == MAMEJPEG_PHASE_HEADER )
+    {
+        MAMEJPEG_CHECK( mameJpeg_readHeader( context ) );
+    }
+    MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_SCAN );
+    MAMEJPEG_CHECK( context->cursor.mcu_row_index == 0 && context->cursor.mcu_col_index == 0 );
+    MAMEJPEG_CHECK( 0 < context->info.width && 0 < context->info.height );
+    for( uint8_t i = 0; i < context->info.component_num; i++ )
+    {
+        MAMEJPEG_NULL_CHECK( context->info.quant_table[ context->info.component[i].quant_table_index ] );
+    }
+
+    uint16_t hor_mcu_num = 0;
+    uint16_t ver_mcu_num = 0;
+    MAMEJPEG_CHECK( mameJpeg_getNumOfMCU( context, &hor_mcu_num, &ver_mcu_num ) );
+
+    /* entropy decoding only, coefficients are checked and dropped */
+    while( context->cursor.mcu_row_index < context->cursor.mcu_row_num )
+    {
+        MAMEJPEG_CHECK( mameJpeg_validateMCU( context ) );
+        MAMEJPEG_CHECK( mameJpeg_countDecodeRestart( context ) );
+
+        context->cursor.mcu_col_index++;
+        if( hor_mcu_num <= context->cursor.mcu_col_index )
+        {
+            context->cursor.mcu_col_index = 0;
+            context->cursor.mcu_row_index++;
+        }
+    }
+
+    /* EOI has to follow the scan directly, only fill bytes may come before it */
+    MAMEJPEG_CHECK( mameJpeg_endDecodeImage( context ) );
+    uint8_t byte = 0;
+    MAMEJPEG_CHECK( mameJpeg_stream_readByte( context->input_stream, &byte ) );
+    MAMEJPEG_CHECK( byte == 0xff );
+    do
+    {
+        MAMEJPEG_CHECK( mameJpeg_stream_readByte( context->input_stream, &byte ) );
+    } while( byte == 0xff );
+    MAMEJPEG_CHECK( ( ( 0xff << 8 ) | byte ) == MAMEJPEG_MARKER_EOI );
+    context->cursor.phase = MAMEJPEG_PHASE_DONE;
+
+    return true;
+}
+
+bool mameJpeg_validate( mameJpeg_context* context, size_t* error_offset_ptr )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    if( mameJpeg_validateImage( context ) )
+    {
+        return true;
+    }
+
+    /* the input consumed when the check failed, the error lies in the last bytes read */
+    if( error_offset_ptr != NULL )
+    {
+        *error_offset_ptr = context->input_stream->position;
+    }
+
+    return false;
+}
+
+static
+bool mameJpeg_input_from_push_source( void* param, uint8_t* byte )
+{
+    MAMEJPEG_NULL_CHECK( param );
+    MAMEJPEG_NULL_CHECK( byte );
+
+    mameJpeg_push_source* source = (mameJpeg_push_source*)param;
+    if( source->size <= source->pos )
+    {
+        source->is_exhausted = true;
+        return false;
+    }
+
+    *byte = source->data[ source->pos ];
+    source->pos++;
+
+    return true;
+}
+
+static
+bool mameJpeg_input_skip_in_push_source( void* param, size_t size )
+{
+    MAMEJPEG_NULL_CHECK( param );
+
+    mameJpeg_push_source* source = (mameJpeg_push_source*)param;
+    if( source->size - source->pos < size )
+    {
+        source->pos = source->size;
+        source->is_exhausted = true;
+        return false;
+    }
+    source->pos += size;
+
+    return true;
+}
+
+bool mameJpeg_initializePushDecode( mameJpeg_context* context,
+        mameJpeg_stream_write_callback_ptr output_callback,
+        void* output_callback_param,
+        uint8_t* work_buffer,
+        size_t work_buffer_size )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( output_callback );
+
+    MAMEJPEG_CHECK( mameJpeg_initializeDecode( context,
+                mameJpeg_input_from_push_source,
+                &context->push_source,
+                output_callback,
+                output_callback_param,
+                work_buffer,
+                work_buffer_size ) );
+    context->input_stream->skip = mameJpeg_input_skip_in_push_source;
+    context->checkpoint.is_enabled = true;
+    MAMEJPEG_CHECK( mameJpeg_saveCheckpoint( context ) );
+
+    return true;
+}
+
+static
+bool mameJpeg_decodePushedInput( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    while( context->cursor.phase == MAMEJPEG_PHASE_HEADER )
+    {
+        mameJpeg_marker marker;
+        MAMEJPEG_CHECK( mameJpeg_getNextMarker( context, &marker ) );
+        MAMEJPEG_CHECK( mameJpeg_decodeSegment( context, marker ) );
+        MAMEJPEG_CHECK( mameJpeg_saveCheckpoint( context ) );
+    }
+
+    while( context->cursor.mcu_row_index < context->cursor.mcu_row_num )
+    {
+        uint16_t ver_mcu_index = context->cursor.mcu_row_index;
+        MAMEJPEG_CHECK( mameJpeg_decodeNextMCURow( context ) );
+        MAMEJPEG_CHECK( mameJpeg_writeBuffer( context, ver_mcu_index ) );
+        context->cursor.consumed_rows = context->cursor.buffered_rows;
+        MAMEJPEG_CHECK( mameJpeg_saveCheckpoint( context ) );
+    }
+
+    if( context->cursor.phase == MAMEJPEG_PHASE_SCAN )
+    {
+        MAMEJPEG_CHECK( mameJpeg_endDecodeImage( context ) );
+        MAMEJPEG_CHECK( mameJpeg_saveCheckpoint( context ) );
+    }
+
+    MAMEJPEG_CHECK( mameJpeg_decodeTrailer( context ) );
+
+    return true;
+}
+
+mameJpeg_status mameJpeg_decodePush( mameJpeg_context* context, const uint8_t* data, size_t size, size_t* consumed_ptr )
+{
+    if( context == NULL || consumed_ptr == NULL || !context->checkpoint.is_enabled )
+    {
+        return MAMEJPEG_STATUS_ERROR;
+    }
+
+    /* data has to start at the first byte that was not consumed by the previous call */
+    context->push_source.data = data;
+    context->push_source.size = ( data != NULL ) ? size : 0;
+    context->push_source.pos = 0;
+    context->push_source.is_exhausted = false;
+    context->checkpoint.input_pos = 0;
+
+    if( !mameJpeg_decodePushedInput( context ) )
+    {
+        /* a truncated stream is an error once the caller has no more input */
+        if( !context->push_source.is_exhausted || context->push_source.is_finished )
+        {
+            *consumed_ptr = context->push_source.pos;
+            return MAMEJPEG_STATUS_ERROR;
+        }
+
+        mameJpeg_restoreCheckpoint( context );
+        *consumed_ptr = context->push_source.pos;
+        return MAMEJPEG_STATUS_NEED_MORE_DATA;
+    }
+
+    *consumed_ptr = context->push_source.pos;
+    return MAMEJPEG_STATUS_OK;
+}
+
+bool mameJpeg_finishPush( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->checkpoint.is_enabled );
+
+    context->push_source.is_finished = true;
+
+    return true;
+}
+
+static const double MAMEJPEG_RGB_TO_YCBCR_COEFF[4][3] = { 
+    { 0.299, -0.169,  0.500 },
+    { 0.587, -0.331, -0.419 },
+    { 0.114,  0.500, -0.081 },
+    {    0 ,    128,    128},
+
+};
+
+/* ITU T.81 Annex K.1 tables in natural order, scaled by the encode quality */
+static const uint8_t MAMEJPEG_STANDARD_QUANT_TABLE[2][64] = {
+    {
+        16,  11,  10,  16,  24,  40,  51,  61,
+        12,  12,  14,  19,  26,  58,  60,  55,
+        14,  13,  16,  24,  40,  57,  69,  56,
+        14,  17,  22,  29,  51,  87,  80,  62,
+        18,  22,  37,  56,  68, 109, 103,  77,
+        24,  35,  55,  64,  81, 104, 113,  92,
+        49,  64,  78,  87, 103, 121, 120, 101,
+        72,  92,  95,  98, 112, 100, 103,  99
+    },
+    {
+        17, 18, 24, 47, 99, 99, 99, 99,
+        18, 21, 26, 66, 99, 99, 99, 99,
+        24, 26, 56, 99, 99, 99, 99, 99,
+        47, 66, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99
+    }
+};
+
+static const uint8_t MAMEJPEG_DEFAULT_HUFFMAN_CODE_BITS[2][2][16] = {
+    {
+        { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 },
+        { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 },
+    },
+    {
+        { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d },
+        { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 },
+    }
+};
+
+static const uint8_t MAMEJPEG_DEFAULT_DC_LUMA_HUFFMAN_CODE_VALUE[] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11
+};
+
+static const uint8_t MAMEJPEG_DEFAULT_DC_CHROMA_HUFFMAN_CODE_VALUE[] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11
+};
+
+static const uint8_t MAMEJPEG_DEFAULT_AC_LUMA_HUFFMAN_CODE_VALUE[] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
+    0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+    0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
+    0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+    0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+    0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+    0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+    0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+    0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4,
+    0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea,
+    0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+static const uint8_t MAMEJPEG_DEFAULT_AC_CHROMA_HUFFMAN_CODE_VALUE[] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21,
+    0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+    0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34,
+    0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38,
+    0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+    0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+    0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96,
+    0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+    0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2,
+    0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
+    0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+static const uint8_t* MAMEJPEG_DEFAULT_HUFFMAN_CODE_VALUE[2][2] = {
+    {
+        MAMEJPEG_DEFAULT_DC_LUMA_HUFFMAN_CODE_VALUE,
+        MAMEJPEG_DEFAULT_DC_CHROMA_HUFFMAN_CODE_VALUE
+    },
+    {
+        MAMEJPEG_DEFAULT_AC_LUMA_HUFFMAN_CODE_VALUE,
+        MAMEJPEG_DEFAULT_AC_CHROMA_HUFFMAN_CODE_VALUE
+    }
+};
+
+static
+bool mameJpeg_restartEncode( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    context->info.component[0].prev_dc_value = 0;
+    context->info.component[1].prev_dc_value = 0;
+    context->info.component[2].prev_dc_value = 0;
+    return true;
+}
+
+static
+bool mameJpeg_getInputBytes( mameJpeg_context* context, uint16_t ver_mcu_index, size_t* input_bytes )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( input_bytes );
+
+    size_t row_bytes = (size_t)context->info.component_num * context->info.width;
+    *input_bytes = row_bytes * mameJpeg_getMCURowHeight( context, ver_mcu_index );
+    return true;
+}
+
+static
+bool mameJpeg_padLineBuffer( mameJpeg_context* context, uint16_t filled_rows )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( 0 < filled_rows );
+
+    /* replicate the last image row into the rows below the bottom edge */
+    size_t row_bytes = (size_t)context->info.component_num * context->info.width;
+    uint16_t mcu_height = 8 * context->info.component[0].ver_sampling;
+    const uint8_t* last_row = context->line_buffer + row_bytes * ( filled_rows - 1 );
+    for( uint16_t y = filled_rows; y < mcu_height; y++ )
+    {
+        memcpy( context->line_buffer + row_bytes * y, last_row, row_bytes );
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_readIntoBuffer( mameJpeg_context* context, uint16_t ver_mcu_index )
+{
+    size_t input_bytes = 0;
+    MAMEJPEG_CHECK( mameJpeg_getInputBytes( context, ver_mcu_index, &input_bytes ) );
+
+    for( size_t i = 0; i < input_bytes; i++ )
+    {
+        MAMEJPEG_CHECK( mameJpeg_stream_readByte( context->input_stream, &(context->line_buffer[i]) ) );
+    }
+    MAMEJPEG_CHECK( mameJpeg_padLineBuffer( context, mameJpeg_getMCURowHeight( context, ver_mcu_index ) ) );
+    context->source.first_row = (size_t)8 * context->info.component[0].ver_sampling * ver_mcu_index;
+
+    return true;
+}
+
+static
+double mameJpeg_applyEncodeColorConvert( mameJpeg_context* context, const uint8_t* pixel, uint8_t component_index )
+{
+    if( context->info.component_num == 1 )
+    {
+        return pixel[0];
+    }
+
+    double value = MAMEJPEG_RGB_TO_YCBCR_COEFF[3][component_index];
+    for( int i = 0; i < 3; i++ )
+    {
+        value += MAMEJPEG_RGB_TO_YCBCR_COEFF[i][component_index] * pixel[i];
+    }
+    return value;
+}
+
+static
+bool mameJpeg_loadSamples( const uint8_t* samples, size_t stride, double* dct_work_buffer )
+{
+    for( int y = 0; y < 8; y++ )
+    {
+        for( int x = 0; x < 8; x++ )
+        {
+            dct_work_buffer[ 8 * y + x ] = samples[x] - 128.0;
+        }
+        samples += stride;
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_applyQuantize( mameJpeg_context* context, uint8_t component_index, const double* dct_work_buffer, int16_t* coeff_block, uint64_t* nonzero_mask )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( nonzero_mask );
+
+    uint8_t table_index = context->info.component[ component_index ].quant_table_index;
+    const uint8_t* quant_table = context->info.quant_table[table_index];
+    MAMEJPEG_NULL_CHECK( quant_table );
+
+    /* bit i is set when the coefficient at zigzag position i is nonzero */
+    uint64_t mask = 0;
+    for( int i = 0; i < 64; i++ )
+    {
+        uint8_t zigzag_index = mameJpeg_getZigZagIndex( context, i );
+        double value = dct_work_buffer[zigzag_index] / quant_table[i];
+        value = ( value < 0.0 ) ? ( value - 0.5 ) : ( value + 0.5 );
+
+        /* keep the magnitude category inside the range of the baseline huffman tables */
+        double limit = ( i == 0 ) ? 2047.0 : 1023.0;
+        int16_t coeff = (int16_t)MAMEJPEG_CLIP( value, -limit, limit );
+        coeff_block[zigzag_index] = coeff;
+        mask |= (uint64_t)( coeff != 0 ) << i;
+    }
+    *nonzero_mask = mask;
+
+    return true;
+}
+
+static
+bool mameJpeg_putHuffmanCode( mameJpeg_context* context, uint8_t ac_dc, uint8_t component_index, uint8_t symbol, uint16_t extra_bits, uint8_t extra_length )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    uint8_t table_index = context->info.component[ component_index ].huff_table_index[ac_dc];
+    if( context->huff_optimize.is_gathering )
+    {
+        context->huff_optimize.symbol_freq[ac_dc][table_index][ symbol ]++;
+        return true;
+    }
+
+    const huffman_code* code = &context->info.huff_table[ac_dc][table_index].codes[ symbol ];
+    MAMEJPEG_CHECK( 0 < code->size );
+    if( context->rate_control.is_estimating )
+    {
+        context->rate_control.estimated_bits += code->size + extra_length;
+        return true;
+    }
+
+    /* code and magnitude bits go out together */
+    uint32_t bits = ( (uint32_t)code->code << extra_length ) | extra_bits;
+    MAMEJPEG_CHECK( mameJpeg_stream_writeCode( context->output_stream, bits, code->size + extra_length ) );
+
+    return true;
+}
+
+static
+bool mameJpeg_calcEncodeDCValue( mameJpeg_context* context, int16_t diff_value, uint16_t* dc_value,  uint8_t* length )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( dc_value );
+    MAMEJPEG_NULL_CHECK( length );
+
+    *length = 0;
+    int16_t abs_value = abs( diff_value );
+    while( 0 < abs_value )
+    {
+        (*length)++;
+        abs_value >>= 1;
+    }
+
+    int base_value = ( 0 < diff_value ) ? 0 : ( ( 1 << *length ) - 1 );
+    *dc_value = diff_value + base_value;
+    return true;
+}
+
+static
+bool mameJpeg_encodeDC( mameJpeg_context* context, uint8_t component_index, const int16_t* coeff_block )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( coeff_block );
+
+    int16_t diff_value = coeff_block[0] - context->info.component[ component_index ].prev_dc_value ;
+    context->info.component[ component_index ].prev_dc_value += diff_value;
+
+    uint16_t huffman_dc_value;
+    uint8_t length;
+    MAMEJPEG_CHECK( mameJpeg_calcEncodeDCValue( context, diff_value, &huffman_dc_value, &length ) );
+
+    MAMEJPEG_CHECK( mameJpeg_putHuffmanCode( context, 0, component_index, length, huffman_dc_value, length ) );
+
+    return true;
+}
+
+static
+bool mameJpeg_encodeAC( mameJpeg_context* context, uint8_t component_index, const int16_t* coeff_block, uint64_t nonzero_mask )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( coeff_block );
+
+    /* jump from one nonzero AC coefficient to the next, the gap is the zero run */
+    uint64_t ac_mask = nonzero_mask & ~(uint64_t)1;
+    uint8_t prev_index = 0;
+    while( ac_mask != 0 )
+    {
+        uint8_t elem_num = mameJpeg_countTrailingZeros( ac_mask );
+        ac_mask &= ac_mask - 1;
+
+        uint8_t zero_run_length = elem_num - prev_index - 1;
+        while( 16 <= zero_run_length )
+        {
+            uint8_t value = ( 15 << 4 ) | 0;
+            MAMEJPEG_CHECK( mameJpeg_putHuffmanCode( context, 1, component_index, value, 0, 0 ) );
+            zero_run_length -= 16;
+        }
+
+        int16_t raw_value = coeff_block[ mameJpeg_getZigZagIndex( context, elem_num ) ];
+        uint16_t huff_value = 0;
+        uint8_t bit_length = 0;
+        MAMEJPEG_CHECK( mameJpeg_calcEncodeDCValue( context, raw_value, &huff_value, &bit_length ) );
+
+        uint8_t value = ( zero_run_length << 4 ) | bit_length;
+        MAMEJPEG_CHECK( mameJpeg_putHuffmanCode( context, 1, component_index, value, huff_value, bit_length ) );
+        prev_index = elem_num;
+    }
+
+    /* EOB unless the last coefficient was coded */
+    if( prev_index < 63 )
+    {
+        MAMEJPEG_CHECK( mameJpeg_putHuffmanCode( context, 1, component_index, 0x00, 0, 0 ) );
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_moveBufferToMCU( mameJpeg_context* context, uint16_t hor_mcu_index, uint16_t ver_mcu_index )
+{
+    MAMEJPEG_CHECK( context->info.component_num == 1 || context->info.component_num == 3 );
+
+    uint16_t mcu_width = 8 * context->info.component[0].hor_sampling;
+    uint16_t mcu_height = 8 * context->info.component[0].ver_sampling;
+    for( uint8_t i = 0; i < context->info.component_num; i++ )
+    {
+        size_t stride;
+        uint8_t* samples = mameJpeg_getComponentSamples( context, i, &stride );
+
+        uint8_t hor_shift = context->info.component[i].hor_shift;
+        uint8_t ver_shift = context->info.component[i].ver_shift;
+        double scale = 1.0 / ( 1 << ( hor_shift + ver_shift ) );
+        uint16_t plane_width = 8 * context->info.component[i].hor_sampling;
+        uint16_t plane_height = 8 * context->info.component[i].ver_sampling;
+        for( uint16_t y = 0; y < plane_height; y++ )
+        {
+            for( uint16_t x = 0; x < plane_width; x++ )
+            {
+                double value = 0.0;
+                for( uint16_t dy = 0; dy < ( 1 << ver_shift ); dy++ )
+                {
+                    /* replicate the last row into the MCU part below the bottom edge */
+                    size_t src_y = (size_t)mcu_height * ver_mcu_index + ( y << ver_shift ) + dy;
+                    src_y = ( src_y < context->info.height ) ? src_y : context->info.height - 1;
+                    const uint8_t* src_row = context->source.pixels + context->source.stride * ( src_y - context->source.first_row );
+                    for( uint16_t dx = 0; dx < ( 1 << hor_shift ); dx++ )
+                    {
+                        /* replicate the last column into the MCU part beyond the right edge */
+                        size_t src_x = (size_t)mcu_width * hor_mcu_index + ( x << hor_shift ) + dx;
+                        src_x = ( src_x < context->info.width ) ? src_x : context->info.width - 1;
+                        value += mameJpeg_applyEncodeColorConvert( context, &src_row[ context->info.component_num * src_x ], i );
+                    }
+                }
+                samples[ y * stride + x ] = mameJpeg_roundToSample( value * scale );
+            }
+        }
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_forwardDCTMCU( mameJpeg_context* context, uint16_t hor_mcu_index, uint16_t ver_mcu_index, double* dct_blocks )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( dct_blocks );
+
+    MAMEJPEG_CHECK( mameJpeg_moveBufferToMCU( context, hor_mcu_index, ver_mcu_index ) );
+
+    double* dct_block = dct_blocks;
+    for( uint8_t i = 0; i < context->info.component_num; i++ )
+    {
+        size_t stride;
+        uint8_t* samples = mameJpeg_getComponentSamples( context, i, &stride );
+
+        uint16_t num_of_hor_8x8blocks = context->info.component[ i ].hor_sampling;
+        uint16_t num_of_ver_8x8blocks = context->info.component[ i ].ver_sampling;
+        for( uint16_t ver_8x8block_index = 0; ver_8x8block_index < num_of_ver_8x8blocks; ver_8x8block_index++ )
+        {
+            for( uint16_t hor_8x8block_index = 0; hor_8x8block_index < num_of_hor_8x8blocks; hor_8x8block_index++ )
+            {
+                uint8_t* block_samples = samples + 8 * ( ver_8x8block_index * stride + hor_8x8block_index );
+                MAMEJPEG_CHECK( mameJpeg_loadSamples( block_samples, stride, dct_block ) );
+                MAMEJPEG_CHECK( mameJpeg_applyDCT( dct_block, true ) );
+                dct_block += 64;
+            }
+        }
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_quantizeMCU( mameJpeg_context* context, const double* dct_blocks, int16_t* coeff_blocks, uint64_t* nonzero_masks )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( dct_blocks );
+    MAMEJPEG_NULL_CHECK( coeff_blocks );
+    MAMEJPEG_NULL_CHECK( nonzero_masks );
+
+    const double* dct_block = dct_blocks;
+    int16_t* coeff_block = coeff_blocks;
+    uint64_t* nonzero_mask = nonzero_masks;
+    for( uint8_t i = 0; i < context->info.component_num; i++ )
+    {
+        uint16_t num_of_8x8blocks = context->info.component[ i ].hor_sampling * context->info.component[ i ].ver_sampling;
+        for( uint16_t j = 0; j < num_of_8x8blocks; j++ )
+        {
+            MAMEJPEG_CHECK( mameJpeg_applyQuantize( context, i, dct_block, coeff_block, nonzero_mask ) );
+            dct_block += 64;
+            coeff_block += 64;
+            nonzero_mask++;
+        }
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_transformMCU( mameJpeg_context* context, uint16_t hor_mcu_index, uint16_t ver_mcu_index, int16_t* coeff_blocks, uint64_t* nonzero_masks )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->info.mcu_block_num <= MAMEJPEG_MAX_MCU_BLOCK_NUM );
+
+    double dct_blocks[ 64 * MAMEJPEG_MAX_MCU_BLOCK_NUM ];
+    MAMEJPEG_CHECK( mameJpeg_forwardDCTMCU( context, hor_mcu_index, ver_mcu_index, dct_blocks ) );
+    MAMEJPEG_CHECK( mameJpeg_quantizeMCU( context, dct_blocks, coeff_blocks, nonzero_masks ) );
+
+    return true;
+}
+
+static
+bool mameJpeg_cacheMCUTransform( mameJpeg_context* context, uint16_t hor_mcu_index, uint16_t ver_mcu_index, float* dct_blocks )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( dct_blocks );
+    MAMEJPEG_CHECK( context->info.mcu_block_num <= MAMEJPEG_MAX_MCU_BLOCK_NUM );
+
+    double dct_work_buffer[ 64 * MAMEJPEG_MAX_MCU_BLOCK_NUM ];
+    MAMEJPEG_CHECK( mameJpeg_forwardDCTMCU( context, hor_mcu_index, ver_mcu_index, dct_work_buffer ) );
+    for( size_t i = 0; i < (size_t)64 * context->info.mcu_block_num; i++ )
+    {
+        dct_blocks[i] = (float)dct_work_buffer[i];
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_quantizeCachedMCU( mameJpeg_context* context, const float* dct_blocks, int16_t* coeff_blocks, uint64_t* nonzero_masks )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( dct_blocks );
+    MAMEJPEG_CHECK( context->info.mcu_block_num <= MAMEJPEG_MAX_MCU_BLOCK_NUM );
+
+    double dct_work_buffer[ 64 * MAMEJPEG_MAX_MCU_BLOCK_NUM ];
+    for( size_t i = 0; i < (size_t)64 * context->info.mcu_block_num; i++ )
+    {
+        dct_work_buffer[i] = dct_blocks[i];
+    }
+    MAMEJPEG_CHECK( mameJpeg_quantizeMCU( context, dct_work_buffer, coeff_blocks, nonzero_masks ) );
+
+    return true;
+}
+
+static
+bool mameJpeg_entropyEncodeMCU( mameJpeg_context* context, const int16_t* coeff_blocks, const uint64_t* nonzero_masks )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( coeff_blocks );
+    MAMEJPEG_NULL_CHECK( nonzero_masks );
+
+    const int16_t* coeff_block = coeff_blocks;
+    const uint64_t* nonzero_mask = nonzero_masks;
+    for( uint8_t i = 0; i < context->info.component_num; i++ )
+    {
+        uint16_t num_of_8x8blocks = context->info.component[ i ].hor_sampling * context->info.component[ i ].ver_sampling;
+        for( uint16_t j = 0; j < num_of_8x8blocks; j++ )
+        {
+            MAMEJPEG_CHECK( mameJpeg_encodeDC( context, i, coeff_block ) );
+            MAMEJPEG_CHECK( mameJpeg_encodeAC( context, i, coeff_block, *nonzero_mask ) );
+            coeff_block += 64;
+            nonzero_mask++;
+        }
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_encodeMCU( mameJpeg_context* context, uint16_t hor_mcu_index, uint16_t ver_mcu_index )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    uint64_t nonzero_masks[ MAMEJPEG_MAX_MCU_BLOCK_NUM ];
+    MAMEJPEG_CHECK( context->info.mcu_block_num <= MAMEJPEG_MAX_MCU_BLOCK_NUM );
+    MAMEJPEG_CHECK( mameJpeg_transformMCU( context, hor_mcu_index, ver_mcu_index, context->info.coeff_blocks, nonzero_masks ) );
+    MAMEJPEG_CHECK( mameJpeg_entropyEncodeMCU( context, context->info.coeff_blocks, nonzero_masks ) );
+
+    return true;
+}
+
+static
+bool mameJpeg_startEncodeImage( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_HEADER );
+
+    MAMEJPEG_CHECK( mameJpeg_setupMCULayout( context, 1 ) );
+
+    size_t coeff_buffer_size = mameJpeg_getCoeffBufferSize( context->info.mcu_block_num );
+    MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, coeff_buffer_size, (void**)&context->info.coeff_blocks ) );
+
+    /* output only contexts get quantized DCT blocks and never see samples */
+    if( !context->source.is_output_only )
+    {
+        size_t sample_buffer_size = mameJpeg_getSampleBufferSize( context->info.mcu_block_num );
+        MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, sample_buffer_size, (void**)&context->info.mcu_samples ) );
+    }
+
+    /* a caller surface is read in place and needs no line buffer */
+    if( !context->source.is_surface && !context->source.is_output_only )
+    {
+        context->line_buffer_length = mameJpeg_getLineBufferSize( context->info.width,
+                context->info.component_num,
+                context->info.component[0].ver_sampling );
+        MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, context->line_buffer_length, (void**)&context->line_buffer ) );
+
+        context->source.pixels = context->line_buffer;
+        context->source.stride = (size_t)context->info.component_num * context->info.width;
+        context->source.first_row = 0;
+    }
+
+    uint16_t hor_mcu_num = 0;
+    uint16_t ver_mcu_num = 0;
+    MAMEJPEG_CHECK( mameJpeg_getNumOfMCU( context, &hor_mcu_num, &ver_mcu_num ) );
+
+    context->cursor.phase = MAMEJPEG_PHASE_SCAN;
+    context->cursor.mcu_col_index = 0;
+    context->cursor.mcu_row_index = 0;
+    context->cursor.mcu_row_num = ver_mcu_num;
+    context->cursor.restart_countdown = context->info.restart_interval;
+
+    return true;
+}
+
+static
+bool mameJpeg_advanceEncodeCursor( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    uint16_t hor_mcu_num = 0;
+    uint16_t ver_mcu_num = 0;
+    MAMEJPEG_CHECK( mameJpeg_getNumOfMCU( context, &hor_mcu_num, &ver_mcu_num ) );
+
+    if( 0 < context->info.restart_interval )
+    {
+        context->cursor.restart_countdown--;
+        if( context->cursor.restart_countdown == 0 )
+        {
+            MAMEJPEG_CHECK( mameJpeg_restartEncode( context ) );
+            context->cursor.restart_countdown = context->info.restart_interval;
+        }
+    }
+
+    context->cursor.mcu_col_index++;
+    if( hor_mcu_num <= context->cursor.mcu_col_index )
+    {
+        context->cursor.mcu_col_index = 0;
+        context->cursor.mcu_row_index++;
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_encodeBufferedMCU( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_SCAN );
+    MAMEJPEG_CHECK( context->cursor.mcu_row_index < context->cursor.mcu_row_num );
+
+    uint16_t hor_mcu_index = context->cursor.mcu_col_index;
+    uint16_t ver_mcu_index = context->cursor.mcu_row_index;
+    MAMEJPEG_CHECK( mameJpeg_encodeMCU( context, hor_mcu_index, ver_mcu_index ) );
+    MAMEJPEG_CHECK( mameJpeg_advanceEncodeCursor( context ) );
+
+    return true;
+}
+
+static
+bool mameJpeg_encodeNextMCU( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->cursor.mcu_row_index < context->cursor.mcu_row_num );
+
+    if( context->cursor.mcu_col_index == 0 && !context->source.is_surface )
+    {
+        MAMEJPEG_CHECK( mameJpeg_readIntoBuffer( context, context->cursor.mcu_row_index ) );
+    }
+    MAMEJPEG_CHECK( mameJpeg_encodeBufferedMCU( context ) );
+
+    return true;
+}
+
+static
+bool mameJpeg_endEncodeImage( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_SCAN );
+    MAMEJPEG_CHECK( context->cursor.mcu_row_num <= context->cursor.mcu_row_index );
+
+    MAMEJPEG_CHECK( mameJpeg_stream_flushBits( context->output_stream ) );
+    context->cursor.phase = MAMEJPEG_PHASE_TRAILER;
+
+    return true;
+}
+
+static
+bool mameJpeg_encodeImage( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    MAMEJPEG_CHECK( mameJpeg_startEncodeImage( context ) );
+    while( context->cursor.mcu_row_index < context->cursor.mcu_row_num )
+    {
+        MAMEJPEG_CHECK( mameJpeg_encodeNextMCU( context ) );
+    }
+    MAMEJPEG_CHECK( mameJpeg_endEncodeImage( context ) );
+
+    return true;
+}
+
+static
+bool mameJpeg_encodeSOISegment( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, MAMEJPEG_MARKER_SOI ) );
+
+    return true;
+}
+
+static
+bool mameJpeg_encodeDQTSegment( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, MAMEJPEG_MARKER_DQT ) );
+
+    uint8_t quant_table_num = 0;
+    for( int i = 0; i < 4; i++ )
+    {
+        quant_table_num += ( context->info.quant_table[i] != NULL ) ? 1 : 0;
+    }
+
+    uint16_t dqt_size = quant_table_num * 65 + 2;
+    MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, dqt_size ) );
+
+    for( uint8_t i = 0; i < 4; i++ )
+    {
+        if( context->info.quant_table[i] == NULL )
+        {
+            continue;
+        }
+
+        /* 8 bit precision, destination is the index the components refer to */
+        MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, i ) );
+        for( uint8_t j = 0; j < 64; j++ )
+        {
+            MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, context->info.quant_table[i][j] ) );
+        }
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_encodeSOF0Segment( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, MAMEJPEG_MARKER_SOF0 ) );
+
+    uint16_t sfo0_size = 6 + context->info.component_num * 3 + 2;
+    MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, sfo0_size ) );
+
+    MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, context->info.accuracy ) );
+    MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, context->info.height ) );
+    MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, context->info.width ) );
+    MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, context->info.component_num ) );
+
+    for( uint8_t i = 0; i < context->info.component_num; i++ )
+    {
+        uint8_t component_index = i + 1;
+        MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, component_index ) );
+        uint8_t sampling = ( context->info.component[i].hor_sampling << 4 ) | context->info.component[i].ver_sampling;
+        MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, sampling ) );
+        MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, context->info.component[i].quant_table_index ) );
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_buildOptimalHuffmanTable( const uint32_t* symbol_freq, uint8_t* code_bits, uint8_t* code_values )
+{
+    MAMEJPEG_NULL_CHECK( symbol_freq );
+    MAMEJPEG_NULL_CHECK( code_bits );
+    MAMEJPEG_NULL_CHECK( code_values );
+
+    /* ITU T.81 Annex K.2, symbol 256 reserves the all-ones code */
+    uint32_t freq[257];
+    uint8_t code_size[257];
+    int16_t others[257];
+    for( int i = 0; i < 257; i++ )
+    {
+        freq[i] = ( i < 256 ) ? symbol_freq[i] : 1;
+        code_size[i] = 0;
+        others[i] = -1;
+    }
+
+    while( true )
+    {
+        /* the two least frequent trees, the higher symbol first on ties */
+        int16_t c1 = -1;
+        int16_t c2 = -1;
+        for( int16_t i = 0; i < 257; i++ )
+        {
+            if( freq[i] == 0 )
+            {
+                continue;
+            }
+            if( c1 < 0 || freq[i] <= freq[c1] )
+            {
+                c2 = c1;
+                c1 = i;
+            }
+            else if( c2 < 0 || freq[i] <= freq[c2] )
+            {
+                c2 = i;
+            }
+        }
+        if( c2 < 0 )
+        {
+            break;
+        }
+
+        freq[c1] += freq[c2];
+        freq[c2] = 0;
+
+        code_size[c1]++;
+        while( 0 <= others[c1] )
+        {
+            c1 = others[c1];
+            code_size[c1]++;
+        }
+        others[c1] = c2;
+
+        code_size[c2]++;
+        while( 0 <= others[c2] )
+        {
+            c2 = others[c2];
+            code_size[c2]++;
+        }
+    }
+
+    uint8_t bits[33];
+    memset( bits, 0x00, sizeof( bits ) );
+    for( int i = 0; i < 257; i++ )
+    {
+        if( 0 < code_size[i] )
+        {
+            MAMEJPEG_CHECK( code_size[i] <= 32 );
+            bits[ code_size[i] ]++;
+        }
+    }
+
+    /* limit code lengths to 16 bits */
+    for( int i = 32; 16 < i; i-- )
+    {
+        while( 0 < bits[i] )
+        {
+            int j = i - 2;
+            while( bits[j] == 0 )
+            {
+                j--;
+            }
+            bits[i] -= 2;
+            bits[i - 1]++;
+            bits[j + 1] += 2;
+            bits[j]--;
+        }
+    }
+
+    /* drop the reserved code from the longest length */
+    int longest = 16;
+    while( bits[longest] == 0 )
+    {
+        longest--;
+    }
+    bits[longest]--;
+
+    memcpy( code_bits, &bits[1], 16 );
+
+    int value_num = 0;
+    for( int length = 1; length <= 32; length++ )
+    {
+        for( int i = 0; i < 256; i++ )
+        {
+            if( code_size[i] == length )
+            {
+                code_values[ value_num ] = (uint8_t)i;
+                value_num++;
+            }
+        }
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_buildHuffmanCodes( mameJpeg_context* context, uint8_t ac_dc, uint8_t luma_chroma, const uint8_t* code_bits, const uint8_t* code_values )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( code_bits );
+    MAMEJPEG_NULL_CHECK( code_values );
+
+    /* the table is rebuilt in place when the codes change between passes */
+    size_t huffman_table_buffer_size = sizeof( huffman_code ) * 256;
+    void** huffman_code_table_ptr = (void**)&context->info.huff_table[ac_dc][luma_chroma].codes;
+    if( *huffman_code_table_ptr == NULL )
+    {
+        MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, huffman_table_buffer_size, huffman_code_table_ptr ) );
+    }
+    huffman_code* codes = context->info.huff_table[ac_dc][luma_chroma].codes;
+    memset( codes, 0x00, huffman_table_buffer_size );
+
+    uint16_t code = 0;
+    uint16_t total_codes = 0;
+    for( int i = 0; i < 16; i++ )
+    {
+        uint16_t num_of_codes = code_bits[i];
+        context->info.huff_table[ac_dc][luma_chroma].offsets[i] = total_codes;
+        for( int j = 0; j < num_of_codes; j++ )
+        {
+            uint8_t value = code_values[ total_codes + j ];
+            codes[ value ].code = code;
+            codes[ value ].size = i + 1;
+            code++;
+        }
+
+        code <<= 1;
+        total_codes += num_of_codes;
+    }
+    context->info.huff_table[ac_dc][luma_chroma].offsets[16] = total_codes;
+
+    return true;
+}
+
+static
+bool mameJpeg_encodeDHTSegment( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    uint8_t max_luma_chroma = ( context->info.component_num == 1 ) ? 1 : 2;
+    for( uint8_t luma_chroma = 0; luma_chroma < max_luma_chroma; luma_chroma++ )
+    {
+        for( uint8_t ac_dc = 0; ac_dc < 2; ac_dc++ )
+        {
+            const uint8_t* code_bits = MAMEJPEG_DEFAULT_HUFFMAN_CODE_BITS[ac_dc][luma_chroma];
+            const uint8_t* code_values = MAMEJPEG_DEFAULT_HUFFMAN_CODE_VALUE[ac_dc][luma_chroma];
+            if( context->huff_optimize.code_bits[ac_dc][luma_chroma] != NULL )
+            {
+                code_bits = context->huff_optimize.code_bits[ac_dc][luma_chroma];
+                code_values = context->huff_optimize.code_values[ac_dc][luma_chroma];
+            }
+
+            MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, MAMEJPEG_MARKER_DHT ) );
+
+            int code_num = 0;
+            for( int i = 0; i < 16; i++ )
+            {
+                code_num += code_bits[i];
+            }
+            uint16_t dht_size = code_num + 16 + 1 + 2;
+            MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, dht_size ) );
+
+            uint8_t huff_type = ( ac_dc << 4 ) | luma_chroma;
+            MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, huff_type ) );
+
+            MAMEJPEG_CHECK( mameJpeg_buildHuffmanCodes( context, ac_dc, luma_chroma, code_bits, code_values ) );
+
+            for( int i = 0; i < 16; i++ )
+            {
+                MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, code_bits[i] ) );
+            }
+
+            for( int i = 0; i < code_num; i++ )
+            {
+                MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, code_values[i] ) );
+            }
+
+        }
+    }
+    return true;
+}
+
+static
+bool mameJpeg_encodeSOSSegment( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, MAMEJPEG_MARKER_SOS ) );
+
+    uint16_t sos_size = 4 + context->info.component_num * 2 + 2;
+    MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, sos_size ) );
+
+    MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, context->info.component_num ) );
+    for( uint8_t i = 0; i < context->info.component_num; i++ )
+    {
+        uint8_t component_index = i + 1;
+        MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, component_index ) );
+
+        uint8_t table_index = ( context->info.component[i].huff_table_index[1] << 4 ) | context->info.component[i].huff_table_index[0];
+        MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, table_index ) );
+    }
+
+    MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, 0 ) );
+    MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, 63 ) );
+    MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, 0 ) );
+
+    return true;
+}
+
+static
+bool mameJpeg_encodeEOISegment( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, MAMEJPEG_MARKER_EOI ) );
+
+    return true;
+}
+
+static
+size_t mameJpeg_getPushSinkSize( uint8_t mcu_block_num )
+{
+    /* a coefficient takes at most a 16 bit code and 11 magnitude bits, doubled by 0xff stuffing */
+    size_t mcu_bytes = (size_t)mcu_block_num * 64 * ( 16 + 11 ) * 2 / 8 + 8;
+    /* the whole header is emitted at once and is below 1KB with the default tables */
+    size_t header_bytes = 1024;
+    return ( mcu_bytes < header_bytes ) ? header_bytes : mcu_bytes;
+}
+
+static
+size_t mameJpeg_getOptimizeTableSize( void )
+{
+    return 4 * ( sizeof( uint32_t ) * 256 + 16 + 256 );
+}
+
+static
+bool mameJpeg_rewindEncodeCursor( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    MAMEJPEG_CHECK( mameJpeg_restartEncode( context ) );
+    context->cursor.mcu_col_index = 0;
+    context->cursor.mcu_row_index = 0;
+    context->cursor.restart_countdown = context->info.restart_interval;
+
+    return true;
+}
+
+static
+bool mameJpeg_startHuffmanStatistics( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    for( uint8_t ac_dc = 0; ac_dc < 2; ac_dc++ )
+    {
+        for( uint8_t luma_chroma = 0; luma_chroma < 2; luma_chroma++ )
+        {
+            uint32_t** symbol_freq = &context->huff_optimize.symbol_freq[ac_dc][luma_chroma];
+            MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, sizeof( uint32_t ) * 256, (void**)symbol_freq ) );
+            memset( *symbol_freq, 0x00, sizeof( uint32_t ) * 256 );
+        }
+    }
+    context->huff_optimize.is_gathering = true;
+
+    return true;
+}
+
+static
+bool mameJpeg_finishHuffmanStatistics( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->huff_optimize.is_gathering );
+
+    context->huff_optimize.is_gathering = false;
+
+    uint8_t max_luma_chroma = ( context->info.component_num == 1 ) ? 1 : 2;
+    for( uint8_t ac_dc = 0; ac_dc < 2; ac_dc++ )
+    {
+        for( uint8_t luma_chroma = 0; luma_chroma < max_luma_chroma; luma_chroma++ )
+        {
+            uint8_t** code_bits = &context->huff_optimize.code_bits[ac_dc][luma_chroma];
+            uint8_t** code_values = &context->huff_optimize.code_values[ac_dc][luma_chroma];
+            MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, 16, (void**)code_bits ) );
+            MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, 256, (void**)code_values ) );
+            MAMEJPEG_CHECK( mameJpeg_buildOptimalHuffmanTable( context->huff_optimize.symbol_freq[ac_dc][luma_chroma], *code_bits, *code_values ) );
+        }
+    }
+
+    MAMEJPEG_CHECK( mameJpeg_encodeDHTSegment( context ) );
+    MAMEJPEG_CHECK( mameJpeg_encodeSOSSegment( context ) );
+
+    return true;
+}
+
+static
+bool mameJpeg_encodeOptimizedImage( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_SCAN );
+
+    uint16_t hor_mcu_num = 0;
+    uint16_t ver_mcu_num = 0;
+    MAMEJPEG_CHECK( mameJpeg_getNumOfMCU( context, &hor_mcu_num, &ver_mcu_num ) );
+    size_t block_num = (size_t)hor_mcu_num * ver_mcu_num * context->info.mcu_block_num;
+
+    MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, sizeof( int16_t ) * 64 * block_num, (void**)&context->huff_optimize.coeff_cache ) );
+    MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, sizeof( uint64_t ) * block_num, (void**)&context->huff_optimize.mask_cache ) );
+    MAMEJPEG_CHECK( mameJpeg_startHuffmanStatistics( context ) );
+
+    /* first pass: quantized coefficients are cached and their symbols counted */
+    int16_t* coeff_blocks = context->huff_optimize.coeff_cache;
+    uint64_t* nonzero_masks = context->huff_optimize.mask_cache;
+    while( context->cursor.mcu_row_index < context->cursor.mcu_row_num )
+    {
+        if( context->cursor.mcu_col_index == 0 && !context->source.is_surface )
+        {
+            MAMEJPEG_CHECK( mameJpeg_readIntoBuffer( context, context->cursor.mcu_row_index ) );
+        }
+        MAMEJPEG_CHECK( mameJpeg_transformMCU( context,
+                    context->cursor.mcu_col_index,
+                    context->cursor.mcu_row_index,
+                    coeff_blocks,
+                    nonzero_masks ) );
+        MAMEJPEG_CHECK( mameJpeg_entropyEncodeMCU( context, coeff_blocks, nonzero_masks ) );
+        MAMEJPEG_CHECK( mameJpeg_advanceEncodeCursor( context ) );
+
+        coeff_blocks += 64 * context->info.mcu_block_num;
+        nonzero_masks += context->info.mcu_block_num;
+    }
+    MAMEJPEG_CHECK( mameJpeg_finishHuffmanStatistics( context ) );
+
+    /* second pass: entropy code the cached coefficients with the new tables */
+    MAMEJPEG_CHECK( mameJpeg_rewindEncodeCursor( context ) );
+    coeff_blocks = context->huff_optimize.coeff_cache;
+    nonzero_masks = context->huff_optimize.mask_cache;
+    while( context->cursor.mcu_row_index < context->cursor.mcu_row_num )
+    {
+        MAMEJPEG_CHECK( mameJpeg_entropyEncodeMCU( context, coeff_blocks, nonzero_masks ) );
+        MAMEJPEG_CHECK( mameJpeg_advanceEncodeCursor( context ) );
+
+        coeff_blocks += 64 * context->info.mcu_block_num;
+        nonzero_masks += context->info.mcu_block_num;
+    }
+    MAMEJPEG_CHECK( mameJpeg_endEncodeImage( context ) );
+
+    return true;
+}
+
+static
+bool mameJpeg_encodeHeader( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    MAMEJPEG_CHECK( mameJpeg_encodeSOISegment( context ) );
+    MAMEJPEG_CHECK( mameJpeg_encodeDQTSegment( context ) );
+    MAMEJPEG_CHECK( mameJpeg_encodeSOF0Segment( context ) );
+    MAMEJPEG_CHECK( mameJpeg_encodeDHTSegment( context ) );
+    MAMEJPEG_CHECK( mameJpeg_encodeSOSSegment( context ) );
+
+    return true;
+}
+
+static
+uint8_t mameJpeg_scaleQuantValue( uint8_t value, uint8_t quality )
+{
+    /* IJG quality scaling, 50 keeps the tables and 100 makes them all ones */
+    int scale = ( quality < 50 ) ? ( 5000 / quality ) : ( 200 - 2 * quality );
+    int scaled_value = ( value * scale + 50 ) / 100;
+    return (uint8_t)MAMEJPEG_CLIP( scaled_value, 1, 255 );
+}
+
+static
+bool mameJpeg_setScaledQuantTables( mameJpeg_context* context, const uint8_t* luma_table, const uint8_t* chroma_table, uint8_t quality )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( luma_table );
+    MAMEJPEG_CHECK( 1 <= quality && quality <= 100 );
+
+    const uint8_t* tables[2] = { luma_table, chroma_table };
+    for( uint8_t i = 0; i < 2; i++ )
+    {
+        if( context->info.quant_table[i] == NULL )
+        {
+            continue;
+        }
+        MAMEJPEG_NULL_CHECK( tables[i] );
+
+        for( uint8_t j = 0; j < 64; j++ )
+        {
+            uint8_t value = tables[i][ mameJpeg_getZigZagIndex( context, j ) ];
+            context->info.quant_table[i][j] = mameJpeg_scaleQuantValue( value, quality );
+        }
+    }
+
+    return true;
+}
+
+static
+size_t mameJpeg_getHeaderSize( mameJpeg_context* context )
+{
+    /* SOI, EOI and the segments written by mameJpeg_encodeHeader, none depends on the quality */
+    uint8_t quant_table_num = ( context->info.component_num == 1 ) ? 1 : 2;
+    size_t header_size = 2 + 2;
+    header_size += 2 + 2 + 65 * quant_table_num;
+    header_size += 2 + 8 + 3 * context->info.component_num;
+    header_size += 2 + 6 + 2 * context->info.component_num;
+
+    for( uint8_t luma_chroma = 0; luma_chroma < quant_table_num; luma_chroma++ )
+    {
+        for( uint8_t ac_dc = 0; ac_dc < 2; ac_dc++ )
+        {
+            header_size += 2 + 2 + 1 + 16;
+            for( int i = 0; i < 16; i++ )
+            {
+                header_size += MAMEJPEG_DEFAULT_HUFFMAN_CODE_BITS[ac_dc][luma_chroma][i];
+            }
+        }
+    }
+
+    return header_size;
+}
+
+static
+bool mameJpeg_setTargetQuality( mameJpeg_context* context, uint8_t quality )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    const uint8_t* chroma_table = ( context->info.component_num == 3 ) ? MAMEJPEG_STANDARD_QUANT_TABLE[1] : NULL;
+    MAMEJPEG_CHECK( mameJpeg_setScaledQuantTables( context, MAMEJPEG_STANDARD_QUANT_TABLE[0], chroma_table, quality ) );
+    context->rate_control.quality = quality;
+
+    return true;
+}
+
+static
+bool mameJpeg_estimateCachedImageSize( mameJpeg_context* context, uint8_t quality, size_t* estimated_bytes )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( estimated_bytes );
+
+    uint16_t hor_mcu_num = 0;
+    uint16_t ver_mcu_num = 0;
+    MAMEJPEG_CHECK( mameJpeg_getNumOfMCU( context, &hor_mcu_num, &ver_mcu_num ) );
+    size_t mcu_num = (size_t)hor_mcu_num * ver_mcu_num;
+
+    MAMEJPEG_CHECK( mameJpeg_setTargetQuality( context, quality ) );
+    MAMEJPEG_CHECK( mameJpeg_restartEncode( context ) );
+
+    /* code lengths only, nothing reaches the output stream */
+    context->rate_control.is_estimating = true;
+    context->rate_control.estimated_bits = 0;
+    uint64_t nonzero_masks[ MAMEJPEG_MAX_MCU_BLOCK_NUM ];
+    const float* dct_blocks = context->rate_control.dct_cache;
+    for( size_t i = 0; i < mcu_num; i++ )
+    {
+        MAMEJPEG_CHECK( mameJpeg_quantizeCachedMCU( context, dct_blocks, context->info.coeff_blocks, nonzero_masks ) );
+        MAMEJPEG_CHECK( mameJpeg_entropyEncodeMCU( context, context->info.coeff_blocks, nonzero_masks ) );
+        dct_blocks += 64 * context->info.mcu_block_num;
+    }
+    context->rate_control.is_estimating = false;
+
+    /* 0xff stuffing is not counted, so the real size is never below the estimate */
+    size_t scan_bytes = ( context->rate_control.estimated_bits + 7 ) / 8;
+    *estimated_bytes = mameJpeg_getHeaderSize( context ) + scan_bytes;
+
+    return true;
+}
+
+static
+bool mameJpeg_output_block_to_counter( void* param, const uint8_t* data, size_t size )
+{
+    MAMEJPEG_NULL_CHECK( param );
+    (void)data;
+
+    *(size_t*)param += size;
+    return true;
+}
+
+static
+bool mameJpeg_measureCachedImageSize( mameJpeg_context* context, uint8_t quality, size_t* encoded_bytes )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( encoded_bytes );
+
+    uint16_t hor_mcu_num = 0;
+    uint16_t ver_mcu_num = 0;
+    MAMEJPEG_CHECK( mameJpeg_getNumOfMCU( context, &hor_mcu_num, &ver_mcu_num ) );
+    size_t mcu_num = (size_t)hor_mcu_num * ver_mcu_num;
+
+    MAMEJPEG_CHECK( mameJpeg_setTargetQuality( context, quality ) );
+    MAMEJPEG_CHECK( mameJpeg_restartEncode( context ) );
+
+    /* the real bit writer with stuffing, its bytes are only counted */
+    mameJpeg_stream_context saved_stream = *context->output_stream;
+    size_t scan_bytes = 0;
+    context->output_stream->write_block = mameJpeg_output_block_to_counter;
+    context->output_stream->callback_param = &scan_bytes;
+    bool is_measured = true;
+    uint64_t nonzero_masks[ MAMEJPEG_MAX_MCU_BLOCK_NUM ];
+    const float* dct_blocks = context->rate_control.dct_cache;
+    for( size_t i = 0; i < mcu_num && is_measured; i++ )
+    {
+        is_measured = mameJpeg_quantizeCachedMCU( context, dct_blocks, context->info.coeff_blocks, nonzero_masks )
+                   && mameJpeg_entropyEncodeMCU( context, context->info.coeff_blocks, nonzero_masks );
+        dct_blocks += 64 * context->info.mcu_block_num;
+    }
+    is_measured = is_measured
+               && mameJpeg_stream_flushBits( context->output_stream )
+               && mameJpeg_stream_flushBuffer( context->output_stream );
+    *context->output_stream = saved_stream;
+    MAMEJPEG_CHECK( is_measured );
+
+    *encoded_bytes = mameJpeg_getHeaderSize( context ) + scan_bytes;
+
+    return true;
+}
+
+static
+bool mameJpeg_encodeTargetSizeImage( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_SCAN );
+    MAMEJPEG_CHECK( context->info.mcu_block_num <= MAMEJPEG_MAX_MCU_BLOCK_NUM );
+
+    uint16_t hor_mcu_num = 0;
+    uint16_t ver_mcu_num = 0;
+    MAMEJPEG_CHECK( mameJpeg_getNumOfMCU( context, &hor_mcu_num, &ver_mcu_num ) );
+    size_t block_num = (size_t)hor_mcu_num * ver_mcu_num * context->info.mcu_block_num;
+    MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, sizeof( float ) * 64 * block_num, (void**)&context->rate_control.dct_cache ) );
+
+    /* color conversion and forward DCT run once, every quality probe starts from the cache */
+    float* dct_blocks = context->rate_control.dct_cache;
+    while( context->cursor.mcu_row_index < context->cursor.mcu_row_num )
+    {
+        if( context->cursor.mcu_col_index == 0 && !context->source.is_surface )
+        {
+            MAMEJPEG_CHECK( mameJpeg_readIntoBuffer( context, context->cursor.mcu_row_index ) );
+        }
+        MAMEJPEG_CHECK( mameJpeg_cacheMCUTransform( context,
+                    context->cursor.mcu_col_index,
+                    context->cursor.mcu_row_index,
+                    dct_blocks ) );
+        MAMEJPEG_CHECK( mameJpeg_advanceEncodeCursor( context ) );
+
+        dct_blocks += 64 * context->info.mcu_block_num;
+    }
+
+    /* the default huffman codes are needed for the estimate before the DHT is written */
+    uint8_t max_luma_chroma = ( context->info.component_num == 1 ) ? 1 : 2;
+    for( uint8_t ac_dc = 0; ac_dc < 2; ac_dc++ )
+    {
+        for( uint8_t luma_chroma = 0; luma_chroma < max_luma_chroma; luma_chroma++ )
+        {
+            MAMEJPEG_CHECK( mameJpeg_buildHuffmanCodes( context,
+                        ac_dc,
+                        luma_chroma,
+                        MAMEJPEG_DEFAULT_HUFFMAN_CODE_BITS[ac_dc][luma_chroma],
+                        MAMEJPEG_DEFAULT_HUFFMAN_CODE_VALUE[ac_dc][luma_chroma] ) );
+        }
+    }
+
+    /* highest quality whose estimate fits, the size falls as the quality goes down */
+    size_t estimated_bytes = 0;
+    MAMEJPEG_CHECK( mameJpeg_estimateCachedImageSize( context, 1, &estimated_bytes ) );
+    MAMEJPEG_CHECK( estimated_bytes <= context->rate_control.target_bytes );
+    uint8_t low_quality = 1;
+    uint8_t high_quality = 100;
+    while( low_quality < high_quality )
+    {
+        uint8_t quality = ( low_quality + high_quality + 1 ) / 2;
+        MAMEJPEG_CHECK( mameJpeg_estimateCachedImageSize( context, quality, &estimated_bytes ) );
+        if( estimated_bytes <= context->rate_control.target_bytes )
+        {
+            low_quality = quality;
+        }
+        else
+        {
+            high_quality = quality - 1;
+        }
+    }
+
+    /* the estimate leaves out stuffing, step down until the real size fits */
+    size_t encoded_bytes = 0;
+    MAMEJPEG_CHECK( mameJpeg_measureCachedImageSize( context, low_quality, &encoded_bytes ) );
+    while( context->rate_control.target_bytes < encoded_bytes )
+    {
+        MAMEJPEG_CHECK( 1 < low_quality );
+        low_quality--;
+        MAMEJPEG_CHECK( mameJpeg_measureCachedImageSize( context, low_quality, &encoded_bytes ) );
+    }
+    MAMEJPEG_CHECK( mameJpeg_setTargetQuality( context, low_quality ) );
+
+    MAMEJPEG_CHECK( mameJpeg_encodeHeader( context ) );
+
+    MAMEJPEG_CHECK( mameJpeg_rewindEncodeCursor( context ) );
+    uint64_t nonzero_masks[ MAMEJPEG_MAX_MCU_BLOCK_NUM ];
+    dct_blocks = context->rate_control.dct_cache;
+    while( context->cursor.mcu_row_index < context->cursor.mcu_row_num )
+    {
+        MAMEJPEG_CHECK( mameJpeg_quantizeCachedMCU( context, dct_blocks, context->info.coeff_blocks, nonzero_masks ) );
+        MAMEJPEG_CHECK( mameJpeg_entropyEncodeMCU( context, context->info.coeff_blocks, nonzero_masks ) );
+        MAMEJPEG_CHECK( mameJpeg_advanceEncodeCursor( context ) );
+
+        dct_blocks += 64 * context->info.mcu_block_num;
+    }
+    MAMEJPEG_CHECK( mameJpeg_endEncodeImage( context ) );
+
+    return true;
+}
+
+bool mameJpeg_getEncodeBufferSize( size_t width, size_t height, mameJpeg_format format, size_t* encode_buffer_size )
+{
+    MAMEJPEG_NULL_CHECK( encode_buffer_size );
+
+    uint8_t component_num = mameJpeg_getComponentNum( format );
+    uint8_t luma_hor_sampling = mameJpeg_getLumaHorSampling( format );
+    uint8_t luma_ver_sampling = mameJpeg_getLumaVerSampling( format );
+
+    size_t mcu_buffer_size = mameJpeg_getMCUBufferSize( width,
+            component_num,
+            luma_hor_sampling,
+            luma_ver_sampling );
+    size_t line_buffer_size = mameJpeg_getLineBufferSize( width,
+            component_num,
+            luma_ver_sampling );
+
+    /* one symbol indexed code table per DC/AC and luma/chroma table */
+    uint8_t huffman_table_num = ( component_num == 1 ) ? 2 : 4;
+    size_t huffman_table_size = sizeof( huffman_code ) * 256 * huffman_table_num;
+
+    /* a table per component at most, coefficient input may carry a separate Cr table */
+    size_t quant_table_size = 64 * component_num;
+
+    *encode_buffer_size = mcu_buffer_size + line_buffer_size + huffman_table_size + quant_table_size
+                        + MAMEJPEG_OUTPUT_BUFFER_SIZE;
+    return true;
+}
+
+bool mameJpeg_getMultiQualityBufferSize( size_t width, size_t height, mameJpeg_format format, size_t* encode_buffer_size )
+{
+    MAMEJPEG_NULL_CHECK( encode_buffer_size );
+    /* no line buffer and a single MCU of coefficients, so the image size does not matter */
+    (void)width;
+    (void)height;
+
+    uint8_t component_num = mameJpeg_getComponentNum( format );
+    uint8_t luma_hor_sampling = mameJpeg_getLumaHorSampling( format );
+    uint8_t luma_ver_sampling = mameJpeg_getLumaVerSampling( format );
+
+    /* the coefficients of one MCU, no samples and no line buffer */
+    uint8_t mcu_block_num = mameJpeg_getMCUBlockNum( component_num, luma_hor_sampling, luma_ver_sampling );
+    size_t coeff_buffer_size = mameJpeg_getCoeffBufferSize( mcu_block_num );
+    uint8_t huffman_table_num = ( component_num == 1 ) ? 2 : 4;
+    size_t huffman_table_size = sizeof( huffman_code ) * 256 * huffman_table_num;
+    size_t quant_table_size = 64 * component_num;
+
+    *encode_buffer_size = coeff_buffer_size + huffman_table_size + quant_table_size + MAMEJPEG_OUTPUT_BUFFER_SIZE;
+    return true;
+}
+
+static
+bool mameJpeg_setupEncode( mameJpeg_context* context,
+        mameJpeg_stream_write_callback_ptr output_callback,
+        void* output_callback_param,
+        size_t width,
+        size_t height,
+        mameJpeg_format format,
+        uint8_t quality,
+        uint8_t* work_buffer,
+        size_t work_buffer_size )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( output_callback );
+    MAMEJPEG_NULL_CHECK( output_callback_param );
+    MAMEJPEG_NULL_CHECK( work_buffer );
+    MAMEJPEG_CHECK( 0 < width && width <= 0xffff );
+    MAMEJPEG_CHECK( 0 < height && height <= 0xffff );
+    MAMEJPEG_CHECK( 1 <= quality && quality <= 100 );
+    MAMEJPEG_CHECK( 0 < work_buffer_size );
+
+    memset( context, 0x00, sizeof( mameJpeg_context ));
+    mameJpeg_stream_output_initialize( context->output_stream, output_callback, output_callback_param );
+    context->mode = MAMEJPEG_MODE_ENCODE;
+
+    context->work_buffer_beg = work_buffer;
+    context->work_buffer_ptr = work_buffer;
+    context->work_buffer_end = work_buffer + work_buffer_size;
+
+    mameJpeg_stream_context* stream = context->output_stream;
+    MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, MAMEJPEG_OUTPUT_BUFFER_SIZE, (void**)&stream->out_buffer ) );
+    stream->out_capacity = MAMEJPEG_OUTPUT_BUFFER_SIZE;
+
+    context->info.accuracy = 8;
+    context->info.width = width;
+    context->info.height = height;
+    context->info.component_num = mameJpeg_getComponentNum( format );
+    for( int i = 0; i < context->info.component_num; i++ )
+    {
+        context->info.component[i].hor_sampling = ( i == 0 ) ? mameJpeg_getLumaHorSampling( format ) : 1;
+        context->info.component[i].ver_sampling = ( i == 0 ) ? mameJpeg_getLumaVerSampling( format ) : 1;
+        context->info.component[i].quant_table_index = ( i == 0 ) ? 0 : 1;
+        context->info.component[i].huff_table_index[0] = ( i == 0 ) ? 0 : 1;
+        context->info.component[i].huff_table_index[1] = ( i == 0 ) ? 0 : 1;
+        context->info.component[i].prev_dc_value = 0;
+    }
+
+    uint8_t quant_table_num = ( context->info.component_num == 1 ) ? 1 : 2;
+    for( uint8_t i = 0; i < quant_table_num; i++ )
+    {
+        MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, 64, (void**)&context->info.quant_table[i] ) );
+    }
+    const uint8_t* chroma_table = ( quant_table_num == 2 ) ? MAMEJPEG_STANDARD_QUANT_TABLE[1] : NULL;
+    MAMEJPEG_CHECK( mameJpeg_setScaledQuantTables( context, MAMEJPEG_STANDARD_QUANT_TABLE[0], chroma_table, quality ) );
+    context->rate_control.quality = quality;
+
+    return true;
+}
+
+bool mameJpeg_initializeEncode( mameJpeg_context* context,
+        mameJpeg_stream_read_callback_ptr input_callback,
+        void* input_callback_param,
+        mameJpeg_stream_write_callback_ptr output_callback,
+        void* output_callback_param,
+        size_t width,
+        size_t height,
+        mameJpeg_format format,
+        uint8_t quality,
+        uint8_t* work_buffer,
+        size_t work_buffer_size
+        )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( input_callback );
+    MAMEJPEG_NULL_CHECK( input_callback_param );
+
+    MAMEJPEG_CHECK( mameJpeg_setupEncode( context,
+                output_callback,
+                output_callback_param,
+                width,
+                height,
+                format,
+                quality,
+                work_buffer,
+                work_buffer_size ) );
+    mameJpeg_stream_input_initialize( context->input_stream, input_callback, input_callback_param );
+
+    return true;
+}
+
+bool mameJpeg_initializeMultiQualityEncode( mameJpeg_context* context,
+        mameJpeg_stream_write_callback_ptr output_callback,
+        void* output_callback_param,
+        size_t width,
+        size_t height,
+        mameJpeg_format format,
+        uint8_t quality,
+        uint8_t* work_buffer,
+        size_t work_buffer_size )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    MAMEJPEG_CHECK( mameJpeg_setupEncode( context,
+                output_callback,
+                output_callback_param,
+                width,
+                height,
+                format,
+                quality,
+                work_buffer,
+                work_buffer_size ) );
+    context->source.is_output_only = true;
+
+    return true;
+}
+
+bool mameJpeg_encode( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_ENCODE );
+    MAMEJPEG_CHECK( !context->source.is_output_only );
+
+    if( 0 < context->rate_control.target_bytes )
+    {
+        /* the header carries the quant tables of the selected quality */
+        MAMEJPEG_CHECK( !context->huff_optimize.is_enabled );
+        MAMEJPEG_CHECK( mameJpeg_startEncodeImage( context ) );
+        MAMEJPEG_CHECK( mameJpeg_encodeTargetSizeImage( context ) );
+    }
+    else if( context->huff_optimize.is_enabled )
+    {
+        /* DHT and SOS follow the statistics pass */
+        MAMEJPEG_CHECK( mameJpeg_encodeSOISegment( context ) );
+        MAMEJPEG_CHECK( mameJpeg_encodeDQTSegment( context ) );
+        MAMEJPEG_CHECK( mameJpeg_encodeSOF0Segment( context ) );
+        MAMEJPEG_CHECK( mameJpeg_startEncodeImage( context ) );
+        MAMEJPEG_CHECK( mameJpeg_encodeOptimizedImage( context ) );
+    }
+    else
+    {
+        MAMEJPEG_CHECK( mameJpeg_encodeHeader( context ) );
+        MAMEJPEG_CHECK( mameJpeg_encodeImage( context ) );
+    }
+    MAMEJPEG_CHECK( mameJpeg_encodeEOISegment( context ) );
+    MAMEJPEG_CHECK( mameJpeg_stream_flushBuffer( context->output_stream ) );
+    return true;
+}
+
+bool mameJpeg_encodeMultiQuality( mameJpeg_context* contexts, size_t context_num )
+{
+    MAMEJPEG_NULL_CHECK( contexts );
+    MAMEJPEG_CHECK( 0 < context_num );
+
+    /* contexts[0] reads the pixels, the others only need matching geometry and their own output */
+    mameJpeg_context* source = &contexts[0];
+    MAMEJPEG_CHECK( !source->source.is_output_only );
+    for( size_t i = 0; i < context_num; i++ )
+    {
+        mameJpeg_context* context = &contexts[i];
+        MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_ENCODE );
+        MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_HEADER );
+        MAMEJPEG_CHECK( !context->huff_optimize.is_enabled );
+        MAMEJPEG_CHECK( context->rate_control.target_bytes == 0 );
+        MAMEJPEG_CHECK( context->info.width == source->info.width );
+        MAMEJPEG_CHECK( context->info.height == source->info.height );
+        MAMEJPEG_CHECK( context->info.component_num == source->info.component_num );
+        MAMEJPEG_CHECK( context->info.component[0].hor_sampling == source->info.component[0].hor_sampling );
+        MAMEJPEG_CHECK( context->info.component[0].ver_sampling == source->info.component[0].ver_sampling );
+
+        MAMEJPEG_CHECK( mameJpeg_encodeHeader( context ) );
+        MAMEJPEG_CHECK( mameJpeg_startEncodeImage( context ) );
+    }
+    MAMEJPEG_CHECK( source->info.mcu_block_num <= MAMEJPEG_MAX_MCU_BLOCK_NUM );
+
+    /* color conversion and forward DCT once per MCU, quantization and entropy coding per output */
+    double dct_blocks[ 64 * MAMEJPEG_MAX_MCU_BLOCK_NUM ];
+    uint64_t nonzero_masks[ MAMEJPEG_MAX_MCU_BLOCK_NUM ];
+    while( source->cursor.mcu_row_index < source->cursor.mcu_row_num )
+    {
+        if( source->cursor.mcu_col_index == 0 && !source->source.is_surface )
+        {
+            MAMEJPEG_CHECK( mameJpeg_readIntoBuffer( source, source->cursor.mcu_row_index ) );
+        }
+        MAMEJPEG_CHECK( mameJpeg_forwardDCTMCU( source,
+                    source->cursor.mcu_col_index,
+                    source->cursor.mcu_row_index,
+                    dct_blocks ) );
+
+        for( size_t i = 0; i < context_num; i++ )
+        {
+            mameJpeg_context* context = &contexts[i];
+            MAMEJPEG_CHECK( mameJpeg_quantizeMCU( context, dct_blocks, context->info.coeff_blocks, nonzero_masks ) );
+            MAMEJPEG_CHECK( mameJpeg_entropyEncodeMCU( context, context->info.coeff_blocks, nonzero_masks ) );
+            MAMEJPEG_CHECK( mameJpeg_advanceEncodeCursor( context ) );
+        }
+    }
+
+    for( size_t i = 0; i < context_num; i++ )
+    {
+        mameJpeg_context* context = &contexts[i];
+        MAMEJPEG_CHECK( mameJpeg_endEncodeImage( context ) );
+        MAMEJPEG_CHECK( mameJpeg_encodeEOISegment( context ) );
+        MAMEJPEG_CHECK( mameJpeg_stream_flushBuffer( context->output_stream ) );
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_loadCoefficientMCU( mameJpeg_context* context, uint16_t hor_mcu_index, uint16_t ver_mcu_index, int16_t* coeff_blocks, uint64_t* nonzero_masks )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( coeff_blocks );
+    MAMEJPEG_NULL_CHECK( nonzero_masks );
+
+    const mameJpeg_coefficients* coefficients = context->coefficients;
+    int16_t* coeff_block = coeff_blocks;
+    uint64_t* nonzero_mask = nonzero_masks;
+    for( uint8_t i = 0; i < context->info.component_num; i++ )
+    {
+        uint16_t num_of_hor_8x8blocks = context->info.component[ i ].hor_sampling;
+        uint16_t num_of_ver_8x8blocks = context->info.component[ i ].ver_sampling;
+        for( uint16_t ver_8x8block_index = 0; ver_8x8block_index < num_of_ver_8x8blocks; ver_8x8block_index++ )
+        {
+            for( uint16_t hor_8x8block_index = 0; hor_8x8block_index < num_of_hor_8x8blocks; hor_8x8block_index++ )
+            {
+                size_t block_x = (size_t)hor_mcu_index * num_of_hor_8x8blocks + hor_8x8block_index;
+                size_t block_y = (size_t)ver_mcu_index * num_of_ver_8x8blocks + ver_8x8block_index;
+                size_t block_index = block_y * coefficients->component[i].hor_block_num + block_x;
+                memcpy( coeff_block, coefficients->component[i].blocks + 64 * block_index, sizeof( int16_t ) * 64 );
+
+                uint64_t mask = 0;
+                for( int j = 0; j < 64; j++ )
+                {
+                    mask |= (uint64_t)( coeff_block[ mameJpeg_getZigZagIndex( context, j ) ] != 0 ) << j;
+                }
+                *nonzero_mask = mask;
+
+                coeff_block += 64;
+                nonzero_mask++;
+            }
+        }
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_encodeCoefficientScan( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->info.mcu_block_num <= MAMEJPEG_MAX_MCU_BLOCK_NUM );
+
+    MAMEJPEG_CHECK( mameJpeg_rewindEncodeCursor( context ) );
+    uint64_t nonzero_masks[ MAMEJPEG_MAX_MCU_BLOCK_NUM ];
+    while( context->cursor.mcu_row_index < context->cursor.mcu_row_num )
+    {
+        MAMEJPEG_CHECK( mameJpeg_loadCoefficientMCU( context,
+                    context->cursor.mcu_col_index,
+                    context->cursor.mcu_row_index,
+                    context->info.coeff_blocks,
+                    nonzero_masks ) );
+        MAMEJPEG_CHECK( mameJpeg_entropyEncodeMCU( context, context->info.coeff_blocks, nonzero_masks ) );
+        MAMEJPEG_CHECK( mameJpeg_advanceEncodeCursor( context ) );
+    }
+
+    return true;
+}
+
+bool mameJpeg_initializeCoefficientEncode( mameJpeg_context* context,
+        mameJpeg_stream_write_callback_ptr output_callback,
+        void* output_callback_param,
+        const mameJpeg_coefficients* coefficients,
+        uint8_t* work_buffer,
+        size_t work_buffer_size )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( coefficients );
+
+    MAMEJPEG_CHECK( mameJpeg_setupEncode( context,
+                output_callback,
+                output_callback_param,
+                coefficients->width,
+                coefficients->height,
+                coefficients->format,
+                100,
+                work_buffer,
+                work_buffer_size ) );
+    MAMEJPEG_CHECK( coefficients->component_num == context->info.component_num );
+
+    uint16_t hor_mcu_num = 0;
+    uint16_t ver_mcu_num = 0;
+    MAMEJPEG_CHECK( mameJpeg_getNumOfMCU( context, &hor_mcu_num, &ver_mcu_num ) );
+    for( uint8_t i = 0; i < context->info.component_num; i++ )
+    {
+        MAMEJPEG_NULL_CHECK( coefficients->component[i].blocks );
+        MAMEJPEG_CHECK( coefficients->component[i].hor_block_num == hor_mcu_num * context->info.component[i].hor_sampling );
+        MAMEJPEG_CHECK( coefficients->component[i].ver_block_num == ver_mcu_num * context->info.component[i].ver_sampling );
+    }
+
+    /* Cb and Cr share a table unless the source had separate ones */
+    if( context->info.component_num == 3
+            && memcmp( coefficients->component[1].quant_table, coefficients->component[2].quant_table, 64 ) != 0 )
+    {
+        MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, 64, (void**)&context->info.quant_table[2] ) );
+        context->info.component[2].quant_table_index = 2;
+    }
+    for( uint8_t i = 0; i < context->info.component_num; i++ )
+    {
+        uint8_t* quant_table = context->info.quant_table[ context->info.component[i].quant_table_index ];
+        for( uint8_t j = 0; j < 64; j++ )
+        {
+            quant_table[j] = coefficients->component[i].quant_table[ mameJpeg_getZigZagIndex( context, j ) ];
+            MAMEJPEG_CHECK( 0 < quant_table[j] );
+        }
+    }
+    context->rate_control.quality = 0;
+    context->coefficients = coefficients;
+
+    return true;
+}
+
+bool mameJpeg_writeCoefficients( mameJpeg_context* context )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( context->coefficients );
+    MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_ENCODE );
+    MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_HEADER );
+    MAMEJPEG_CHECK( context->rate_control.target_bytes == 0 );
+
+    if( context->huff_optimize.is_enabled )
+    {
+        /* the coefficients are already in memory, the statistics pass needs no cache */
+        MAMEJPEG_CHECK( mameJpeg_encodeSOISegment( context ) );
+        MAMEJPEG_CHECK( mameJpeg_encodeDQTSegment( context ) );
+        MAMEJPEG_CHECK( mameJpeg_encodeSOF0Segment( context ) );
+        MAMEJPEG_CHECK( mameJpeg_startEncodeImage( context ) );
+        MAMEJPEG_CHECK( mameJpeg_startHuffmanStatistics( context ) );
+        MAMEJPEG_CHECK( mameJpeg_encodeCoefficientScan( context ) );
+        MAMEJPEG_CHECK( mameJpeg_finishHuffmanStatistics( context ) );
+    }
+    else
+    {
+        MAMEJPEG_CHECK( mameJpeg_encodeHeader( context ) );
+        MAMEJPEG_CHECK( mameJpeg_startEncodeImage( context ) );
+    }
+    MAMEJPEG_CHECK( mameJpeg_encodeCoefficientScan( context ) );
+    MAMEJPEG_CHECK( mameJpeg_endEncodeImage( context ) );
+    MAMEJPEG_CHECK( mameJpeg_encodeEOISegment( context ) );
+    MAMEJPEG_CHECK( mameJpeg_stream_flushBuffer( context->output_stream ) );
+
+    return true;
+}
+
+static
+mameJpeg_format mameJpeg_getTransposedFormat( mameJpeg_format format )
+{
+    switch( format )
+    {
+    case MAMEJPEG_FORMAT_YCBCR_422v:
+        return MAMEJPEG_FORMAT_YCBCR_422h;
+    case MAMEJPEG_FORMAT_YCBCR_422h:
+        return MAMEJPEG_FORMAT_YCBCR_422v;
+    default:
+        return format;
+    }
+}
+
+bool mameJpeg_transformCoefficients( const mameJpeg_coefficients* src,
+        mameJpeg_transform transform,
+        mameJpeg_coefficients* dst,
+        uint8_t* coefficient_buffer,
+        size_t coefficient_buffer_size )
+{
+    MAMEJPEG_NULL_CHECK( src );
+    MAMEJPEG_NULL_CHECK( dst );
+    MAMEJPEG_NULL_CHECK( coefficient_buffer );
+    MAMEJPEG_CHECK( src != dst );
+    MAMEJPEG_CHECK( src->component_num == mameJpeg_getComponentNum( src->format ) );
+
+    /* every transform is an optional transpose followed by optional flips */
+    const bool transform_table[7][3] = {
+        /* transpose, flip x, flip y */
+        { false, true,  false },
+        { false, false, true  },
+        { true,  false, false },
+        { true,  true,  true  },
+        { true,  true,  false },
+        { false, true,  true  },
+        { true,  false, true  },
+    };
+    MAMEJPEG_CHECK( 0 <= transform && transform <= MAMEJPEG_TRANSFORM_ROTATE_270 );
+    bool is_transposed = transform_table[transform][0];
+    bool is_flipped_x = transform_table[transform][1];
+    bool is_flipped_y = transform_table[transform][2];
+
+    /* image and MCU size after the transpose */
+    size_t width = is_transposed ? src->height : src->width;
+    size_t height = is_transposed ? src->width : src->height;
+    mameJpeg_format format = is_transposed ? mameJpeg_getTransposedFormat( src->format ) : src->format;
+    size_t mcu_width = 8 * mameJpeg_getLumaHorSampling( format );
+    size_t mcu_height = 8 * mameJpeg_getLumaVerSampling( format );
+
+    /* a flipped axis drops its partial edge MCU, it would otherwise move padding into the image */
+    size_t dst_width = is_flipped_x ? width / mcu_width * mcu_width : width;
+    size_t dst_height = is_flipped_y ? height / mcu_height * mcu_height : height;
+    MAMEJPEG_CHECK( 0 < dst_width && 0 < dst_height );
+
+    memset( dst, 0x00, sizeof( mameJpeg_coefficients ) );
+    dst->width = dst_width;
+    dst->height = dst_height;
+    dst->format = format;
+    dst->component_num = src->component_num;
+
+    int16_t* blocks = (int16_t*)coefficient_buffer;
+    size_t used_size = 0;
+    for( uint8_t i = 0; i < src->component_num; i++ )
+    {
+        uint16_t hor_sampling = ( i == 0 ) ? mameJpeg_getLumaHorSampling( format ) : 1;
+        uint16_t ver_sampling = ( i == 0 ) ? mameJpeg_getLumaVerSampling( format ) : 1;
+        uint16_t src_hor_block_num = is_transposed ? src->component[i].ver_block_num : src->component[i].hor_block_num;
+        uint16_t src_ver_block_num = is_transposed ? src->component[i].hor_block_num : src->component[i].ver_block_num;
+        uint16_t hor_block_num = ( dst_width + mcu_width - 1 ) / mcu_width * hor_sampling;
+        uint16_t ver_block_num = ( dst_height + mcu_height - 1 ) / mcu_height * ver_sampling;
+        MAMEJPEG_NULL_CHECK( src->component[i].blocks );
+        MAMEJPEG_CHECK( hor_block_num <= src_hor_block_num && ver_block_num <= src_ver_block_num );
+
+        used_size += sizeof( int16_t ) * 64 * hor_block_num * ver_block_num;
+        MAMEJPEG_CHECK( used_size <= coefficient_buffer_size );
+        dst->component[i].hor_block_num = hor_block_num;
+        dst->component[i].ver_block_num = ver_block_num;
+        dst->component[i].blocks = blocks;
+        blocks += (size_t)64 * hor_block_num * ver_block_num;
+
+        for( uint8_t v = 0; v < 8; v++ )
+        {
+            for( uint8_t u = 0; u < 8; u++ )
+            {
+                uint8_t src_index = is_transposed ? ( 8 * u + v ) : ( 8 * v + u );
+                dst->component[i].quant_table[ 8 * v + u ] = src->component[i].quant_table[ src_index ];
+            }
+        }
+
+        for( uint16_t block_y = 0; block_y < ver_block_num; block_y++ )
+        {
+            for( uint16_t block_x = 0; block_x < hor_block_num; block_x++ )
+            {
+                size_t x = is_flipped_x ? ( hor_block_num - 1 - block_x ) : block_x;
+                size_t y = is_flipped_y ? ( ver_block_num - 1 - block_y ) : block_y;
+                size_t src_block_index = is_transposed ? ( x * src->component[i].hor_block_num + y ) : ( y * src->component[i].hor_block_num + x );
+                const int16_t* src_block = src->component[i].blocks + 64 * src_block_index;
+                int16_t* dst_block = dst->component[i].blocks + 64 * ( (size_t)block_y * hor_block_num + block_x );
+
+                /* a mirrored axis negates its odd frequencies */
+                for( uint8_t v = 0; v < 8; v++ )
+                {
+                    for( uint8_t u = 0; u < 8; u++ )
+                    {
+                        uint8_t src_index = is_transposed ? ( 8 * u + v ) : ( 8 * v + u );
+                        bool is_negated = ( is_flipped_x && ( u & 1 ) ) != ( is_flipped_y && ( v & 1 ) );
+                        dst_block[ 8 * v + u ] = is_negated ? -src_block[ src_index ] : src_block[ src_index ];
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+static
+bool mameJpeg_requantizeToScaledTables( mameJpeg_coefficients* coefficients, const uint8_t* luma_table, const uint8_t* chroma_table, uint8_t quality )
+{
+    MAMEJPEG_NULL_CHECK( coefficients );
+    MAMEJPEG_NULL_CHECK( luma_table );
+    MAMEJPEG_CHECK( 1 <= quality && quality <= 100 );
+    MAMEJPEG_CHECK( coefficients->component_num == 1 || coefficients->component_num == 3 );
+    MAMEJPEG_CHECK( coefficients->component_num == 1 || chroma_table != NULL );
+
+    for( uint8_t i = 0; i < coefficients->component_num; i++ )
+    {
+        MAMEJPEG_NULL_CHECK( coefficients->component[i].blocks );
+
+        /* a step finer than the source would only spend bits on the old rounding error */
+        uint8_t* quant_table = coefficients->component[i].quant_table;
+        const uint8_t* target_table = ( i == 0 ) ? luma_table : chroma_table;
+        int src_steps[64];
+        for( uint8_t j = 0; j < 64; j++ )
+        {
+            MAMEJPEG_CHECK( 0 < quant_table[j] );
+            src_steps[j] = quant_table[j];
+            quant_table[j] = MAMEJPEG_MAX( quant_table[j], mameJpeg_scaleQuantValue( target_table[j], quality ) );
+        }
+
+        size_t block_num = (size_t)coefficients->component[i].hor_block_num * coefficients->component[i].ver_block_num;
+        int16_t* coeff = coefficients->component[i].blocks;
+        for( size_t j = 0; j < block_num; j++ )
+        {
+            for( uint8_t k = 0; k < 64; k++ )
+            {
+                /* one rounding from the dequantized value, half away from zero */
+                int dst_step = quant_table[k];
+                int value = coeff[k] * src_steps[k];
+                int magnitude = ( abs( value ) + dst_step / 2 ) / dst_step;
+                int limit = ( k == 0 ) ? 2047 : 1023;
+                magnitude = MAMEJPEG_MIN( magnitude, limit );
+                coeff[k] = (int16_t)( ( value < 0 ) ? -magnitude : magnitude );
+            }
+            coeff += 64;
+        }
+    }
+
+    return true;
+}
+
+bool mameJpeg_requantizeCoefficients( mameJpeg_coefficients* coefficients, uint8_t quality )
+{
+    return mameJpeg_requantizeToScaledTables( coefficients, MAMEJPEG_STANDARD_QUANT_TABLE[0], MAMEJPEG_STANDARD_QUANT_TABLE[1], quality );
+}
+
+bool mameJpeg_requantizeCoefficientsToTables( mameJpeg_coefficients* coefficients, const uint8_t* luma_table, const uint8_t* chroma_table )
+{
+    /* quality 50 keeps the tables unscaled, like mameJpeg_setQuantTables */
+    return mameJpeg_requantizeToScaledTables( coefficients, luma_table, chroma_table, 50 );
+}
+
+bool mameJpeg_getOptimizeBufferSize( size_t width, size_t height, mameJpeg_format format, size_t* optimize_buffer_size )
 {
-    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( optimize_buffer_size );
 
-    MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, MAMEJPEG_MARKER_SOI ) );
+    size_t block_num = mameJpeg_getImageBlockNum( width, height, format );
 
+    /* added to the encode buffer size: coefficient cache, nonzero masks and tables */
+    *optimize_buffer_size = ( sizeof( int16_t ) * 64 + sizeof( uint64_t ) ) * block_num + mameJpeg_getOptimizeTableSize();
     return true;
 }
 
-static
-bool mameJpeg_encodeDQTSegment( mameJpeg_context* context )
+bool mameJpeg_setQuantTables( mameJpeg_context* context, const uint8_t* luma_table, const uint8_t* chroma_table )
 {
     MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_ENCODE );
+    MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_HEADER );
 
-    uint8_t max_luma_chroma = ( context->info.component_num == 1 ) ? 1 : 2;
-    for( uint8_t luma_chroma = 0; luma_chroma < max_luma_chroma; luma_chroma++ )
-    {
-        context->info.quant_table[luma_chroma] = (uint8_t*)MAMEJPEG_DEFAULT_QUANT_TABLE[luma_chroma];
-    }
-
-    MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, MAMEJPEG_MARKER_DQT ) );
-
-    uint8_t quant_table_num = 0;
-    for( int i = 0; i < 4; i++ )
-    {
-        quant_table_num += ( context->info.quant_table[i] != NULL ) ? 1 : 0;
-    }
+    /* natural order tables used as they are */
+    MAMEJPEG_CHECK( mameJpeg_setScaledQuantTables( context, luma_table, chroma_table, 50 ) );
+    context->rate_control.quality = 0;
 
-    uint16_t dqt_size = quant_table_num * 65 + 2;
-    MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, dqt_size ) );
+    return true;
+}
 
-    for( uint8_t i = 0; i < quant_table_num; i++ )
-    {
-        MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, i ) );
-        for( uint8_t j = 0; j < 64; j++ )
-        {
-            MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, context->info.quant_table[i][j] ) );
-        }
-    }
+bool mameJpeg_getTargetSizeBufferSize( size_t width, size_t height, mameJpeg_format format, size_t* target_size_buffer_size )
+{
+    MAMEJPEG_NULL_CHECK( target_size_buffer_size );
 
+    /* added to the encode buffer size: forward DCT output of every block */
+    *target_size_buffer_size = sizeof( float ) * 64 * mameJpeg_getImageBlockNum( width, height, format );
     return true;
 }
 
-static
-bool mameJpeg_encodeSOF0Segment( mameJpeg_context* context )
+bool mameJpeg_setTargetSize( mameJpeg_context* context, size_t target_bytes )
 {
     MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_ENCODE );
+    MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_HEADER );
 
-    MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, MAMEJPEG_MARKER_SOF0 ) );
+    /* 0 turns the quality search off */
+    context->rate_control.target_bytes = target_bytes;
 
-    uint16_t sfo0_size = 6 + context->info.component_num * 3 + 2;
-    MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, sfo0_size ) );
+    return true;
+}
 
-    MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, context->info.accuracy ) );
-    MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, context->info.height ) );
-    MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, context->info.width ) );
-    MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, context->info.component_num ) );
+bool mameJpeg_getSelectedQuality( mameJpeg_context* context, uint8_t* quality )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( quality );
+    MAMEJPEG_CHECK( 0 < context->rate_control.quality );
 
-    for( uint8_t i = 0; i < context->info.component_num; i++ )
-    {
-        uint8_t component_index = i + 1;
-        MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, component_index ) );
-        uint8_t sampling = ( context->info.component[i].hor_sampling << 4 ) | context->info.component[i].ver_sampling;
-        MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, sampling ) );
-        MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, context->info.component[i].quant_table_index ) );
-    }
+    *quality = context->rate_control.quality;
 
     return true;
 }
 
-static
-bool mameJpeg_encodeDHTSegment( mameJpeg_context* context )
+bool mameJpeg_setOptimizeHuffman( mameJpeg_context* context, bool is_enabled )
 {
     MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_ENCODE );
+    MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_HEADER );
 
-    uint8_t max_luma_chroma = ( context->info.component_num == 1 ) ? 1 : 2;
-    for( uint8_t luma_chroma = 0; luma_chroma < max_luma_chroma; luma_chroma++ )
-    {
-        for( uint8_t ac_dc = 0; ac_dc < 2; ac_dc++ )
-        {
-            MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, MAMEJPEG_MARKER_DHT ) );
-
-            int code_num = 0;
-            for( int i = 0; i < 16; i++ )
-            {
-                code_num += MAMEJPEG_DEFAULT_HUFFMAN_CODE_BITS[ac_dc][luma_chroma][i];
-            }
-            uint16_t dht_size = code_num + 16 + 1 + 2;
-            MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, dht_size ) );
+    context->huff_optimize.is_enabled = is_enabled;
 
-            uint8_t huff_type = ( ac_dc << 4 ) | luma_chroma;
-            MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, huff_type ) );
+    return true;
+}
 
-            size_t huffman_table_buffer_size = sizeof( huffman_element ) * code_num;
-            void** huffman_code_table_ptr = (void**)&context->info.huff_table[ac_dc][luma_chroma].elements;
-            MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, huffman_table_buffer_size, huffman_code_table_ptr ) );
+bool mameJpeg_setOutputBlockCallback( mameJpeg_context* context, mameJpeg_stream_write_block_callback_ptr output_block_callback )
+{
+    MAMEJPEG_NULL_CHECK( context );
 
-            uint16_t code = 0;
-            uint16_t total_codes = 0;
-            for( int i = 0; i < 16; i++ )
-            {
-                uint16_t num_of_codes = MAMEJPEG_DEFAULT_HUFFMAN_CODE_BITS[ac_dc][luma_chroma][i];
-                MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, num_of_codes  ) );
+    /* called with the output callback param, NULL falls back to the byte callback */
+    context->output_stream->write_block = output_block_callback;
 
-                context->info.huff_table[ac_dc][luma_chroma].offsets[i] = total_codes;
-                for( int j = 0; j < num_of_codes; j++ )
-                {
-                    uint16_t element_index = total_codes + j;
-                    uint16_t value = MAMEJPEG_DEFAULT_HUFFMAN_CODE_VALUE[ac_dc][luma_chroma][element_index];
-                    context->info.huff_table[ac_dc][luma_chroma].elements[ element_index ].code = code;
-                    context->info.huff_table[ac_dc][luma_chroma].elements[ element_index ].value = value;
-                    code++;
-                }
+    return true;
+}
 
-                code <<= 1;
-                total_codes += num_of_codes;
-            }
-            context->info.huff_table[ac_dc][luma_chroma].offsets[16] = total_codes;
+static
+bool mameJpeg_output_to_push_sink( void* param, uint8_t byte )
+{
+    MAMEJPEG_NULL_CHECK( param );
 
-            for( int i = 0; i < total_codes; i++ )
-            {
-                MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, MAMEJPEG_DEFAULT_HUFFMAN_CODE_VALUE[ac_dc][luma_chroma][i] ) );
-            }
+    mameJpeg_push_sink* sink = (mameJpeg_push_sink*)param;
+    MAMEJPEG_CHECK( sink->length < sink->capacity );
 
-        }
+    sink->buffer[ sink->length ] = byte;
+    sink->length++;
 
-        context->info.quant_table[luma_chroma] = (uint8_t*)MAMEJPEG_DEFAULT_QUANT_TABLE[luma_chroma];
-    }
     return true;
 }
 
 static
-bool mameJpeg_encodeSOSSegment( mameJpeg_context* context )
+bool mameJpeg_output_block_to_push_sink( void* param, const uint8_t* data, size_t size )
 {
-    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_NULL_CHECK( param );
 
-    MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, MAMEJPEG_MARKER_SOS ) );
+    mameJpeg_push_sink* sink = (mameJpeg_push_sink*)param;
+    MAMEJPEG_CHECK( size <= sink->capacity - sink->length );
 
-    uint16_t sos_size = 4 + context->info.component_num * 2 + 2;
-    MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, sos_size ) );
+    memcpy( sink->buffer + sink->length, data, size );
+    sink->length += size;
 
-    MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, context->info.component_num ) );
-    for( uint8_t i = 0; i < context->info.component_num; i++ )
-    {
-        uint8_t component_index = i + 1;
-        MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, component_index ) );
+    return true;
+}
 
-        uint8_t table_index = ( context->info.component[i].huff_table_index[1] << 4 ) | context->info.component[i].huff_table_index[0];
-        MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, table_index ) );
-    }
+bool mameJpeg_getPushEncodeBufferSize( size_t width, size_t height, mameJpeg_format format, size_t* push_encode_buffer_size )
+{
+    MAMEJPEG_NULL_CHECK( push_encode_buffer_size );
+    /* the sink holds one MCU or the header, neither grows with the image */
+    (void)width;
+    (void)height;
+
+    /* added to the encode buffer size: the sink holding the unit that did not fit the caller chunk */
+    uint8_t mcu_block_num = mameJpeg_getMCUBlockNum( mameJpeg_getComponentNum( format ),
+            mameJpeg_getLumaHorSampling( format ),
+            mameJpeg_getLumaVerSampling( format ) );
+    *push_encode_buffer_size = mameJpeg_getPushSinkSize( mcu_block_num );
+    return true;
+}
 
-    MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, 0 ) );
-    MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, 63 ) );
-    MAMEJPEG_CHECK( mameJpeg_stream_writeByte( context->output_stream, 0 ) );
+bool mameJpeg_initializePushEncode( mameJpeg_context* context,
+        mameJpeg_stream_read_callback_ptr input_callback,
+        void* input_callback_param,
+        size_t width,
+        size_t height,
+        mameJpeg_format format,
+        uint8_t quality,
+        uint8_t* work_buffer,
+        size_t work_buffer_size )
+{
+    MAMEJPEG_NULL_CHECK( context );
+
+    MAMEJPEG_CHECK( mameJpeg_initializeEncode( context,
+                input_callback,
+                input_callback_param,
+                mameJpeg_output_to_push_sink,
+                &context->push_sink,
+                width,
+                height,
+                format,
+                quality,
+                work_buffer,
+                work_buffer_size ) );
+
+    uint8_t mcu_block_num = mameJpeg_getMCUBlockNum( context->info.component_num,
+            context->info.component[0].hor_sampling,
+            context->info.component[0].ver_sampling );
+    context->push_sink.capacity = mameJpeg_getPushSinkSize( mcu_block_num );
+    context->output_stream->write_block = mameJpeg_output_block_to_push_sink;
+    MAMEJPEG_CHECK( mameJpeg_assignBuffer( context, context->push_sink.capacity, (void**)&context->push_sink.buffer ) );
 
-    MAMEJPEG_CHECK( mameJpeg_encodeImage( context ) );
     return true;
 }
 
 static
-bool mameJpeg_encodeEOISegment( mameJpeg_context* context )
+bool mameJpeg_encodeNextUnit( mameJpeg_context* context )
 {
     MAMEJPEG_NULL_CHECK( context );
 
-    MAMEJPEG_CHECK( mameJpeg_stream_writeTwoBytes( context->output_stream, MAMEJPEG_MARKER_EOI ) );
+    /* each unit is small enough to fit into the push sink as a whole */
+    switch( context->cursor.phase )
+    {
+    case MAMEJPEG_PHASE_HEADER:
+        MAMEJPEG_CHECK( !context->huff_optimize.is_enabled );
+        MAMEJPEG_CHECK( context->rate_control.target_bytes == 0 );
+        MAMEJPEG_CHECK( mameJpeg_encodeHeader( context ) );
+        MAMEJPEG_CHECK( mameJpeg_startEncodeImage( context ) );
+        break;
+    case MAMEJPEG_PHASE_SCAN:
+        MAMEJPEG_CHECK( mameJpeg_encodeNextMCU( context ) );
+        if( context->cursor.mcu_row_num <= context->cursor.mcu_row_index )
+        {
+            MAMEJPEG_CHECK( mameJpeg_endEncodeImage( context ) );
+        }
+        break;
+    case MAMEJPEG_PHASE_TRAILER:
+        MAMEJPEG_CHECK( mameJpeg_encodeEOISegment( context ) );
+        context->cursor.phase = MAMEJPEG_PHASE_DONE;
+        break;
+    default:
+        return false;
+    }
+    MAMEJPEG_CHECK( mameJpeg_stream_flushBuffer( context->output_stream ) );
 
     return true;
 }
 
-bool mameJpeg_getEncodeBufferSize( size_t width, size_t height, mameJpeg_format format, size_t* encode_buffer_size )
+mameJpeg_status mameJpeg_encodePush( mameJpeg_context* context, uint8_t* dst, size_t dst_size, size_t* written_ptr )
 {
-    MAMEJPEG_NULL_CHECK( encode_buffer_size );
+    if( context == NULL || written_ptr == NULL || context->push_sink.buffer == NULL )
+    {
+        return MAMEJPEG_STATUS_ERROR;
+    }
+    if( dst == NULL && 0 < dst_size )
+    {
+        return MAMEJPEG_STATUS_ERROR;
+    }
 
-    uint8_t component_num = mameJpeg_getComponentNum( format );
-    uint8_t luma_hor_sampling = mameJpeg_getLumaHorSampling( format );
-    uint8_t luma_ver_sampling = mameJpeg_getLumaVerSampling( format );
+    mameJpeg_push_sink* sink = &context->push_sink;
+    size_t written = 0;
+    *written_ptr = 0;
+    while( true )
+    {
+        size_t copy_bytes = sink->length - sink->pos;
+        copy_bytes = ( copy_bytes < dst_size - written ) ? copy_bytes : dst_size - written;
+        if( 0 < copy_bytes )
+        {
+            memcpy( dst + written, sink->buffer + sink->pos, copy_bytes );
+            sink->pos += copy_bytes;
+            written += copy_bytes;
+            *written_ptr = written;
+        }
 
-    size_t dct_buffer_size = 64 * sizeof( double );
-    size_t mcu_buffer_size = mameJpeg_getMCUBufferSize( width,
-            component_num,
-            luma_hor_sampling,
-            luma_ver_sampling );
-    size_t line_buffer_size = mameJpeg_getLineBufferSize( width,
-            component_num,
-            luma_ver_sampling );
+        if( sink->pos < sink->length )
+        {
+            return MAMEJPEG_STATUS_OUTPUT_FULL;
+        }
+        sink->pos = 0;
+        sink->length = 0;
 
-    uint16_t huffman_code_num = 0;
-    uint8_t max_luma_chroma = ( component_num == 1 ) ? 1 : 2;
-    for( uint8_t luma_chroma = 0; luma_chroma < max_luma_chroma; ++luma_chroma )
-    {
-        for( uint8_t ac_dc = 0; ac_dc < 2; ++ac_dc )
+        if( context->cursor.phase == MAMEJPEG_PHASE_DONE )
         {
-            for( int i = 0; i < 16; i++ )
-            {
-                huffman_code_num += MAMEJPEG_DEFAULT_HUFFMAN_CODE_BITS[ac_dc][luma_chroma][i];
-            }
+            return MAMEJPEG_STATUS_OK;
+        }
+        if( !mameJpeg_encodeNextUnit( context ) )
+        {
+            return MAMEJPEG_STATUS_ERROR;
         }
     }
-    size_t huffman_table_size = sizeof( huffman_element ) * huffman_code_num;
-
-    *encode_buffer_size = dct_buffer_size + mcu_buffer_size + line_buffer_size + huffman_table_size + 1;
-    return true;
 }
 
-bool mameJpeg_initializeEncode( mameJpeg_context* context,
-        mameJpeg_stream_read_callback_ptr input_callback,
-        void* input_callback_param,
+bool mameJpeg_initializeRowEncode( mameJpeg_context* context,
         mameJpeg_stream_write_callback_ptr output_callback,
         void* output_callback_param,
         size_t width,
         size_t height,
         mameJpeg_format format,
+        uint8_t quality,
         uint8_t* work_buffer,
-        size_t work_buffer_size
-        )
+        size_t work_buffer_size )
 {
     MAMEJPEG_NULL_CHECK( context );
-    MAMEJPEG_NULL_CHECK( input_callback );
-    MAMEJPEG_NULL_CHECK( input_callback_param );
-    MAMEJPEG_NULL_CHECK( output_callback );
-    MAMEJPEG_NULL_CHECK( output_callback_param );
-    MAMEJPEG_NULL_CHECK( work_buffer );
-    MAMEJPEG_CHECK( 0 < width );
-    MAMEJPEG_CHECK( 0 < height );
-    MAMEJPEG_CHECK( 0 < work_buffer_size );
 
-    memset( context, 0x00, sizeof( mameJpeg_context ));
-    mameJpeg_stream_input_initialize( context->input_stream, input_callback, input_callback_param );
-    mameJpeg_stream_output_initialize( context->output_stream, output_callback, output_callback_param );
-    context->mode = MAMEJPEG_MODE_ENCODE;
+    MAMEJPEG_CHECK( mameJpeg_setupEncode( context,
+                output_callback,
+                output_callback_param,
+                width,
+                height,
+                format,
+                quality,
+                work_buffer,
+                work_buffer_size ) );
 
-    context->work_buffer_beg = work_buffer;
-    context->work_buffer_ptr = work_buffer;
-    context->work_buffer_end = work_buffer + work_buffer_size;
+    return true;
+}
 
-    context->info.accuracy = 8;
-    context->info.width = width;
-    context->info.height = height;
-    context->info.component_num = mameJpeg_getComponentNum( format );
-    for( int i = 0; i < context->info.component_num; i++ )
+bool mameJpeg_encodeRows( mameJpeg_context* context, const uint8_t* rows, size_t stride, size_t count )
+{
+    MAMEJPEG_NULL_CHECK( context );
+    MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_ENCODE );
+    MAMEJPEG_CHECK( !context->source.is_surface );
+    MAMEJPEG_CHECK( !context->source.is_output_only );
+    MAMEJPEG_CHECK( !context->huff_optimize.is_enabled );
+    MAMEJPEG_CHECK( context->rate_control.target_bytes == 0 );
+    MAMEJPEG_CHECK( rows != NULL || count == 0 );
+
+    if( context->cursor.phase == MAMEJPEG_PHASE_HEADER )
     {
-        context->info.component[i].hor_sampling = ( i == 0 ) ? mameJpeg_getLumaHorSampling( format ) : 1;
-        context->info.component[i].ver_sampling = ( i == 0 ) ? mameJpeg_getLumaVerSampling( format ) : 1;
-        context->info.component[i].quant_table_index = ( i == 0 ) ? 0 : 1;
-        context->info.component[i].huff_table_index[0] = ( i == 0 ) ? 0 : 1;
-        context->info.component[i].huff_table_index[1] = ( i == 0 ) ? 0 : 1;
-        context->info.component[i].prev_dc_value = 0;
+        MAMEJPEG_CHECK( mameJpeg_encodeHeader( context ) );
+        MAMEJPEG_CHECK( mameJpeg_startEncodeImage( context ) );
+        context->cursor.buffered_rows = 0;
+    }
+
+    size_t row_bytes = (size_t)context->info.component_num * context->info.width;
+    MAMEJPEG_CHECK( row_bytes <= stride || count <= 1 );
+
+    for( size_t i = 0; i < count; i++ )
+    {
+        MAMEJPEG_CHECK( context->cursor.phase == MAMEJPEG_PHASE_SCAN );
+
+        uint16_t ver_mcu_index = context->cursor.mcu_row_index;
+        uint8_t* dst = context->line_buffer + row_bytes * context->cursor.buffered_rows;
+        memcpy( dst, rows + stride * i, row_bytes );
+        context->cursor.buffered_rows++;
+
+        /* compress the MCU row as soon as its last row has arrived */
+        uint16_t mcu_row_height = mameJpeg_getMCURowHeight( context, ver_mcu_index );
+        if( context->cursor.buffered_rows < mcu_row_height )
+        {
+            continue;
+        }
+
+        MAMEJPEG_CHECK( mameJpeg_padLineBuffer( context, mcu_row_height ) );
+        context->source.first_row = (size_t)8 * context->info.component[0].ver_sampling * ver_mcu_index;
+        while( context->cursor.mcu_row_index == ver_mcu_index )
+        {
+            MAMEJPEG_CHECK( mameJpeg_encodeBufferedMCU( context ) );
+        }
+        context->cursor.buffered_rows = 0;
+
+        if( context->cursor.mcu_row_num <= context->cursor.mcu_row_index )
+        {
+            MAMEJPEG_CHECK( mameJpeg_endEncodeImage( context ) );
+            MAMEJPEG_CHECK( mameJpeg_encodeEOISegment( context ) );
+            context->cursor.phase = MAMEJPEG_PHASE_DONE;
+        }
+        MAMEJPEG_CHECK( mameJpeg_stream_flushBuffer( context->output_stream ) );
     }
 
     return true;
 }
 
-bool mameJpeg_encode( mameJpeg_context* context )
+bool mameJpeg_initializeSurfaceEncode( mameJpeg_context* context,
+        const uint8_t* pixels,
+        size_t stride,
+        mameJpeg_stream_write_callback_ptr output_callback,
+        void* output_callback_param,
+        size_t width,
+        size_t height,
+        mameJpeg_format format,
+        uint8_t quality,
+        uint8_t* work_buffer,
+        size_t work_buffer_size )
 {
     MAMEJPEG_NULL_CHECK( context );
-    MAMEJPEG_CHECK( context->mode == MAMEJPEG_MODE_ENCODE );
+    MAMEJPEG_NULL_CHECK( pixels );
+
+    MAMEJPEG_CHECK( mameJpeg_setupEncode( context,
+                output_callback,
+                output_callback_param,
+                width,
+                height,
+                format,
+                quality,
+                work_buffer,
+                work_buffer_size ) );
+    MAMEJPEG_CHECK( (size_t)context->info.component_num * width <= stride );
+
+    context->source.pixels = pixels;
+    context->source.stride = stride;
+    context->source.first_row = 0;
+    context->source.is_surface = true;
 
-    MAMEJPEG_CHECK( mameJpeg_encodeSOISegment( context ) );
-    MAMEJPEG_CHECK( mameJpeg_encodeDQTSegment( context ) );
-    MAMEJPEG_CHECK( mameJpeg_encodeSOF0Segment( context ) );
-    MAMEJPEG_CHECK( mameJpeg_encodeDHTSegment( context ) );
-    MAMEJPEG_CHECK( mameJpeg_encodeSOSSegment( context ) );
-    MAMEJPEG_CHECK( mameJpeg_encodeEOISegment( context ) );
     return true;
 }
 
@@ -2054,6 +5618,17 @@ bool mameJpeg_input_from_memory_callback( void* param, uint8_t* byte )
     return true;
 }
 
+bool mameJpeg_input_skip_in_memory_callback( void* param, size_t size )
+{
+    MAMEJPEG_NULL_CHECK( param );
+
+    mameJpeg_memory_callback_param *callback_param = (mameJpeg_memory_callback_param*)param;
+    MAMEJPEG_CHECK( size <= callback_param->buffer_size - callback_param->buffer_pos );
+    callback_param->buffer_pos += size;
+
+    return true;
+}
+
 bool mameJpeg_output_to_memory_callback( void* param, uint8_t byte )
 {
     MAMEJPEG_NULL_CHECK( param );
@@ -2068,6 +5643,21 @@ bool mameJpeg_output_to_memory_callback( void* param, uint8_t byte )
     return true;
 }
 
+bool mameJpeg_output_block_to_memory_callback( void* param, const uint8_t* data, size_t size )
+{
+    MAMEJPEG_NULL_CHECK( param );
+    MAMEJPEG_NULL_CHECK( data );
+
+    mameJpeg_memory_callback_param *callback_param = (mameJpeg_memory_callback_param*)param;
+    MAMEJPEG_NULL_CHECK( callback_param->buffer_ptr );
+    MAMEJPEG_CHECK( size <= callback_param->buffer_size - callback_param->buffer_pos );
+
+    memcpy( (uint8_t*)callback_param->buffer_ptr + callback_param->buffer_pos, data, size );
+    callback_param->buffer_pos += size;
+
+    return true;
+}
+
 bool mameJpeg_input_from_file_callback( void* param, uint8_t* byte )
 {
     MAMEJPEG_NULL_CHECK( param );
@@ -2079,6 +5669,14 @@ bool mameJpeg_input_from_file_callback( void* param, uint8_t* byte )
     return ( n == 1 );
 }
 
+bool mameJpeg_input_skip_in_file_callback( void* param, size_t size )
+{
+    MAMEJPEG_NULL_CHECK( param );
+
+    FILE* fp = (FILE*)param;
+    return ( fseek( fp, (long)size, SEEK_CUR ) == 0 );
+}
+
 bool mameJpeg_output_to_file_callback( void* param, uint8_t byte )
 {
     MAMEJPEG_NULL_CHECK( param );
@@ -2089,6 +5687,17 @@ bool mameJpeg_output_to_file_callback( void* param, uint8_t byte )
     return ( n == 1 );
 }
 
+bool mameJpeg_output_block_to_file_callback( void* param, const uint8_t* data, size_t size )
+{
+    MAMEJPEG_NULL_CHECK( param );
+    MAMEJPEG_NULL_CHECK( data );
+
+    FILE* fp = (FILE*)param;
+    size_t n = fwrite( data, 1, size, fp );
+
+    return ( n == size );
+}
+
 # ifdef __cplusplus
 }
 # endif /* __cplusplus */
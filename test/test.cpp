@@ -1,4 +1,8 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <cstdlib>
+#include <vector>
 
 #define CATCH_CONFIG_MAIN
 #include "catch.hpp"
@@ -311,11 +315,37 @@ TEST_CASE("Bitsteram write test", "[sample]")
     CHECK( mameJpeg_stream_writeBits(bitstream, &data8, 8 ) );
     data16 = 0xaabb;
     CHECK( mameJpeg_stream_writeBits(bitstream, &data16, 16 ) );
+    CHECK( mameJpeg_stream_flushBits( bitstream ) );
     
     int res = memcmp( buffer, "\xfa\xab\x32\xb3\xf8\xc3\xaa\xaa\xbb", sizeof( buffer ) / sizeof( uint8_t ) );
     CHECK( res == 0 );
 }
 
+TEST_CASE("Bitsteram write stuffing test", "[sample]")
+{
+    uint8_t buffer[16];
+    uint8_t out_buffer[16];
+    mameJpeg_stream_context bitstream[1];
+    mameJpeg_memory_callback_param param = { buffer, 0, sizeof( buffer ) / sizeof( uint8_t ) };
+    mameJpeg_stream_output_initialize( bitstream, mameJpeg_output_to_memory_callback, &param  );
+    bitstream->out_buffer = out_buffer;
+    bitstream->out_capacity = sizeof( out_buffer );
+    bitstream->write_block = mameJpeg_output_block_to_memory_callback;
+
+    CHECK( mameJpeg_stream_writeCode( bitstream, 0x12345678, 32 ) );
+    CHECK( mameJpeg_stream_writeCode( bitstream, 0x3f, 6 ) );
+    CHECK( mameJpeg_stream_writeCode( bitstream, 0xffc0, 16 ) );
+    CHECK( mameJpeg_stream_writeCode( bitstream, 0x5, 3 ) );
+    CHECK( mameJpeg_stream_flushBits( bitstream ) );
+    CHECK( param.buffer_pos == 0 );
+    CHECK( mameJpeg_stream_flushBuffer( bitstream ) );
+
+    /* 0xff bytes produced by the accumulator are followed by a stuffed 0x00 */
+    CHECK( param.buffer_pos == 10 );
+    int res = memcmp( buffer, "\x12\x34\x56\x78\xff\x00\xff\x00\x02\x80", 10 );
+    CHECK( res == 0 );
+}
+
 TEST_CASE("Get image info", "[getImageInfo]")
 {
     uint16_t width;
@@ -467,6 +497,7 @@ TEST_CASE("Encode jpeg", "[sample]")
                     width,
                     height,
                     format,
+                    100,
                     work_buffer,
                     work_buffer_size);
 
@@ -532,3 +563,2314 @@ TEST_CASE("Encode jpeg", "[sample]")
         }
     }
 }
+
+TEST_CASE("Forward and inverse DCT", "[dct]")
+{
+    const double pi = 3.14159265358979323846;
+    double block[64];
+    double energy = 0.0;
+    double sum = 0.0;
+    for( int i = 0; i < 64; i++ )
+    {
+        block[i] = ( ( i * 37 ) % 255 ) - 128.0;
+        energy += block[i] * block[i];
+        sum += block[i];
+    }
+
+    /* orthonormal: the DC term is sum / 8 and the energy is preserved */
+    double work[64];
+    memcpy( work, block, sizeof( work ) );
+    REQUIRE( mameJpeg_applyDCT( work, true ) );
+    double coeff_energy = 0.0;
+    for( int i = 0; i < 64; i++ )
+    {
+        coeff_energy += work[i] * work[i];
+    }
+    CHECK( fabs( work[0] - sum / 8.0 ) < 1e-9 );
+    CHECK( fabs( coeff_energy - energy ) < 1e-6 );
+
+    REQUIRE( mameJpeg_applyDCT( work, false ) );
+    for( int i = 0; i < 64; i++ )
+    {
+        CHECK( fabs( work[i] - block[i] ) < 1e-9 );
+    }
+
+    /* every horizontal cosine lands on its own coefficient */
+    for( int u = 0; u < 8; u++ )
+    {
+        for( int i = 0; i < 64; i++ )
+        {
+            work[i] = cos( ( 2 * ( i % 8 ) + 1 ) * u * pi / 16 );
+        }
+        REQUIRE( mameJpeg_applyDCT( work, true ) );
+        for( int i = 0; i < 64; i++ )
+        {
+            CHECK( fabs( work[i] ) < ( ( i == u ) ? 100.0 : 1e-9 ) );
+        }
+        CHECK( 1.0 < fabs( work[u] ) );
+    }
+}
+
+TEST_CASE("Encode and decode wide jpeg", "[largeImage]")
+{
+    /* wider than the old uint16_t MCU row byte count allowed for RGB 4:2:0 */
+    const uint16_t width = 2000;
+    const uint16_t height = 24;
+    const mameJpeg_format format = MAMEJPEG_FORMAT_YCBCR_420;
+    const uint8_t components = mameJpeg_getComponentNum( format );
+
+    std::vector< uint8_t > image( components * width * height );
+    for( size_t y = 0; y < height; y++ )
+    {
+        for( size_t x = 0; x < width; x++ )
+        {
+            uint8_t* pixel = &image[ components * ( y * width + x ) ];
+            pixel[0] = (uint8_t)( x / 8 );
+            pixel[1] = (uint8_t)( 255 - x / 8 );
+            pixel[2] = (uint8_t)( y * 8 );
+        }
+    }
+
+    std::vector< uint8_t > encoded( 1024 * 1024 );
+    {
+        mameJpeg_memory_callback_param input_param = { image.data(), 0, image.size() };
+        mameJpeg_memory_callback_param output_param = { encoded.data(), 0, encoded.size() };
+
+        size_t work_buffer_size;
+        REQUIRE( mameJpeg_getEncodeBufferSize( width, height, format, &work_buffer_size ) );
+        std::vector< uint8_t > work_buffer( work_buffer_size );
+
+        mameJpeg_context context[1];
+        REQUIRE( mameJpeg_initializeEncode( context,
+                    mameJpeg_input_from_memory_callback,
+                    &input_param,
+                    mameJpeg_output_to_memory_callback,
+                    &output_param,
+                    width,
+                    height,
+                    format,
+                    100,
+                    work_buffer.data(),
+                    work_buffer.size() ) );
+        REQUIRE( mameJpeg_encode( context ) );
+        CHECK( input_param.buffer_pos == image.size() );
+        encoded.resize( output_param.buffer_pos );
+    }
+
+    std::vector< uint8_t > decoded( image.size() );
+    {
+        uint16_t decoded_width;
+        uint16_t decoded_height;
+        uint8_t decoded_components;
+        size_t work_buffer_size;
+        mameJpeg_memory_callback_param info_input_param = { encoded.data(), 0, encoded.size() };
+        REQUIRE( mameJpeg_getDecodeBufferSize( mameJpeg_input_from_memory_callback,
+                    &info_input_param,
+                    &decoded_width,
+                    &decoded_height,
+                    &decoded_components,
+                    &work_buffer_size ) );
+        CHECK( decoded_width == width );
+        CHECK( decoded_height == height );
+        CHECK( decoded_components == components );
+        std::vector< uint8_t > work_buffer( work_buffer_size );
+
+        mameJpeg_memory_callback_param input_param = { encoded.data(), 0, encoded.size() };
+        mameJpeg_memory_callback_param output_param = { decoded.data(), 0, decoded.size() };
+        mameJpeg_context context[1];
+        REQUIRE( mameJpeg_initializeDecode( context,
+                    mameJpeg_input_from_memory_callback,
+                    &input_param,
+                    mameJpeg_output_to_memory_callback,
+                    &output_param,
+                    work_buffer.data(),
+                    work_buffer.size() ) );
+        REQUIRE( mameJpeg_decode( context ) );
+        CHECK( output_param.buffer_pos == decoded.size() );
+    }
+
+    double diff_sum = 0.0;
+    for( size_t i = 0; i < image.size(); i++ )
+    {
+        diff_sum += abs( (int)image[i] - (int)decoded[i] );
+    }
+    diff_sum /= image.size();
+    CHECK( diff_sum < 5.0 );
+}
+
+namespace {
+
+/* generates a 65535x65535 mid-gray baseline jpeg on the fly.
+ * every 8x8 block is coded as "DC diff 0" + "EOB" with the default luma
+ * tables ( 6 bits ), so four blocks are exactly the three bytes below. */
+struct synthetic_jpeg_source {
+    std::vector< uint8_t > header;
+    uint64_t scan_bytes;
+    uint64_t pos;
+};
+
+bool synthetic_jpeg_source_callback( void* param, uint8_t* byte )
+{
+    static const uint8_t four_blocks[3] = { 0x28, 0xa2, 0x8a };
+    static const uint8_t trailer[2] = { 0xff, 0xd9 };
+
+    synthetic_jpeg_source* source = (synthetic_jpeg_source*)param;
+    uint64_t pos = source->pos++;
+    if( pos < source->header.size() )
+    {
+        *byte = source->header[ pos ];
+        return true;
+    }
+    pos -= source->header.size();
+    if( pos < source->scan_bytes )
+    {
+        *byte = four_blocks[ pos % 3 ];
+        return true;
+    }
+    pos -= source->scan_bytes;
+    if( pos < 2 )
+    {
+        *byte = trailer[ pos ];
+        return true;
+    }
+    return false;
+}
+
+struct counting_sink {
+    uint64_t bytes;
+    uint64_t mismatches;
+};
+
+bool counting_sink_callback( void* param, uint8_t byte )
+{
+    counting_sink* sink = (counting_sink*)param;
+    sink->bytes++;
+    sink->mismatches += ( byte != 128 ) ? 1 : 0;
+    return true;
+}
+
+void make_synthetic_jpeg_source( synthetic_jpeg_source* source, uint16_t width, uint16_t height )
+{
+    const uint8_t head[] = {
+        0xff, 0xd8,
+        0xff, 0xdb, 0x00, 0x43, 0x00
+    };
+    source->header.assign( head, head + sizeof( head ) );
+    source->header.insert( source->header.end(), 64, 1 );
+
+    const uint8_t sof0[] = {
+        0xff, 0xc0, 0x00, 0x0b, 0x08,
+        (uint8_t)( height >> 8 ), (uint8_t)height, (uint8_t)( width >> 8 ), (uint8_t)width,
+        0x01, 0x01, 0x11, 0x00
+    };
+    source->header.insert( source->header.end(), sof0, sof0 + sizeof( sof0 ) );
+
+    for( int ac_dc = 0; ac_dc < 2; ac_dc++ )
+    {
+        int code_num = 0;
+        for( int i = 0; i < 16; i++ )
+        {
+            code_num += MAMEJPEG_DEFAULT_HUFFMAN_CODE_BITS[ac_dc][0][i];
+        }
+        uint16_t dht_size = code_num + 16 + 1 + 2;
+        const uint8_t dht[] = { 0xff, 0xc4, (uint8_t)( dht_size >> 8 ), (uint8_t)dht_size, (uint8_t)( ac_dc << 4 ) };
+        source->header.insert( source->header.end(), dht, dht + sizeof( dht ) );
+        source->header.insert( source->header.end(), MAMEJPEG_DEFAULT_HUFFMAN_CODE_BITS[ac_dc][0], MAMEJPEG_DEFAULT_HUFFMAN_CODE_BITS[ac_dc][0] + 16 );
+        source->header.insert( source->header.end(), MAMEJPEG_DEFAULT_HUFFMAN_CODE_VALUE[ac_dc][0], MAMEJPEG_DEFAULT_HUFFMAN_CODE_VALUE[ac_dc][0] + code_num );
+    }
+
+    const uint8_t sos[] = { 0xff, 0xda, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3f, 0x00 };
+    source->header.insert( source->header.end(), sos, sos + sizeof( sos ) );
+
+    uint64_t blocks = (uint64_t)( ( width + 7 ) / 8 ) * ( ( height + 7 ) / 8 );
+    source->scan_bytes = blocks / 4 * 3;
+    source->pos = 0;
+}
+
+}
+
+TEST_CASE("Stream a gigapixel jpeg in bounded memory", "[.][benchmark]")
+{
+    const uint16_t width = 65535;
+    const uint16_t height = 65535;
+
+    synthetic_jpeg_source info_source;
+    make_synthetic_jpeg_source( &info_source, width, height );
+    size_t work_buffer_size;
+    REQUIRE( mameJpeg_getDecodeBufferSize( synthetic_jpeg_source_callback, &info_source, NULL, NULL, NULL, &work_buffer_size ) );
+
+    /* only the MCU row strip has to live in memory */
+    CHECK( work_buffer_size < 4 * 1024 * 1024 );
+    std::vector< uint8_t > work_buffer( work_buffer_size );
+
+    synthetic_jpeg_source source;
+    make_synthetic_jpeg_source( &source, width, height );
+    counting_sink sink = { 0, 0 };
+
+    mameJpeg_context context[1];
+    REQUIRE( mameJpeg_initializeDecode( context,
+                synthetic_jpeg_source_callback,
+                &source,
+                counting_sink_callback,
+                &sink,
+                work_buffer.data(),
+                work_buffer.size() ) );
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    REQUIRE( mameJpeg_decode( context ) );
+    std::chrono::duration< double > elapsed = std::chrono::steady_clock::now() - begin;
+
+    CHECK( sink.bytes == (uint64_t)width * height );
+    CHECK( sink.mismatches == 0 );
+    WARN( "decoded " << sink.bytes << " pixels in " << elapsed.count() << " s ( "
+            << sink.bytes / elapsed.count() / 1e6 << " Mpixel/s )" );
+}
+
+TEST_CASE("Decode jpeg by scanlines", "[scanline]")
+{
+    uint8_t* data = jpeg_test_pattern_color_420;
+    size_t size = sizeof( jpeg_test_pattern_color_420 );
+
+    size_t work_buffer_size;
+    mameJpeg_memory_callback_param info_input_param = { data, 0, size };
+    REQUIRE( mameJpeg_getDecodeBufferSize( mameJpeg_input_from_memory_callback, &info_input_param, NULL, NULL, NULL, &work_buffer_size ) );
+
+    std::vector< uint8_t > expect;
+    {
+        std::vector< uint8_t > work_buffer( work_buffer_size );
+        expect.resize( 3 * 16 * 16 );
+        mameJpeg_memory_callback_param input_param = { data, 0, size };
+        mameJpeg_memory_callback_param output_param = { expect.data(), 0, expect.size() };
+        mameJpeg_context context[1];
+        REQUIRE( mameJpeg_initializeDecode( context,
+                    mameJpeg_input_from_memory_callback,
+                    &input_param,
+                    mameJpeg_output_to_memory_callback,
+                    &output_param,
+                    work_buffer.data(),
+                    work_buffer.size() ) );
+        REQUIRE( mameJpeg_decode( context ) );
+    }
+
+    SECTION( "whole image in small steps" )
+    {
+        std::vector< uint8_t > work_buffer( work_buffer_size );
+        mameJpeg_memory_callback_param input_param = { data, 0, size };
+        mameJpeg_context context[1];
+        REQUIRE( mameJpeg_initializeDecode( context,
+                    mameJpeg_input_from_memory_callback,
+                    &input_param,
+                    NULL,
+                    NULL,
+                    work_buffer.data(),
+                    work_buffer.size() ) );
+        REQUIRE( mameJpeg_readHeader( context ) );
+
+        uint16_t width;
+        uint16_t height;
+        uint8_t components;
+        REQUIRE( mameJpeg_getImageInfo( context, &width, &height, &components ) );
+        CHECK( width == 16 );
+        CHECK( height == 16 );
+        CHECK( components == 3 );
+
+        std::vector< uint8_t > decoded( components * width * height );
+        size_t total_rows = 0;
+        size_t read_rows = 0;
+        do
+        {
+            REQUIRE( mameJpeg_readScanlines( context, &decoded[ total_rows * components * width ], 3, &read_rows ) );
+            CHECK( read_rows <= 3 );
+            total_rows += read_rows;
+        } while( 0 < read_rows );
+        CHECK( total_rows == height );
+        REQUIRE( mameJpeg_finish( context ) );
+        CHECK( input_param.buffer_pos == size );
+        CHECK( decoded == expect );
+    }
+
+    SECTION( "stop after the top rows" )
+    {
+        std::vector< uint8_t > work_buffer( work_buffer_size );
+        mameJpeg_memory_callback_param input_param = { data, 0, size };
+        mameJpeg_context context[1];
+        REQUIRE( mameJpeg_initializeDecode( context,
+                    mameJpeg_input_from_memory_callback,
+                    &input_param,
+                    NULL,
+                    NULL,
+                    work_buffer.data(),
+                    work_buffer.size() ) );
+        REQUIRE( mameJpeg_readHeader( context ) );
+
+        std::vector< uint8_t > decoded( 3 * 16 * 5 );
+        size_t read_rows = 0;
+        REQUIRE( mameJpeg_readScanlines( context, decoded.data(), 5, &read_rows ) );
+        CHECK( read_rows == 5 );
+        REQUIRE( mameJpeg_finish( context ) );
+        CHECK( input_param.buffer_pos < size );
+        CHECK( std::equal( decoded.begin(), decoded.end(), expect.begin() ) );
+    }
+}
+
+TEST_CASE("Decode jpeg pushed in small chunks", "[push]")
+{
+    uint8_t* data = jpeg_test_pattern_color_420;
+    size_t size = sizeof( jpeg_test_pattern_color_420 );
+
+    size_t work_buffer_size;
+    mameJpeg_memory_callback_param info_input_param = { data, 0, size };
+    REQUIRE( mameJpeg_getDecodeBufferSize( mameJpeg_input_from_memory_callback, &info_input_param, NULL, NULL, NULL, &work_buffer_size ) );
+
+    std::vector< uint8_t > expect( 3 * 16 * 16 );
+    {
+        std::vector< uint8_t > work_buffer( work_buffer_size );
+        mameJpeg_memory_callback_param input_param = { data, 0, size };
+        mameJpeg_memory_callback_param output_param = { expect.data(), 0, expect.size() };
+        mameJpeg_context context[1];
+        REQUIRE( mameJpeg_initializeDecode( context,
+                    mameJpeg_input_from_memory_callback,
+                    &input_param,
+                    mameJpeg_output_to_memory_callback,
+                    &output_param,
+                    work_buffer.data(),
+                    work_buffer.size() ) );
+        REQUIRE( mameJpeg_decode( context ) );
+    }
+
+    const size_t chunk_sizes[] = { 1, 7, 64 };
+    for( size_t chunk_size : chunk_sizes )
+    {
+        std::vector< uint8_t > work_buffer( work_buffer_size );
+        std::vector< uint8_t > decoded( expect.size() );
+        mameJpeg_memory_callback_param output_param = { decoded.data(), 0, decoded.size() };
+        mameJpeg_context context[1];
+        REQUIRE( mameJpeg_initializePushDecode( context,
+                    mameJpeg_output_to_memory_callback,
+                    &output_param,
+                    work_buffer.data(),
+                    work_buffer.size() ) );
+
+        /* unconsumed bytes are kept and presented again with the next chunk */
+        std::vector< uint8_t > pending;
+        size_t arrived = 0;
+        mameJpeg_status status = MAMEJPEG_STATUS_NEED_MORE_DATA;
+        while( status == MAMEJPEG_STATUS_NEED_MORE_DATA )
+        {
+            REQUIRE( arrived < size );
+            size_t chunk = std::min( chunk_size, size - arrived );
+            pending.insert( pending.end(), data + arrived, data + arrived + chunk );
+            arrived += chunk;
+
+            size_t consumed = 0;
+            status = mameJpeg_decodePush( context, pending.data(), pending.size(), &consumed );
+            REQUIRE( consumed <= pending.size() );
+            pending.erase( pending.begin(), pending.begin() + consumed );
+        }
+        CHECK( status == MAMEJPEG_STATUS_OK );
+        CHECK( arrived == size );
+        CHECK( pending.empty() );
+        CHECK( output_param.buffer_pos == decoded.size() );
+        CHECK( decoded == expect );
+    }
+
+    SECTION( "corrupt data is reported as error" )
+    {
+        std::vector< uint8_t > work_buffer( work_buffer_size );
+        std::vector< uint8_t > decoded( expect.size() );
+        mameJpeg_memory_callback_param output_param = { decoded.data(), 0, decoded.size() };
+        mameJpeg_context context[1];
+        REQUIRE( mameJpeg_initializePushDecode( context,
+                    mameJpeg_output_to_memory_callback,
+                    &output_param,
+                    work_buffer.data(),
+                    work_buffer.size() ) );
+
+        /* DQT refers to quantization table 9 */
+        const uint8_t not_a_jpeg[] = { 0xff, 0xd8, 0xff, 0xdb, 0x00, 0x43, 0x09, 0x01, 0x01, 0x01 };
+        size_t consumed = 0;
+        CHECK( mameJpeg_decodePush( context, not_a_jpeg, sizeof( not_a_jpeg ), &consumed ) == MAMEJPEG_STATUS_ERROR );
+    }
+}
+
+TEST_CASE("Finish a pushed jpeg without EOI", "[push]")
+{
+    uint8_t* data = jpeg_test_pattern_color_420;
+    size_t size = sizeof( jpeg_test_pattern_color_420 );
+    REQUIRE( data[ size - 2 ] == 0xff );
+    REQUIRE( data[ size - 1 ] == 0xd9 );
+
+    size_t work_buffer_size;
+    mameJpeg_memory_callback_param info_input_param = { data, 0, size };
+    REQUIRE( mameJpeg_getDecodeBufferSize( mameJpeg_input_from_memory_callback, &info_input_param, NULL, NULL, NULL, &work_buffer_size ) );
+
+    std::vector< uint8_t > expect( 3 * 16 * 16 );
+    {
+        std::vector< uint8_t > work_buffer( work_buffer_size );
+        mameJpeg_memory_callback_param input_param = { data, 0, size - 2 };
+        mameJpeg_memory_callback_param output_param = { expect.data(), 0, expect.size() };
+        mameJpeg_context context[1];
+        REQUIRE( mameJpeg_initializeDecode( context,
+                    mameJpeg_input_from_memory_callback,
+                    &input_param,
+                    mameJpeg_output_to_memory_callback,
+                    &output_param,
+                    work_buffer.data(),
+                    work_buffer.size() ) );
+        REQUIRE( mameJpeg_decode( context ) );
+    }
+
+    /* EOI removed decodes like the blocking decoder, the scan cut short fails */
+    const size_t removed_sizes[] = { 2, 12 };
+    for( size_t removed : removed_sizes )
+    {
+        std::vector< uint8_t > work_buffer( work_buffer_size );
+        std::vector< uint8_t > decoded( expect.size() );
+        mameJpeg_memory_callback_param output_param = { decoded.data(), 0, decoded.size() };
+        mameJpeg_context context[1];
+        REQUIRE( mameJpeg_initializePushDecode( context,
+                    mameJpeg_output_to_memory_callback,
+                    &output_param,
+                    work_buffer.data(),
+                    work_buffer.size() ) );
+
+        std::vector< uint8_t > pending( data, data + size - removed );
+        size_t consumed = 0;
+        CHECK( mameJpeg_decodePush( context, pending.data(), pending.size(), &consumed ) == MAMEJPEG_STATUS_NEED_MORE_DATA );
+        pending.erase( pending.begin(), pending.begin() + consumed );
+
+        /* without the end of input an empty push keeps waiting */
+        CHECK( mameJpeg_decodePush( context, NULL, 0, &consumed ) == MAMEJPEG_STATUS_NEED_MORE_DATA );
+        CHECK( consumed == 0 );
+
+        REQUIRE( mameJpeg_finishPush( context ) );
+        mameJpeg_status status = mameJpeg_decodePush( context, pending.data(), pending.size(), &consumed );
+        if( removed == 2 )
+        {
+            CHECK( status == MAMEJPEG_STATUS_OK );
+            CHECK( consumed == pending.size() );
+            CHECK( decoded == expect );
+        }
+        else
+        {
+            CHECK( status == MAMEJPEG_STATUS_ERROR );
+        }
+    }
+}
+
+TEST_CASE("Encode jpeg into small output chunks", "[push]")
+{
+    const uint16_t width = 40;
+    const uint16_t height = 24;
+    const mameJpeg_format format = MAMEJPEG_FORMAT_YCBCR_420;
+    const uint8_t components = mameJpeg_getComponentNum( format );
+
+    std::vector< uint8_t > image( components * width * height );
+    for( size_t i = 0; i < image.size(); i++ )
+    {
+        image[i] = (uint8_t)( ( i * 7 ) ^ ( i >> 5 ) );
+    }
+
+    size_t work_buffer_size;
+    REQUIRE( mameJpeg_getEncodeBufferSize( width, height, format, &work_buffer_size ) );
+    size_t push_encode_buffer_size;
+    REQUIRE( mameJpeg_getPushEncodeBufferSize( width, height, format, &push_encode_buffer_size ) );
+
+    std::vector< uint8_t > expect( 1024 * 1024 );
+    {
+        std::vector< uint8_t > work_buffer( work_buffer_size );
+        mameJpeg_memory_callback_param input_param = { image.data(), 0, image.size() };
+        mameJpeg_memory_callback_param output_param = { expect.data(), 0, expect.size() };
+        mameJpeg_context context[1];
+        REQUIRE( mameJpeg_initializeEncode( context,
+                    mameJpeg_input_from_memory_callback,
+                    &input_param,
+                    mameJpeg_output_to_memory_callback,
+                    &output_param,
+                    width,
+                    height,
+                    format,
+                    100,
+                    work_buffer.data(),
+                    work_buffer.size() ) );
+        REQUIRE( mameJpeg_encode( context ) );
+        expect.resize( output_param.buffer_pos );
+    }
+
+    const size_t chunk_sizes[] = { 1, 13, 4096 };
+    for( size_t chunk_size : chunk_sizes )
+    {
+        std::vector< uint8_t > work_buffer( work_buffer_size + push_encode_buffer_size );
+        mameJpeg_memory_callback_param input_param = { image.data(), 0, image.size() };
+        mameJpeg_context context[1];
+        REQUIRE( mameJpeg_initializePushEncode( context,
+                    mameJpeg_input_from_memory_callback,
+                    &input_param,
+                    width,
+                    height,
+                    format,
+                    100,
+                    work_buffer.data(),
+                    work_buffer.size() ) );
+
+        std::vector< uint8_t > encoded;
+        std::vector< uint8_t > chunk( chunk_size );
+        mameJpeg_status status = MAMEJPEG_STATUS_OUTPUT_FULL;
+        while( status == MAMEJPEG_STATUS_OUTPUT_FULL )
+        {
+            size_t written = 0;
+            status = mameJpeg_encodePush( context, chunk.data(), chunk.size(), &written );
+            encoded.insert( encoded.end(), chunk.begin(), chunk.begin() + written );
+        }
+        CHECK( status == MAMEJPEG_STATUS_OK );
+        CHECK( encoded == expect );
+    }
+}
+
+TEST_CASE("Encode jpeg from pushed rows", "[push]")
+{
+    const uint16_t width = 40;
+    const uint16_t height = 21;
+    const mameJpeg_format format = MAMEJPEG_FORMAT_YCBCR_420;
+    const uint8_t components = mameJpeg_getComponentNum( format );
+    const size_t row_bytes = components * width;
+
+    std::vector< uint8_t > image( row_bytes * height );
+    for( size_t i = 0; i < image.size(); i++ )
+    {
+        image[i] = (uint8_t)( ( i * 5 ) ^ ( i >> 4 ) );
+    }
+
+    size_t work_buffer_size;
+    REQUIRE( mameJpeg_getEncodeBufferSize( width, height, format, &work_buffer_size ) );
+
+    std::vector< uint8_t > expect( 1024 * 1024 );
+    {
+        std::vector< uint8_t > work_buffer( work_buffer_size );
+        mameJpeg_memory_callback_param input_param = { image.data(), 0, image.size() };
+        mameJpeg_memory_callback_param output_param = { expect.data(), 0, expect.size() };
+        mameJpeg_context context[1];
+        REQUIRE( mameJpeg_initializeEncode( context,
+                    mameJpeg_input_from_memory_callback,
+                    &input_param,
+                    mameJpeg_output_to_memory_callback,
+                    &output_param,
+                    width,
+                    height,
+                    format,
+                    100,
+                    work_buffer.data(),
+                    work_buffer.size() ) );
+        REQUIRE( mameJpeg_encode( context ) );
+        expect.resize( output_param.buffer_pos );
+    }
+
+    /* rows are handed over with padding between them */
+    const size_t stride = row_bytes + 7;
+    std::vector< uint8_t > strided( stride * height );
+    for( size_t y = 0; y < height; y++ )
+    {
+        memcpy( &strided[ stride * y ], &image[ row_bytes * y ], row_bytes );
+    }
+
+    const size_t row_counts[] = { 1, 5, height };
+    for( size_t row_count : row_counts )
+    {
+        std::vector< uint8_t > work_buffer( work_buffer_size );
+        std::vector< uint8_t > encoded( 1024 * 1024 );
+        mameJpeg_memory_callback_param output_param = { encoded.data(), 0, encoded.size() };
+        mameJpeg_context context[1];
+        REQUIRE( mameJpeg_initializeRowEncode( context,
+                    mameJpeg_output_to_memory_callback,
+                    &output_param,
+                    width,
+                    height,
+                    format,
+                    100,
+                    work_buffer.data(),
+                    work_buffer.size() ) );
+
+        for( size_t y = 0; y < height; y += row_count )
+        {
+            size_t count = std::min( row_count, (size_t)height - y );
+            REQUIRE( mameJpeg_encodeRows( context, &strided[ stride * y ], stride, count ) );
+        }
+        CHECK_FALSE( mameJpeg_encodeRows( context, strided.data(), stride, 1 ) );
+
+        encoded.resize( output_param.buffer_pos );
+        CHECK( encoded == expect );
+    }
+}
+
+TEST_CASE("Encode jpeg from a strided surface", "[surface]")
+{
+    const uint16_t width = 37;
+    const uint16_t height = 19;
+    const mameJpeg_format formats[] = { MAMEJPEG_FORMAT_YCBCR_420, MAMEJPEG_FORMAT_YCBCR_422h, MAMEJPEG_FORMAT_Y_444 };
+
+    for( mameJpeg_format format : formats )
+    {
+        const uint8_t components = mameJpeg_getComponentNum( format );
+        const size_t row_bytes = components * width;
+
+        std::vector< uint8_t > image( row_bytes * height );
+        for( size_t i = 0; i < image.size(); i++ )
+        {
+            image[i] = (uint8_t)( ( i * 3 ) ^ ( i >> 3 ) );
+        }
+
+        size_t work_buffer_size;
+        REQUIRE( mameJpeg_getEncodeBufferSize( width, height, format, &work_buffer_size ) );
+
+        std::vector< uint8_t > expect( 1024 * 1024 );
+        {
+            std::vector< uint8_t > work_buffer( work_buffer_size );
+            mameJpeg_memory_callback_param input_param = { image.data(), 0, image.size() };
+            mameJpeg_memory_callback_param output_param = { expect.data(), 0, expect.size() };
+            mameJpeg_context context[1];
+            REQUIRE( mameJpeg_initializeEncode( context,
+                        mameJpeg_input_from_memory_callback,
+                        &input_param,
+                        mameJpeg_output_to_memory_callback,
+                        &output_param,
+                        width,
+                        height,
+                        format,
+                        100,
+                        work_buffer.data(),
+                        work_buffer.size() ) );
+            REQUIRE( mameJpeg_encode( context ) );
+            expect.resize( output_param.buffer_pos );
+        }
+
+        /* the surface ends right after the last pixel, so edge MCUs must not read past it */
+        const size_t stride = row_bytes + 5;
+        std::vector< uint8_t > surface( stride * ( height - 1 ) + row_bytes );
+        for( size_t y = 0; y < height; y++ )
+        {
+            memcpy( &surface[ stride * y ], &image[ row_bytes * y ], row_bytes );
+        }
+
+        std::vector< uint8_t > work_buffer( work_buffer_size );
+        std::vector< uint8_t > encoded( 1024 * 1024 );
+        mameJpeg_memory_callback_param output_param = { encoded.data(), 0, encoded.size() };
+        mameJpeg_context context[1];
+        REQUIRE( mameJpeg_initializeSurfaceEncode( context,
+                    surface.data(),
+                    stride,
+                    mameJpeg_output_to_memory_callback,
+                    &output_param,
+                    width,
+                    height,
+                    format,
+                    100,
+                    work_buffer.data(),
+                    work_buffer.size() ) );
+        REQUIRE( mameJpeg_setOutputBlockCallback( context, mameJpeg_output_block_to_memory_callback ) );
+        REQUIRE( mameJpeg_encode( context ) );
+        CHECK( context->line_buffer == NULL );
+
+        encoded.resize( output_param.buffer_pos );
+        CHECK( encoded == expect );
+    }
+}
+
+static std::vector< uint8_t > encodeForTest( const std::vector< uint8_t >& image, uint16_t width, uint16_t height, mameJpeg_format format, bool optimize, uint8_t quality = 100 )
+{
+    size_t work_buffer_size;
+    mameJpeg_getEncodeBufferSize( width, height, format, &work_buffer_size );
+    size_t optimize_buffer_size = 0;
+    if( optimize )
+    {
+        mameJpeg_getOptimizeBufferSize( width, height, format, &optimize_buffer_size );
+    }
+    std::vector< uint8_t > work_buffer( work_buffer_size + optimize_buffer_size );
+
+    std::vector< uint8_t > encoded( 1024 * 1024 );
+    mameJpeg_memory_callback_param input_param = { (void*)image.data(), 0, image.size() };
+    mameJpeg_memory_callback_param output_param = { encoded.data(), 0, encoded.size() };
+    mameJpeg_context context[1];
+    bool ret = mameJpeg_initializeEncode( context,
+            mameJpeg_input_from_memory_callback,
+            &input_param,
+            mameJpeg_output_to_memory_callback,
+            &output_param,
+            width,
+            height,
+            format,
+            quality,
+            work_buffer.data(),
+            work_buffer.size() );
+    ret = ret && mameJpeg_setOptimizeHuffman( context, optimize );
+    ret = ret && mameJpeg_encode( context );
+    encoded.resize( ret ? output_param.buffer_pos : 0 );
+    return encoded;
+}
+
+static std::vector< uint8_t > decodeForTest( std::vector< uint8_t >& encoded )
+{
+    uint16_t width = 0;
+    uint16_t height = 0;
+    uint8_t components = 0;
+    size_t work_buffer_size = 0;
+    mameJpeg_memory_callback_param info_input_param = { encoded.data(), 0, encoded.size() };
+    if( !mameJpeg_getDecodeBufferSize( mameJpeg_input_from_memory_callback, &info_input_param, &width, &height, &components, &work_buffer_size ) )
+    {
+        return std::vector< uint8_t >();
+    }
+
+    std::vector< uint8_t > work_buffer( work_buffer_size );
+    std::vector< uint8_t > decoded( (size_t)width * height * components );
+    mameJpeg_memory_callback_param input_param = { encoded.data(), 0, encoded.size() };
+    mameJpeg_memory_callback_param output_param = { decoded.data(), 0, decoded.size() };
+    mameJpeg_context context[1];
+    bool ret = mameJpeg_initializeDecode( context,
+            mameJpeg_input_from_memory_callback,
+            &input_param,
+            mameJpeg_output_to_memory_callback,
+            &output_param,
+            work_buffer.data(),
+            work_buffer.size() );
+    ret = ret && mameJpeg_decode( context );
+    decoded.resize( ret ? output_param.buffer_pos : 0 );
+    return decoded;
+}
+
+TEST_CASE("Encode jpeg with optimized huffman tables", "[optimize]")
+{
+    const uint16_t width = 61;
+    const uint16_t height = 35;
+    const mameJpeg_format formats[] = { MAMEJPEG_FORMAT_YCBCR_420, MAMEJPEG_FORMAT_YCBCR_444, MAMEJPEG_FORMAT_Y_444 };
+
+    for( mameJpeg_format format : formats )
+    {
+        const uint8_t components = mameJpeg_getComponentNum( format );
+        std::vector< uint8_t > image( (size_t)components * width * height );
+        for( size_t y = 0; y < height; y++ )
+        {
+            for( size_t x = 0; x < width; x++ )
+            {
+                for( size_t c = 0; c < components; c++ )
+                {
+                    image[ components * ( y * width + x ) + c ] = (uint8_t)( 128 + 100 * sin( 0.2 * x + 0.3 * y + c ) );
+                }
+            }
+        }
+
+        std::vector< uint8_t > standard = encodeForTest( image, width, height, format, false );
+        std::vector< uint8_t > optimized = encodeForTest( image, width, height, format, true );
+        REQUIRE( !standard.empty() );
+        REQUIRE( !optimized.empty() );
+        CHECK( optimized.size() < standard.size() );
+
+        /* only the entropy coding differs, so both decode to the same pixels */
+        std::vector< uint8_t > standard_decoded = decodeForTest( standard );
+        std::vector< uint8_t > optimized_decoded = decodeForTest( optimized );
+        CHECK( standard_decoded.size() == image.size() );
+        CHECK( optimized_decoded == standard_decoded );
+    }
+}
+
+static size_t findDQTForTest( const std::vector< uint8_t >& encoded )
+{
+    for( size_t i = 0; i + 1 < encoded.size(); i++ )
+    {
+        if( encoded[ i ] == 0xff && encoded[ i + 1 ] == 0xdb )
+        {
+            return i;
+        }
+    }
+    return encoded.size();
+}
+
+TEST_CASE("Encode jpeg with quality factor", "[quality]")
+{
+    const uint16_t width = 61;
+    const uint16_t height = 35;
+    const mameJpeg_format format = MAMEJPEG_FORMAT_YCBCR_444;
+    std::vector< uint8_t > image( (size_t)3 * width * height );
+    for( size_t y = 0; y < height; y++ )
+    {
+        for( size_t x = 0; x < width; x++ )
+        {
+            for( size_t c = 0; c < 3; c++ )
+            {
+                image[ 3 * ( y * width + x ) + c ] = (uint8_t)( 128 + 100 * sin( 0.2 * x + 0.3 * y + c ) );
+            }
+        }
+    }
+
+    SECTION("lower quality makes smaller output")
+    {
+        std::vector< uint8_t > high = encodeForTest( image, width, height, format, false, 100 );
+        std::vector< uint8_t > middle = encodeForTest( image, width, height, format, false, 75 );
+        std::vector< uint8_t > low = encodeForTest( image, width, height, format, false, 20 );
+        REQUIRE( !high.empty() );
+        REQUIRE( !middle.empty() );
+        REQUIRE( !low.empty() );
+        CHECK( middle.size() < high.size() );
+        CHECK( low.size() < middle.size() );
+
+        std::vector< uint8_t > decoded = decodeForTest( middle );
+        REQUIRE( decoded.size() == image.size() );
+        double error = 0;
+        for( size_t i = 0; i < image.size(); i++ )
+        {
+            error += fabs( (double)decoded[ i ] - image[ i ] );
+        }
+        CHECK( error / image.size() < 4.0 );
+    }
+
+    SECTION("quality 50 writes the standard tables")
+    {
+        std::vector< uint8_t > encoded = encodeForTest( image, width, height, format, false, 50 );
+        size_t dqt = findDQTForTest( encoded );
+        REQUIRE( dqt + 4 + 65 * 2 <= encoded.size() );
+        CHECK( encoded[ dqt + 2 ] == 0x00 );
+        CHECK( encoded[ dqt + 3 ] == 0x84 );
+        /* Pq/Tq, then the first values in zigzag order */
+        CHECK( encoded[ dqt + 4 ] == 0x00 );
+        CHECK( encoded[ dqt + 5 ] == 16 );
+        CHECK( encoded[ dqt + 6 ] == 11 );
+        CHECK( encoded[ dqt + 7 ] == 12 );
+        CHECK( encoded[ dqt + 4 + 65 ] == 0x01 );
+        CHECK( encoded[ dqt + 5 + 65 ] == 17 );
+        CHECK( encoded[ dqt + 6 + 65 ] == 18 );
+        CHECK( encoded[ dqt + 7 + 65 ] == 18 );
+    }
+
+    SECTION("quality 100 writes all ones")
+    {
+        std::vector< uint8_t > encoded = encodeForTest( image, width, height, format, false, 100 );
+        size_t dqt = findDQTForTest( encoded );
+        REQUIRE( dqt + 4 + 65 * 2 <= encoded.size() );
+        for( size_t i = 0; i < 64; i++ )
+        {
+            CHECK( encoded[ dqt + 5 + i ] == 1 );
+            CHECK( encoded[ dqt + 5 + 65 + i ] == 1 );
+        }
+    }
+
+    SECTION("custom tables")
+    {
+        uint8_t luma[ 64 ];
+        uint8_t chroma[ 64 ];
+        for( size_t i = 0; i < 64; i++ )
+        {
+            luma[ i ] = (uint8_t)( i + 1 );
+            chroma[ i ] = 7;
+        }
+
+        size_t work_buffer_size;
+        mameJpeg_getEncodeBufferSize( width, height, format, &work_buffer_size );
+        std::vector< uint8_t > work_buffer( work_buffer_size );
+        std::vector< uint8_t > encoded( 1024 * 1024 );
+        mameJpeg_memory_callback_param input_param = { image.data(), 0, image.size() };
+        mameJpeg_memory_callback_param output_param = { encoded.data(), 0, encoded.size() };
+        mameJpeg_context context[1];
+        REQUIRE( mameJpeg_initializeEncode( context,
+                mameJpeg_input_from_memory_callback,
+                &input_param,
+                mameJpeg_output_to_memory_callback,
+                &output_param,
+                width,
+                height,
+                format,
+                90,
+                work_buffer.data(),
+                work_buffer.size() ) );
+        REQUIRE( mameJpeg_setQuantTables( context, luma, chroma ) );
+        REQUIRE( mameJpeg_encode( context ) );
+        encoded.resize( output_param.buffer_pos );
+
+        size_t dqt = findDQTForTest( encoded );
+        REQUIRE( dqt + 4 + 65 * 2 <= encoded.size() );
+        /* natural order 0, 1, 8, 16, 9 in zigzag */
+        CHECK( encoded[ dqt + 5 ] == 1 );
+        CHECK( encoded[ dqt + 6 ] == 2 );
+        CHECK( encoded[ dqt + 7 ] == 9 );
+        CHECK( encoded[ dqt + 8 ] == 17 );
+        CHECK( encoded[ dqt + 9 ] == 10 );
+        CHECK( encoded[ dqt + 5 + 65 ] == 7 );
+        CHECK( !decodeForTest( encoded ).empty() );
+
+        /* tables are fixed once the header is written */
+        CHECK( !mameJpeg_setQuantTables( context, luma, chroma ) );
+    }
+
+    SECTION("invalid quality")
+    {
+        CHECK( encodeForTest( image, width, height, format, false, 0 ).empty() );
+        CHECK( encodeForTest( image, width, height, format, false, 101 ).empty() );
+    }
+}
+
+static std::vector< uint8_t > encodeToTargetForTest( const std::vector< uint8_t >& image, uint16_t width, uint16_t height, mameJpeg_format format, size_t target_bytes, uint8_t* quality )
+{
+    size_t work_buffer_size;
+    mameJpeg_getEncodeBufferSize( width, height, format, &work_buffer_size );
+    size_t target_size_buffer_size;
+    mameJpeg_getTargetSizeBufferSize( width, height, format, &target_size_buffer_size );
+    std::vector< uint8_t > work_buffer( work_buffer_size + target_size_buffer_size );
+
+    std::vector< uint8_t > encoded( 1024 * 1024 );
+    mameJpeg_memory_callback_param input_param = { (void*)image.data(), 0, image.size() };
+    mameJpeg_memory_callback_param output_param = { encoded.data(), 0, encoded.size() };
+    mameJpeg_context context[1];
+    bool ret = mameJpeg_initializeEncode( context,
+            mameJpeg_input_from_memory_callback,
+            &input_param,
+            mameJpeg_output_to_memory_callback,
+            &output_param,
+            width,
+            height,
+            format,
+            100,
+            work_buffer.data(),
+            work_buffer.size() );
+    ret = ret && mameJpeg_setTargetSize( context, target_bytes );
+    ret = ret && mameJpeg_encode( context );
+    ret = ret && mameJpeg_getSelectedQuality( context, quality );
+    encoded.resize( ret ? output_param.buffer_pos : 0 );
+    return encoded;
+}
+
+TEST_CASE("Encode jpeg into a target size", "[quality]")
+{
+    const uint16_t width = 77;
+    const uint16_t height = 45;
+    const mameJpeg_format formats[] = { MAMEJPEG_FORMAT_YCBCR_420, MAMEJPEG_FORMAT_YCBCR_444, MAMEJPEG_FORMAT_Y_444 };
+
+    for( mameJpeg_format format : formats )
+    {
+        const uint8_t components = mameJpeg_getComponentNum( format );
+        std::vector< uint8_t > image( (size_t)components * width * height );
+        for( size_t y = 0; y < height; y++ )
+        {
+            for( size_t x = 0; x < width; x++ )
+            {
+                for( size_t c = 0; c < components; c++ )
+                {
+                    image[ components * ( y * width + x ) + c ] = (uint8_t)( 128 + 60 * sin( 0.2 * x + 0.3 * y + c ) + ( ( x * 7 + y * 13 ) % 31 ) );
+                }
+            }
+        }
+
+        const size_t targets[] = { 1500, 2500, 4000, 8000 };
+        size_t prev_size = 0;
+        uint8_t prev_quality = 0;
+        for( size_t target : targets )
+        {
+            uint8_t quality = 0;
+            std::vector< uint8_t > encoded = encodeToTargetForTest( image, width, height, format, target, &quality );
+            REQUIRE( !encoded.empty() );
+            CHECK( encoded.size() <= target );
+            CHECK( prev_size <= encoded.size() );
+            CHECK( prev_quality <= quality );
+            CHECK( decodeForTest( encoded ).size() == image.size() );
+
+            /* the same stream as a plain encode at the selected quality */
+            CHECK( encoded == encodeForTest( image, width, height, format, false, quality ) );
+            if( quality < 100 )
+            {
+                /* the highest quality that fits */
+                CHECK( target < encodeForTest( image, width, height, format, false, quality + 1 ).size() );
+            }
+            prev_size = encoded.size();
+            prev_quality = quality;
+        }
+
+        /* not even quality 1 fits */
+        uint8_t quality = 0;
+        CHECK( encodeToTargetForTest( image, width, height, format, 100, &quality ).empty() );
+    }
+
+    /* noise stuffs many 0xff bytes, every target is still met exactly */
+    std::vector< uint8_t > noise( 3 * width * height );
+    uint32_t seed = 12345;
+    for( size_t i = 0; i < noise.size(); i++ )
+    {
+        seed = seed * 1103515245 + 12345;
+        noise[i] = (uint8_t)( seed >> 16 );
+    }
+    for( size_t target = 2000; target < 12000; target += 250 )
+    {
+        uint8_t quality = 0;
+        std::vector< uint8_t > encoded = encodeToTargetForTest( noise, width, height, MAMEJPEG_FORMAT_YCBCR_444, target, &quality );
+        REQUIRE( !encoded.empty() );
+        CHECK( encoded.size() <= target );
+        CHECK( encoded == encodeForTest( noise, width, height, MAMEJPEG_FORMAT_YCBCR_444, false, quality ) );
+    }
+}
+
+TEST_CASE("Encode jpeg at several qualities in one pass", "[quality]")
+{
+    const uint16_t width = 77;
+    const uint16_t height = 45;
+    const mameJpeg_format formats[] = { MAMEJPEG_FORMAT_YCBCR_420, MAMEJPEG_FORMAT_YCBCR_422v, MAMEJPEG_FORMAT_Y_444 };
+    const uint8_t qualities[] = { 100, 75, 30 };
+    const size_t context_num = sizeof( qualities ) / sizeof( qualities[0] );
+
+    for( mameJpeg_format format : formats )
+    {
+        const uint8_t components = mameJpeg_getComponentNum( format );
+        std::vector< uint8_t > image( (size_t)components * width * height );
+        for( size_t y = 0; y < height; y++ )
+        {
+            for( size_t x = 0; x < width; x++ )
+            {
+                for( size_t c = 0; c < components; c++ )
+                {
+                    image[ components * ( y * width + x ) + c ] = (uint8_t)( 128 + 100 * sin( 0.2 * x + 0.3 * y + c ) );
+                }
+            }
+        }
+
+        size_t work_buffer_size;
+        mameJpeg_getEncodeBufferSize( width, height, format, &work_buffer_size );
+        size_t output_only_buffer_size;
+        mameJpeg_getMultiQualityBufferSize( width, height, format, &output_only_buffer_size );
+        CHECK( output_only_buffer_size < work_buffer_size );
+        std::vector< std::vector< uint8_t > > work_buffers( context_num, std::vector< uint8_t >( output_only_buffer_size ) );
+        work_buffers[0].resize( work_buffer_size );
+        std::vector< std::vector< uint8_t > > outputs( context_num, std::vector< uint8_t >( 1024 * 1024 ) );
+        mameJpeg_memory_callback_param input_param = { image.data(), 0, image.size() };
+        mameJpeg_memory_callback_param output_params[ context_num ];
+        mameJpeg_context contexts[ context_num ];
+        for( size_t i = 0; i < context_num; i++ )
+        {
+            output_params[i] = { outputs[i].data(), 0, outputs[i].size() };
+            if( i == 0 )
+            {
+                /* the first context reads the pixels */
+                REQUIRE( mameJpeg_initializeEncode( &contexts[i],
+                        mameJpeg_input_from_memory_callback,
+                        &input_param,
+                        mameJpeg_output_to_memory_callback,
+                        &output_params[i],
+                        width,
+                        height,
+                        format,
+                        qualities[i],
+                        work_buffers[i].data(),
+                        work_buffers[i].size() ) );
+            }
+            else
+            {
+                REQUIRE( mameJpeg_initializeMultiQualityEncode( &contexts[i],
+                        mameJpeg_output_to_memory_callback,
+                        &output_params[i],
+                        width,
+                        height,
+                        format,
+                        qualities[i],
+                        work_buffers[i].data(),
+                        work_buffers[i].size() ) );
+            }
+        }
+        REQUIRE( mameJpeg_encodeMultiQuality( contexts, context_num ) );
+
+        for( size_t i = 0; i < context_num; i++ )
+        {
+            outputs[i].resize( output_params[i].buffer_pos );
+            CHECK( outputs[i] == encodeForTest( image, width, height, format, false, qualities[i] ) );
+        }
+        CHECK( outputs[2].size() < outputs[1].size() );
+        CHECK( outputs[1].size() < outputs[0].size() );
+    }
+
+    SECTION("geometry must match")
+    {
+        const uint8_t components = 3;
+        std::vector< uint8_t > image( (size_t)components * width * height, 0x80 );
+        size_t work_buffer_size;
+        mameJpeg_getEncodeBufferSize( width, height, MAMEJPEG_FORMAT_YCBCR_444, &work_buffer_size );
+        std::vector< uint8_t > work_buffer0( work_buffer_size );
+        std::vector< uint8_t > work_buffer1( work_buffer_size );
+        std::vector< uint8_t > output( 1024 * 1024 );
+        mameJpeg_memory_callback_param input_param = { image.data(), 0, image.size() };
+        mameJpeg_memory_callback_param output_param = { output.data(), 0, output.size() };
+        mameJpeg_context contexts[2];
+        REQUIRE( mameJpeg_initializeEncode( &contexts[0], mameJpeg_input_from_memory_callback, &input_param,
+                mameJpeg_output_to_memory_callback, &output_param, width, height, MAMEJPEG_FORMAT_YCBCR_444, 90,
+                work_buffer0.data(), work_buffer0.size() ) );
+        REQUIRE( mameJpeg_initializeMultiQualityEncode( &contexts[1], mameJpeg_output_to_memory_callback, &output_param,
+                width, height, MAMEJPEG_FORMAT_YCBCR_420, 90, work_buffer1.data(), work_buffer1.size() ) );
+        CHECK( !mameJpeg_encodeMultiQuality( contexts, 2 ) );
+    }
+
+    SECTION("output only contexts have no pixels to read")
+    {
+        size_t work_buffer_size;
+        mameJpeg_getMultiQualityBufferSize( width, height, MAMEJPEG_FORMAT_YCBCR_444, &work_buffer_size );
+        std::vector< uint8_t > work_buffer( work_buffer_size );
+        std::vector< uint8_t > output( 1024 * 1024 );
+        mameJpeg_memory_callback_param output_param = { output.data(), 0, output.size() };
+        mameJpeg_context context[1];
+        REQUIRE( mameJpeg_initializeMultiQualityEncode( context, mameJpeg_output_to_memory_callback, &output_param,
+                width, height, MAMEJPEG_FORMAT_YCBCR_444, 90, work_buffer.data(), work_buffer.size() ) );
+        CHECK( !mameJpeg_encode( context ) );
+        CHECK( !mameJpeg_encodeMultiQuality( context, 1 ) );
+    }
+}
+
+static bool readCoefficientsForTest( std::vector< uint8_t >& encoded, std::vector< uint8_t >& work_buffer, std::vector< uint8_t >& coefficient_buffer, mameJpeg_coefficients* coefficients )
+{
+    size_t work_buffer_size = 0;
+    mameJpeg_memory_callback_param info_input_param = { encoded.data(), 0, encoded.size() };
+    if( !mameJpeg_getDecodeBufferSize( mameJpeg_input_from_memory_callback, &info_input_param, NULL, NULL, NULL, &work_buffer_size ) )
+    {
+        return false;
+    }
+    work_buffer.resize( work_buffer_size );
+
+    mameJpeg_memory_callback_param input_param = { encoded.data(), 0, encoded.size() };
+    mameJpeg_context context[1];
+    bool ret = mameJpeg_initializeDecode( context,
+            mameJpeg_input_from_memory_callback,
+            &input_param,
+            NULL,
+            NULL,
+            work_buffer.data(),
+            work_buffer.size() );
+    ret = ret && mameJpeg_readHeader( context );
+
+    size_t coefficient_buffer_size = 0;
+    ret = ret && mameJpeg_getCoefficientBufferSize( context, &coefficient_buffer_size );
+    coefficient_buffer.resize( coefficient_buffer_size );
+    ret = ret && mameJpeg_readCoefficients( context, coefficients, coefficient_buffer.data(), coefficient_buffer.size() );
+    return ret;
+}
+
+static std::vector< uint8_t > writeCoefficientsForTest( const mameJpeg_coefficients* coefficients, bool optimize )
+{
+    size_t work_buffer_size;
+    mameJpeg_getEncodeBufferSize( coefficients->width, coefficients->height, coefficients->format, &work_buffer_size );
+    size_t optimize_buffer_size = 0;
+    if( optimize )
+    {
+        mameJpeg_getOptimizeBufferSize( coefficients->width, coefficients->height, coefficients->format, &optimize_buffer_size );
+    }
+    std::vector< uint8_t > work_buffer( work_buffer_size + optimize_buffer_size );
+
+    std::vector< uint8_t > encoded( 1024 * 1024 );
+    mameJpeg_memory_callback_param output_param = { encoded.data(), 0, encoded.size() };
+    mameJpeg_context context[1];
+    bool ret = mameJpeg_initializeCoefficientEncode( context,
+            mameJpeg_output_to_memory_callback,
+            &output_param,
+            coefficients,
+            work_buffer.data(),
+            work_buffer.size() );
+    ret = ret && mameJpeg_setOptimizeHuffman( context, optimize );
+    ret = ret && mameJpeg_writeCoefficients( context );
+    encoded.resize( ret ? output_param.buffer_pos : 0 );
+    return encoded;
+}
+
+TEST_CASE("Read and write DCT coefficients", "[coefficients]")
+{
+    const uint16_t width = 77;
+    const uint16_t height = 45;
+    const mameJpeg_format formats[] = { MAMEJPEG_FORMAT_YCBCR_420, MAMEJPEG_FORMAT_YCBCR_422h, MAMEJPEG_FORMAT_YCBCR_444, MAMEJPEG_FORMAT_Y_444 };
+
+    for( mameJpeg_format format : formats )
+    {
+        const uint8_t components = mameJpeg_getComponentNum( format );
+        std::vector< uint8_t > image( (size_t)components * width * height );
+        for( size_t y = 0; y < height; y++ )
+        {
+            for( size_t x = 0; x < width; x++ )
+            {
+                for( size_t c = 0; c < components; c++ )
+                {
+                    image[ components * ( y * width + x ) + c ] = (uint8_t)( 128 + 100 * sin( 0.2 * x + 0.3 * y + c ) );
+                }
+            }
+        }
+        std::vector< uint8_t > encoded = encodeForTest( image, width, height, format, false, 75 );
+        REQUIRE( !encoded.empty() );
+
+        std::vector< uint8_t > work_buffer;
+        std::vector< uint8_t > coefficient_buffer;
+        mameJpeg_coefficients coefficients;
+        REQUIRE( readCoefficientsForTest( encoded, work_buffer, coefficient_buffer, &coefficients ) );
+        CHECK( coefficients.width == width );
+        CHECK( coefficients.height == height );
+        CHECK( coefficients.format == format );
+        CHECK( coefficients.component_num == components );
+        const size_t mcu_width = ( format == MAMEJPEG_FORMAT_YCBCR_420 || format == MAMEJPEG_FORMAT_YCBCR_422h ) ? 16 : 8;
+        CHECK( coefficients.component[0].hor_block_num == ( width + mcu_width - 1 ) / mcu_width * mcu_width / 8 );
+        /* quality 75 scales the Annex K luminance DC step 16 to 8 */
+        CHECK( coefficients.component[0].quant_table[0] == 8 );
+        CHECK( coefficients.component[0].blocks[0] != 0 );
+
+        /* same tables and coefficients give the same stream */
+        std::vector< uint8_t > rewritten = writeCoefficientsForTest( &coefficients, false );
+        CHECK( rewritten == encoded );
+
+        std::vector< uint8_t > optimized = writeCoefficientsForTest( &coefficients, true );
+        REQUIRE( !optimized.empty() );
+        CHECK( optimized.size() < encoded.size() );
+        CHECK( decodeForTest( optimized ) == decodeForTest( encoded ) );
+    }
+}
+
+TEST_CASE("Transform DCT coefficients losslessly", "[coefficients]")
+{
+    const mameJpeg_format formats[] = { MAMEJPEG_FORMAT_YCBCR_420, MAMEJPEG_FORMAT_YCBCR_422h, MAMEJPEG_FORMAT_YCBCR_444, MAMEJPEG_FORMAT_Y_444 };
+    const mameJpeg_transform transforms[] = {
+        MAMEJPEG_TRANSFORM_FLIP_H,
+        MAMEJPEG_TRANSFORM_FLIP_V,
+        MAMEJPEG_TRANSFORM_TRANSPOSE,
+        MAMEJPEG_TRANSFORM_TRANSVERSE,
+        MAMEJPEG_TRANSFORM_ROTATE_90,
+        MAMEJPEG_TRANSFORM_ROTATE_180,
+        MAMEJPEG_TRANSFORM_ROTATE_270,
+    };
+    /* transpose, flip x, flip y applied to the destination coordinates */
+    const bool steps[7][3] = {
+        { false, true, false }, { false, false, true }, { true, false, false }, { true, true, true },
+        { true, true, false }, { false, true, true }, { true, false, true },
+    };
+    const uint16_t sizes[2][2] = { { 48, 32 }, { 77, 45 } };
+
+    for( const auto& size : sizes )
+    {
+        const uint16_t width = size[0];
+        const uint16_t height = size[1];
+        for( mameJpeg_format format : formats )
+        {
+            const uint8_t components = mameJpeg_getComponentNum( format );
+            std::vector< uint8_t > image( (size_t)components * width * height );
+            for( size_t y = 0; y < height; y++ )
+            {
+                for( size_t x = 0; x < width; x++ )
+                {
+                    for( size_t c = 0; c < components; c++ )
+                    {
+                        image[ components * ( y * width + x ) + c ] = (uint8_t)( 128 + 60 * sin( 0.2 * x + 0.1 * y * y / 8 + c ) + ( x * y ) % 17 );
+                    }
+                }
+            }
+            std::vector< uint8_t > encoded = encodeForTest( image, width, height, format, false, 90 );
+            std::vector< uint8_t > decoded = decodeForTest( encoded );
+            REQUIRE( decoded.size() == image.size() );
+
+            std::vector< uint8_t > work_buffer;
+            std::vector< uint8_t > coefficient_buffer;
+            mameJpeg_coefficients coefficients;
+            REQUIRE( readCoefficientsForTest( encoded, work_buffer, coefficient_buffer, &coefficients ) );
+
+            for( size_t t = 0; t < sizeof( transforms ) / sizeof( transforms[0] ); t++ )
+            {
+                std::vector< uint8_t > transformed_buffer( coefficient_buffer.size() );
+                mameJpeg_coefficients transformed;
+                REQUIRE( mameJpeg_transformCoefficients( &coefficients, transforms[t], &transformed, transformed_buffer.data(), transformed_buffer.size() ) );
+
+                bool is_transposed = steps[t][0];
+                size_t mcu_width = 8 * mameJpeg_getLumaHorSampling( transformed.format );
+                size_t mcu_height = 8 * mameJpeg_getLumaVerSampling( transformed.format );
+                size_t expected_width = is_transposed ? height : width;
+                size_t expected_height = is_transposed ? width : height;
+                expected_width = steps[t][1] ? expected_width / mcu_width * mcu_width : expected_width;
+                expected_height = steps[t][2] ? expected_height / mcu_height * mcu_height : expected_height;
+                CHECK( transformed.width == expected_width );
+                CHECK( transformed.height == expected_height );
+                if( format == MAMEJPEG_FORMAT_YCBCR_422h )
+                {
+                    CHECK( transformed.format == ( is_transposed ? MAMEJPEG_FORMAT_YCBCR_422v : MAMEJPEG_FORMAT_YCBCR_422h ) );
+                }
+
+                std::vector< uint8_t > rewritten = writeCoefficientsForTest( &transformed, false );
+                REQUIRE( !rewritten.empty() );
+                std::vector< uint8_t > result = decodeForTest( rewritten );
+                REQUIRE( result.size() == (size_t)components * transformed.width * transformed.height );
+
+                /* the pixels follow the same mapping up to IDCT rounding */
+                int max_diff = 0;
+                for( size_t y = 0; y < transformed.height; y++ )
+                {
+                    for( size_t x = 0; x < transformed.width; x++ )
+                    {
+                        size_t ix = steps[t][1] ? ( transformed.width - 1 - x ) : x;
+                        size_t iy = steps[t][2] ? ( transformed.height - 1 - y ) : y;
+                        size_t src_x = is_transposed ? iy : ix;
+                        size_t src_y = is_transposed ? ix : iy;
+                        for( size_t c = 0; c < components; c++ )
+                        {
+                            int diff = abs( (int)result[ components * ( y * transformed.width + x ) + c ] - decoded[ components * ( src_y * width + src_x ) + c ] );
+                            max_diff = ( max_diff < diff ) ? diff : max_diff;
+                        }
+                    }
+                }
+                CHECK( max_diff <= 1 );
+            }
+        }
+    }
+
+    SECTION("destination buffer too small")
+    {
+        std::vector< uint8_t > image( 3 * 32 * 32, 0x40 );
+        std::vector< uint8_t > encoded = encodeForTest( image, 32, 32, MAMEJPEG_FORMAT_YCBCR_420, false, 90 );
+        std::vector< uint8_t > work_buffer;
+        std::vector< uint8_t > coefficient_buffer;
+        mameJpeg_coefficients coefficients;
+        REQUIRE( readCoefficientsForTest( encoded, work_buffer, coefficient_buffer, &coefficients ) );
+        std::vector< uint8_t > transformed_buffer( coefficient_buffer.size() - 1 );
+        mameJpeg_coefficients transformed;
+        CHECK( !mameJpeg_transformCoefficients( &coefficients, MAMEJPEG_TRANSFORM_ROTATE_90, &transformed, transformed_buffer.data(), transformed_buffer.size() ) );
+    }
+}
+
+TEST_CASE("Crop jpeg losslessly on MCU boundaries", "[coefficients]")
+{
+    const uint16_t width = 77;
+    const uint16_t height = 45;
+    const mameJpeg_format formats[] = { MAMEJPEG_FORMAT_YCBCR_420, MAMEJPEG_FORMAT_YCBCR_444, MAMEJPEG_FORMAT_Y_444 };
+    /* x, y, width, height in pixels of the 4:2:0 MCU grid, which the other formats also align to */
+    const size_t windows[][4] = { { 16, 16, 40, 25 }, { 32, 0, 45, 45 }, { 0, 0, 77, 45 }, { 64, 32, 1, 1 } };
+
+    for( mameJpeg_format format : formats )
+    {
+        const uint8_t components = mameJpeg_getComponentNum( format );
+        std::vector< uint8_t > image( (size_t)components * width * height );
+        for( size_t y = 0; y < height; y++ )
+        {
+            for( size_t x = 0; x < width; x++ )
+            {
+                for( size_t c = 0; c < components; c++ )
+                {
+                    image[ components * ( y * width + x ) + c ] = (uint8_t)( 128 + 60 * sin( 0.2 * x + 0.1 * y * y / 8 + c ) + ( x * y ) % 17 );
+                }
+            }
+        }
+        std::vector< uint8_t > encoded = encodeForTest( image, width, height, format, false, 90 );
+        std::vector< uint8_t > decoded = decodeForTest( encoded );
+        REQUIRE( decoded.size() == image.size() );
+
+        for( const auto& window : windows )
+        {
+            size_t work_buffer_size = 0;
+            mameJpeg_memory_callback_param info_input_param = { encoded.data(), 0, encoded.size() };
+            REQUIRE( mameJpeg_getDecodeBufferSize( mameJpeg_input_from_memory_callback, &info_input_param, NULL, NULL, NULL, &work_buffer_size ) );
+            std::vector< uint8_t > work_buffer( work_buffer_size );
+            mameJpeg_memory_callback_param input_param = { encoded.data(), 0, encoded.size() };
+            mameJpeg_context context[1];
+            REQUIRE( mameJpeg_initializeDecode( context, mameJpeg_input_from_memory_callback, &input_param, NULL, NULL, work_buffer.data(), work_buffer.size() ) );
+            REQUIRE( mameJpeg_readHeader( context ) );
+            REQUIRE( mameJpeg_setCropWindow( context, window[0], window[1], window[2], window[3] ) );
+
+            size_t coefficient_buffer_size = 0;
+            REQUIRE( mameJpeg_getCoefficientBufferSize( context, &coefficient_buffer_size ) );
+            std::vector< uint8_t > coefficient_buffer( coefficient_buffer_size );
+            mameJpeg_coefficients coefficients;
+            REQUIRE( mameJpeg_readCoefficients( context, &coefficients, coefficient_buffer.data(), coefficient_buffer.size() ) );
+            CHECK( coefficients.width == window[2] );
+            CHECK( coefficients.height == window[3] );
+
+            std::vector< uint8_t > cropped = writeCoefficientsForTest( &coefficients, false );
+            REQUIRE( !cropped.empty() );
+            std::vector< uint8_t > result = decodeForTest( cropped );
+            REQUIRE( result.size() == (size_t)components * window[2] * window[3] );
+
+            /* the same coefficients decode to the same pixels */
+            bool is_same = true;
+            for( size_t y = 0; y < window[3]; y++ )
+            {
+                const uint8_t* expected = &decoded[ components * ( ( window[1] + y ) * width + window[0] ) ];
+                is_same = is_same && memcmp( &result[ components * y * window[2] ], expected, components * window[2] ) == 0;
+            }
+            CHECK( is_same );
+        }
+    }
+
+    SECTION("window must start on an MCU boundary")
+    {
+        std::vector< uint8_t > image( 3 * width * height, 0x40 );
+        std::vector< uint8_t > encoded = encodeForTest( image, width, height, MAMEJPEG_FORMAT_YCBCR_420, false, 90 );
+        size_t work_buffer_size = 0;
+        mameJpeg_memory_callback_param info_input_param = { encoded.data(), 0, encoded.size() };
+        REQUIRE( mameJpeg_getDecodeBufferSize( mameJpeg_input_from_memory_callback, &info_input_param, NULL, NULL, NULL, &work_buffer_size ) );
+        std::vector< uint8_t > work_buffer( work_buffer_size );
+        mameJpeg_memory_callback_param input_param = { encoded.data(), 0, encoded.size() };
+        mameJpeg_context context[1];
+        REQUIRE( mameJpeg_initializeDecode( context, mameJpeg_input_from_memory_callback, &input_param, NULL, NULL, work_buffer.data(), work_buffer.size() ) );
+        REQUIRE( mameJpeg_readHeader( context ) );
+        CHECK( !mameJpeg_setCropWindow( context, 8, 0, 16, 16 ) );
+        CHECK( !mameJpeg_setCropWindow( context, 0, 0, 78, 16 ) );
+        CHECK( mameJpeg_setCropWindow( context, 16, 32, 61, 13 ) );
+    }
+}
+
+TEST_CASE("Requantize DCT coefficients to a lower quality", "[coefficients]")
+{
+    const uint16_t width = 77;
+    const uint16_t height = 45;
+    const mameJpeg_format formats[] = { MAMEJPEG_FORMAT_YCBCR_420, MAMEJPEG_FORMAT_Y_444 };
+
+    for( mameJpeg_format format : formats )
+    {
+        const uint8_t components = mameJpeg_getComponentNum( format );
+        std::vector< uint8_t > image( (size_t)components * width * height );
+        for( size_t y = 0; y < height; y++ )
+        {
+            for( size_t x = 0; x < width; x++ )
+            {
+                for( size_t c = 0; c < components; c++ )
+                {
+                    image[ components * ( y * width + x ) + c ] = (uint8_t)( 128 + 60 * sin( 0.2 * x + 0.1 * y * y / 8 + c ) + ( x * y ) % 17 );
+                }
+            }
+        }
+        std::vector< uint8_t > encoded = encodeForTest( image, width, height, format, false, 95 );
+        std::vector< uint8_t > direct = encodeForTest( image, width, height, format, false, 50 );
+
+        std::vector< uint8_t > work_buffer;
+        std::vector< uint8_t > coefficient_buffer;
+        mameJpeg_coefficients coefficients;
+        REQUIRE( readCoefficientsForTest( encoded, work_buffer, coefficient_buffer, &coefficients ) );
+
+        SECTION("coarser tables shrink the stream")
+        {
+            REQUIRE( mameJpeg_requantizeCoefficients( &coefficients, 50 ) );
+            CHECK( coefficients.component[0].quant_table[0] == 16 );
+            CHECK( coefficients.component[0].quant_table[1] == 11 );
+
+            std::vector< uint8_t > requantized = writeCoefficientsForTest( &coefficients, false );
+            std::vector< uint8_t > optimized = writeCoefficientsForTest( &coefficients, true );
+            REQUIRE( !requantized.empty() );
+            REQUIRE( !optimized.empty() );
+            CHECK( requantized.size() < encoded.size() / 2 );
+            CHECK( optimized.size() < requantized.size() );
+
+            /* close to encoding the pixels at that quality directly */
+            std::vector< uint8_t > result = decodeForTest( optimized );
+            std::vector< uint8_t > direct_result = decodeForTest( direct );
+            REQUIRE( result.size() == image.size() );
+            REQUIRE( direct_result.size() == image.size() );
+            double error = 0;
+            double direct_error = 0;
+            for( size_t i = 0; i < image.size(); i++ )
+            {
+                error += fabs( (double)result[i] - image[i] );
+                direct_error += fabs( (double)direct_result[i] - image[i] );
+            }
+            CHECK( error < direct_error * 1.2 );
+        }
+
+        SECTION("tables never get finer than the source")
+        {
+            REQUIRE( mameJpeg_requantizeCoefficients( &coefficients, 100 ) );
+            CHECK( writeCoefficientsForTest( &coefficients, false ) == encoded );
+        }
+
+        SECTION("custom target tables")
+        {
+            uint8_t luma_table[64];
+            uint8_t chroma_table[64];
+            memset( luma_table, 40, sizeof( luma_table ) );
+            memset( chroma_table, 60, sizeof( chroma_table ) );
+            luma_table[0] = 1;
+
+            uint8_t source_tables[3][64];
+            for( size_t i = 0; i < components; i++ )
+            {
+                memcpy( source_tables[i], coefficients.component[i].quant_table, 64 );
+            }
+            if( components == 3 )
+            {
+                CHECK( !mameJpeg_requantizeCoefficientsToTables( &coefficients, luma_table, NULL ) );
+            }
+            REQUIRE( mameJpeg_requantizeCoefficientsToTables( &coefficients, luma_table, chroma_table ) );
+            for( size_t i = 0; i < components; i++ )
+            {
+                const uint8_t* target_table = ( i == 0 ) ? luma_table : chroma_table;
+                for( size_t j = 0; j < 64; j++ )
+                {
+                    CHECK( coefficients.component[i].quant_table[j] == std::max( source_tables[i][j], target_table[j] ) );
+                }
+            }
+
+            std::vector< uint8_t > requantized = writeCoefficientsForTest( &coefficients, true );
+            REQUIRE( !requantized.empty() );
+            CHECK( requantized.size() < encoded.size() / 2 );
+            CHECK( decodeForTest( requantized ).size() == image.size() );
+        }
+    }
+}
+
+typedef struct {
+    mameJpeg_memory_callback_param memory;
+    size_t read_count;
+} counting_callback_param;
+
+static bool counting_input_callback( void* param, uint8_t* byte )
+{
+    counting_callback_param* counting_param = (counting_callback_param*)param;
+    counting_param->read_count++;
+    return mameJpeg_input_from_memory_callback( &counting_param->memory, byte );
+}
+
+static bool counting_skip_callback( void* param, size_t size )
+{
+    counting_callback_param* counting_param = (counting_callback_param*)param;
+    return mameJpeg_input_skip_in_memory_callback( &counting_param->memory, size );
+}
+
+TEST_CASE("Skip unknown segments by length", "[segment]")
+{
+    const uint16_t width = 40;
+    const uint16_t height = 24;
+    std::vector< uint8_t > image( 3 * width * height );
+    for( size_t i = 0; i < image.size(); i++ )
+    {
+        image[i] = (uint8_t)( i * 7 );
+    }
+    std::vector< uint8_t > encoded = encodeForTest( image, width, height, MAMEJPEG_FORMAT_YCBCR_420, false, 90 );
+    std::vector< uint8_t > expect = decodeForTest( encoded );
+    REQUIRE( expect.size() == image.size() );
+
+    /* APP1 right after SOI whose payload looks like markers */
+    const size_t payload_size = 6000;
+    std::vector< uint8_t > app1 = { 0xff, 0xe1, (uint8_t)( ( payload_size + 2 ) >> 8 ), (uint8_t)( payload_size + 2 ) };
+    for( size_t i = 0; i < payload_size; i++ )
+    {
+        const uint8_t pattern[] = { 0xff, 0xc0, 0x00, 0x11, 0xff, 0xd9, 0xff, 0xda };
+        app1.push_back( pattern[ i % sizeof( pattern ) ] );
+    }
+    std::vector< uint8_t > with_app1( encoded.begin(), encoded.begin() + 2 );
+    with_app1.insert( with_app1.end(), app1.begin(), app1.end() );
+    with_app1.insert( with_app1.end(), encoded.begin() + 2, encoded.end() );
+
+    SECTION("memory source")
+    {
+        CHECK( decodeForTest( with_app1 ) == expect );
+    }
+
+    SECTION("custom source with and without a skip callback")
+    {
+        size_t work_buffer_size = 0;
+        mameJpeg_memory_callback_param info_input_param = { with_app1.data(), 0, with_app1.size() };
+        REQUIRE( mameJpeg_getDecodeBufferSize( mameJpeg_input_from_memory_callback, &info_input_param, NULL, NULL, NULL, &work_buffer_size ) );
+
+        for( int use_skip = 0; use_skip < 2; use_skip++ )
+        {
+            std::vector< uint8_t > work_buffer( work_buffer_size );
+            std::vector< uint8_t > decoded( expect.size() );
+            counting_callback_param input_param = { { with_app1.data(), 0, with_app1.size() }, 0 };
+            mameJpeg_memory_callback_param output_param = { decoded.data(), 0, decoded.size() };
+            mameJpeg_context context[1];
+            REQUIRE( mameJpeg_initializeDecode( context,
+                        counting_input_callback,
+                        &input_param,
+                        mameJpeg_output_to_memory_callback,
+                        &output_param,
+                        work_buffer.data(),
+                        work_buffer.size() ) );
+            if( use_skip )
+            {
+                REQUIRE( mameJpeg_setInputSkipCallback( context, counting_skip_callback ) );
+            }
+            REQUIRE( mameJpeg_decode( context ) );
+            CHECK( decoded == expect );
+            CHECK( ( input_param.read_count + payload_size <= with_app1.size() ) == ( use_skip == 1 ) );
+        }
+    }
+
+    SECTION("pushed source")
+    {
+        size_t work_buffer_size = 0;
+        mameJpeg_memory_callback_param info_input_param = { with_app1.data(), 0, with_app1.size() };
+        REQUIRE( mameJpeg_getDecodeBufferSize( mameJpeg_input_from_memory_callback, &info_input_param, NULL, NULL, NULL, &work_buffer_size ) );
+        std::vector< uint8_t > work_buffer( work_buffer_size );
+        std::vector< uint8_t > decoded( expect.size() );
+        mameJpeg_memory_callback_param output_param = { decoded.data(), 0, decoded.size() };
+        mameJpeg_context context[1];
+        REQUIRE( mameJpeg_initializePushDecode( context, mameJpeg_output_to_memory_callback, &output_param, work_buffer.data(), work_buffer.size() ) );
+
+        std::vector< uint8_t > pending;
+        size_t arrived = 0;
+        mameJpeg_status status = MAMEJPEG_STATUS_NEED_MORE_DATA;
+        while( status == MAMEJPEG_STATUS_NEED_MORE_DATA && arrived < with_app1.size() )
+        {
+            size_t chunk = std::min( (size_t)500, with_app1.size() - arrived );
+            pending.insert( pending.end(), with_app1.begin() + arrived, with_app1.begin() + arrived + chunk );
+            arrived += chunk;
+
+            size_t consumed = 0;
+            status = mameJpeg_decodePush( context, pending.data(), pending.size(), &consumed );
+            pending.erase( pending.begin(), pending.begin() + consumed );
+        }
+        CHECK( status == MAMEJPEG_STATUS_OK );
+        CHECK( decoded == expect );
+    }
+
+    SECTION("probe")
+    {
+        mameJpeg_probe_info info;
+        REQUIRE( mameJpeg_probeMemory( with_app1.data(), with_app1.size(), &info ) );
+        CHECK( info.width == width );
+        CHECK( info.height == height );
+        CHECK( info.component_num == 3 );
+        CHECK( info.hor_sampling[0] == 2 );
+        CHECK( info.ver_sampling[0] == 2 );
+        CHECK( info.hor_sampling[1] == 1 );
+        CHECK( info.ver_sampling[2] == 1 );
+        CHECK( info.is_baseline );
+
+        /* the SOF does not have to be complete beyond itself */
+        std::vector< uint8_t > gray = encodeForTest( std::vector< uint8_t >( width * height, 0x80 ), width, height, MAMEJPEG_FORMAT_Y_444, false, 90 );
+        REQUIRE( mameJpeg_probeMemory( gray.data(), 300, &info ) );
+        CHECK( info.component_num == 1 );
+        CHECK( info.hor_sampling[0] == 1 );
+
+        CHECK( !mameJpeg_probeMemory( with_app1.data(), 1000, &info ) );
+        CHECK( !mameJpeg_probeMemory( with_app1.data() + 1, with_app1.size() - 1, &info ) );
+    }
+}
+
+static void putTiffValueForTest( std::vector< uint8_t >& tiff, uint32_t value, size_t bytes, bool is_big_endian )
+{
+    for( size_t i = 0; i < bytes; i++ )
+    {
+        size_t shift = is_big_endian ? ( bytes - 1 - i ) : i;
+        tiff.push_back( (uint8_t)( value >> ( 8 * shift ) ) );
+    }
+}
+
+static std::vector< uint8_t > makeExifSegmentForTest( const std::vector< uint8_t >& thumbnail, bool is_big_endian )
+{
+    std::vector< uint8_t > tiff = { (uint8_t)( is_big_endian ? 'M' : 'I' ), (uint8_t)( is_big_endian ? 'M' : 'I' ) };
+    putTiffValueForTest( tiff, 42, 2, is_big_endian );
+    putTiffValueForTest( tiff, 8, 4, is_big_endian );
+
+    /* IFD0 with Make only */
+    putTiffValueForTest( tiff, 1, 2, is_big_endian );
+    putTiffValueForTest( tiff, 0x010f, 2, is_big_endian );
+    putTiffValueForTest( tiff, 2, 2, is_big_endian );
+    putTiffValueForTest( tiff, 4, 4, is_big_endian );
+    tiff.insert( tiff.end(), { 'a', 'b', 'c', 0x00 } );
+    putTiffValueForTest( tiff, 26, 4, is_big_endian );
+
+    /* IFD1 pointing at the thumbnail */
+    putTiffValueForTest( tiff, 2, 2, is_big_endian );
+    putTiffValueForTest( tiff, 0x0201, 2, is_big_endian );
+    putTiffValueForTest( tiff, 4, 2, is_big_endian );
+    putTiffValueForTest( tiff, 1, 4, is_big_endian );
+    putTiffValueForTest( tiff, 56, 4, is_big_endian );
+    putTiffValueForTest( tiff, 0x0202, 2, is_big_endian );
+    putTiffValueForTest( tiff, 4, 2, is_big_endian );
+    putTiffValueForTest( tiff, 1, 4, is_big_endian );
+    putTiffValueForTest( tiff, (uint32_t)thumbnail.size(), 4, is_big_endian );
+    putTiffValueForTest( tiff, 0, 4, is_big_endian );
+    tiff.insert( tiff.end(), thumbnail.begin(), thumbnail.end() );
+
+    size_t segment_size = 2 + 6 + tiff.size();
+    std::vector< uint8_t > segment = { 0xff, 0xe1, (uint8_t)( segment_size >> 8 ), (uint8_t)segment_size, 'E', 'x', 'i', 'f', 0x00, 0x00 };
+    segment.insert( segment.end(), tiff.begin(), tiff.end() );
+    return segment;
+}
+
+TEST_CASE("Find the EXIF thumbnail", "[exif]")
+{
+    const uint16_t width = 64;
+    const uint16_t height = 48;
+    std::vector< uint8_t > image( 3 * width * height );
+    for( size_t i = 0; i < image.size(); i++ )
+    {
+        image[i] = (uint8_t)( i * 3 );
+    }
+    std::vector< uint8_t > main_image = encodeForTest( image, width, height, MAMEJPEG_FORMAT_YCBCR_420, false, 90 );
+
+    const uint16_t thumbnail_width = 16;
+    const uint16_t thumbnail_height = 8;
+    std::vector< uint8_t > thumbnail_image( 3 * thumbnail_width * thumbnail_height, 0x40 );
+    std::vector< uint8_t > thumbnail = encodeForTest( thumbnail_image, thumbnail_width, thumbnail_height, MAMEJPEG_FORMAT_YCBCR_444, false, 75 );
+
+    for( int is_big_endian = 0; is_big_endian < 2; is_big_endian++ )
+    {
+        std::vector< uint8_t > exif = makeExifSegmentForTest( thumbnail, is_big_endian == 1 );
+        std::vector< uint8_t > encoded( main_image.begin(), main_image.begin() + 2 );
+        encoded.insert( encoded.end(), exif.begin(), exif.end() );
+        encoded.insert( encoded.end(), main_image.begin() + 2, main_image.end() );
+
+        /* the main scan is never needed, the thumbnail has its own SOS */
+        size_t header_size = 2 + exif.size();
+        for( ; header_size + 1 < encoded.size(); header_size++ )
+        {
+            if( encoded[header_size] == 0xff && encoded[ header_size + 1 ] == 0xda )
+            {
+                break;
+            }
+        }
+
+        const uint8_t* found = NULL;
+        size_t found_size = 0;
+        REQUIRE( mameJpeg_findExifThumbnail( encoded.data(), header_size, &found, &found_size ) );
+        CHECK( found_size == thumbnail.size() );
+        std::vector< uint8_t > found_thumbnail( found, found + found_size );
+        CHECK( found_thumbnail == thumbnail );
+        CHECK( decodeForTest( found_thumbnail ) == decodeForTest( thumbnail ) );
+
+        /* the main image still decodes with EXIF in front */
+        CHECK( decodeForTest( encoded ) == decodeForTest( main_image ) );
+    }
+
+    const uint8_t* found = NULL;
+    size_t found_size = 0;
+    CHECK( !mameJpeg_findExifThumbnail( main_image.data(), main_image.size(), &found, &found_size ) );
+
+    std::vector< uint8_t > exif = makeExifSegmentForTest( thumbnail, false );
+    std::vector< uint8_t > corrupted( main_image.begin(), main_image.begin() + 2 );
+    /* thumbnail length running past the segment */
+    exif[ exif.size() - thumbnail.size() - 8 ] = 0xff;
+    corrupted.insert( corrupted.end(), exif.begin(), exif.end() );
+    corrupted.insert( corrupted.end(), main_image.begin() + 2, main_image.end() );
+    CHECK( !mameJpeg_findExifThumbnail( corrupted.data(), corrupted.size(), &found, &found_size ) );
+}
+
+static std::vector< uint8_t > decodePreviewForTest( std::vector< uint8_t >& encoded, uint16_t* width, uint16_t* height )
+{
+    size_t work_buffer_size = 0;
+    mameJpeg_memory_callback_param info_input_param = { encoded.data(), 0, encoded.size() };
+    REQUIRE( mameJpeg_getDecodeBufferSize( mameJpeg_input_from_memory_callback, &info_input_param, NULL, NULL, NULL, &work_buffer_size ) );
+    std::vector< uint8_t > work_buffer( work_buffer_size );
+
+    mameJpeg_memory_callback_param input_param = { encoded.data(), 0, encoded.size() };
+    mameJpeg_context context[1];
+    REQUIRE( mameJpeg_initializeDecode( context, mameJpeg_input_from_memory_callback, &input_param, NULL, NULL, work_buffer.data(), work_buffer.size() ) );
+    REQUIRE( mameJpeg_readHeader( context ) );
+
+    size_t preview_buffer_size = 0;
+    REQUIRE( mameJpeg_getPreviewSize( context, width, height, &preview_buffer_size ) );
+    std::vector< uint8_t > preview( preview_buffer_size );
+    REQUIRE( !mameJpeg_decodePreview( context, preview.data(), preview.size() - 1 ) );
+    REQUIRE( mameJpeg_decodePreview( context, preview.data(), preview.size() ) );
+    return preview;
+}
+
+TEST_CASE("Decode a DC only preview", "[preview]")
+{
+    /* flat 16x16 tiles, the DC of every block is then the whole block */
+    const uint16_t width = 100;
+    const uint16_t height = 60;
+    std::vector< uint8_t > image( 3 * width * height );
+    for( uint16_t y = 0; y < height; y++ )
+    {
+        for( uint16_t x = 0; x < width; x++ )
+        {
+            uint32_t tile = ( y / 16 ) * 7 + ( x / 16 );
+            for( int c = 0; c < 3; c++ )
+            {
+                image[ 3 * ( y * width + x ) + c ] = (uint8_t)( ( tile * 53 + c * 91 ) & 0xff );
+            }
+        }
+    }
+
+    const mameJpeg_format formats[] = { MAMEJPEG_FORMAT_YCBCR_444, MAMEJPEG_FORMAT_YCBCR_420, MAMEJPEG_FORMAT_YCBCR_422v, MAMEJPEG_FORMAT_Y_444 };
+    for( mameJpeg_format format : formats )
+    {
+        uint8_t component_num = ( format == MAMEJPEG_FORMAT_Y_444 ) ? 1 : 3;
+        std::vector< uint8_t > source( image );
+        if( component_num == 1 )
+        {
+            source.resize( width * height );
+            for( size_t i = 0; i < source.size(); i++ )
+            {
+                source[i] = image[ 3 * i ];
+            }
+        }
+        std::vector< uint8_t > encoded = encodeForTest( source, width, height, format, false );
+        std::vector< uint8_t > decoded = decodeForTest( encoded );
+
+        uint16_t preview_width = 0;
+        uint16_t preview_height = 0;
+        std::vector< uint8_t > preview = decodePreviewForTest( encoded, &preview_width, &preview_height );
+        REQUIRE( preview_width == ( width + 7 ) / 8 );
+        REQUIRE( preview_height == ( height + 7 ) / 8 );
+
+        int max_diff = 0;
+        for( uint16_t y = 0; y < preview_height; y++ )
+        {
+            for( uint16_t x = 0; x < preview_width; x++ )
+            {
+                for( uint8_t c = 0; c < component_num; c++ )
+                {
+                    int expected = decoded[ component_num * ( 8 * y * width + 8 * x ) + c ];
+                    int actual = preview[ component_num * ( y * preview_width + x ) + c ];
+                    max_diff = std::max( max_diff, std::abs( expected - actual ) );
+                }
+            }
+        }
+        CHECK( max_diff <= 2 );
+    }
+}
+
+TEST_CASE("Decode scaled outputs along with the full image", "[preview]")
+{
+    const uint16_t width = 90;
+    const uint16_t height = 52;
+    std::vector< uint8_t > image( 3 * width * height );
+    for( uint16_t y = 0; y < height; y++ )
+    {
+        for( uint16_t x = 0; x < width; x++ )
+        {
+            image[ 3 * ( y * width + x ) + 0 ] = (uint8_t)( 2 * x + y );
+            image[ 3 * ( y * width + x ) + 1 ] = (uint8_t)( 255 - 3 * y );
+            image[ 3 * ( y * width + x ) + 2 ] = (uint8_t)( 64 + x + 2 * y );
+        }
+    }
+
+    const mameJpeg_format formats[] = { MAMEJPEG_FORMAT_YCBCR_444, MAMEJPEG_FORMAT_YCBCR_420 };
+    for( mameJpeg_format format : formats )
+    {
+        std::vector< uint8_t > encoded = encodeForTest( image, width, height, format, false, 95 );
+        std::vector< uint8_t > expect = decodeForTest( encoded );
+
+        size_t work_buffer_size = 0;
+        mameJpeg_memory_callback_param info_input_param = { encoded.data(), 0, encoded.size() };
+        REQUIRE( mameJpeg_getDecodeBufferSize( mameJpeg_input_from_memory_callback, &info_input_param, NULL, NULL, NULL, &work_buffer_size ) );
+        std::vector< uint8_t > work_buffer( work_buffer_size );
+        std::vector< uint8_t > decoded( expect.size() );
+        mameJpeg_memory_callback_param input_param = { encoded.data(), 0, encoded.size() };
+        mameJpeg_memory_callback_param output_param = { decoded.data(), 0, decoded.size() };
+        mameJpeg_context context[1];
+        REQUIRE( mameJpeg_initializeDecode( context,
+                    mameJpeg_input_from_memory_callback,
+                    &input_param,
+                    mameJpeg_output_to_memory_callback,
+                    &output_param,
+                    work_buffer.data(),
+                    work_buffer.size() ) );
+        REQUIRE( mameJpeg_readHeader( context ) );
+
+        const uint8_t scales[] = { 2, 4, 8 };
+        std::vector< uint8_t > outputs[3];
+        uint16_t output_widths[3];
+        uint16_t output_heights[3];
+        for( int i = 0; i < 3; i++ )
+        {
+            size_t output_buffer_size = 0;
+            REQUIRE( mameJpeg_getScaledOutputSize( context, scales[i], &output_widths[i], &output_heights[i], &output_buffer_size ) );
+            CHECK( output_widths[i] == ( width + scales[i] - 1 ) / scales[i] );
+            CHECK( output_heights[i] == ( height + scales[i] - 1 ) / scales[i] );
+            outputs[i].resize( output_buffer_size );
+            CHECK( !mameJpeg_setScaledOutput( context, scales[i], outputs[i].data(), output_buffer_size - 1 ) );
+            REQUIRE( mameJpeg_setScaledOutput( context, scales[i], outputs[i].data(), output_buffer_size ) );
+        }
+        CHECK( !mameJpeg_setScaledOutput( context, 3, outputs[0].data(), outputs[0].size() ) );
+        REQUIRE( mameJpeg_decode( context ) );
+
+        /* the full size output is not affected */
+        CHECK( decoded == expect );
+
+        /* 1/8 is the DC preview */
+        uint16_t preview_width = 0;
+        uint16_t preview_height = 0;
+        CHECK( outputs[2] == decodePreviewForTest( encoded, &preview_width, &preview_height ) );
+
+        /* 1/2 and 1/4 are close to box averages of the full size output,
+           subsampled chroma is coarser than the box and is allowed more */
+        for( int i = 0; i < 2; i++ )
+        {
+            int max_diff = 0;
+            int total_diff = 0;
+            for( uint16_t y = 0; y < output_heights[i]; y++ )
+            {
+                for( uint16_t x = 0; x < output_widths[i]; x++ )
+                {
+                    for( int c = 0; c < 3; c++ )
+                    {
+                        int sum = 0;
+                        int count = 0;
+                        for( uint16_t sy = y * scales[i]; sy < std::min( height, (uint16_t)( ( y + 1 ) * scales[i] ) ); sy++ )
+                        {
+                            for( uint16_t sx = x * scales[i]; sx < std::min( width, (uint16_t)( ( x + 1 ) * scales[i] ) ); sx++ )
+                            {
+                                sum += expect[ 3 * ( sy * width + sx ) + c ];
+                                count++;
+                            }
+                        }
+                        int actual = outputs[i][ 3 * ( y * output_widths[i] + x ) + c ];
+                        int diff = std::abs( ( sum + count / 2 ) / count - actual );
+                        max_diff = std::max( max_diff, diff );
+                        total_diff += diff;
+                    }
+                }
+            }
+            INFO( "scale 1/" << (int)scales[i] );
+            CHECK( max_diff <= ( ( format == MAMEJPEG_FORMAT_YCBCR_444 ) ? 2 : 12 ) );
+            CHECK( total_diff <= (int)outputs[i].size() * ( ( format == MAMEJPEG_FORMAT_YCBCR_444 ) ? 1 : 6 ) );
+        }
+    }
+}
+
+static mameJpeg_signature computeSignatureForTest( std::vector< uint8_t >& encoded )
+{
+    size_t work_buffer_size = 0;
+    mameJpeg_memory_callback_param info_input_param = { encoded.data(), 0, encoded.size() };
+    REQUIRE( mameJpeg_getDecodeBufferSize( mameJpeg_input_from_memory_callback, &info_input_param, NULL, NULL, NULL, &work_buffer_size ) );
+    std::vector< uint8_t > work_buffer( work_buffer_size );
+
+    mameJpeg_memory_callback_param input_param = { encoded.data(), 0, encoded.size() };
+    mameJpeg_context context[1];
+    REQUIRE( mameJpeg_initializeDecode( context, mameJpeg_input_from_memory_callback, &input_param, NULL, NULL, work_buffer.data(), work_buffer.size() ) );
+    mameJpeg_signature signature;
+    REQUIRE( mameJpeg_computeSignature( context, &signature ) );
+    return signature;
+}
+
+TEST_CASE("Compute a signature from coefficients", "[signature]")
+{
+    const uint16_t width = 120;
+    const uint16_t height = 80;
+    std::vector< uint8_t > image( 3 * width * height );
+    std::vector< uint8_t > other( 3 * width * height );
+    for( uint16_t y = 0; y < height; y++ )
+    {
+        for( uint16_t x = 0; x < width; x++ )
+        {
+            for( int c = 0; c < 3; c++ )
+            {
+                double wave = sin( x * 0.07 + c ) * cos( y * 0.05 ) * 100.0;
+                image[ 3 * ( y * width + x ) + c ] = (uint8_t)( 128 + wave + ( ( x * 13 + y * 7 ) % 11 ) );
+                other[ 3 * ( y * width + x ) + c ] = (uint8_t)( 128 + cos( x * 0.03 ) * sin( y * 0.11 + c ) * 100.0 );
+            }
+        }
+    }
+
+    const mameJpeg_format formats[] = { MAMEJPEG_FORMAT_YCBCR_444, MAMEJPEG_FORMAT_YCBCR_420 };
+    for( mameJpeg_format format : formats )
+    {
+        std::vector< uint8_t > high = encodeForTest( image, width, height, format, false, 95 );
+        std::vector< uint8_t > low = encodeForTest( image, width, height, format, false, 40 );
+        std::vector< uint8_t > different = encodeForTest( other, width, height, format, false, 95 );
+
+        mameJpeg_signature high_signature = computeSignatureForTest( high );
+        mameJpeg_signature low_signature = computeSignatureForTest( low );
+        mameJpeg_signature different_signature = computeSignatureForTest( different );
+        CHECK( high_signature.component_num == 3 );
+        CHECK( mameJpeg_getSignatureDistance( &high_signature, &high_signature ) == 0 );
+        CHECK( mameJpeg_getSignatureDistance( &high_signature, &low_signature ) <= 8 );
+        CHECK( 32 <= mameJpeg_getSignatureDistance( &high_signature, &different_signature ) );
+
+        /* luma statistics match the ones of the decoded samples */
+        std::vector< uint8_t > decoded = decodeForTest( high );
+        double sum = 0.0;
+        double square_sum = 0.0;
+        for( size_t i = 0; i < (size_t)width * height; i++ )
+        {
+            const uint8_t* pixel = &decoded[ 3 * i ];
+            double luma = 0.299 * pixel[0] + 0.587 * pixel[1] + 0.114 * pixel[2];
+            sum += luma;
+            square_sum += luma * luma;
+        }
+        double mean = sum / ( width * height );
+        double variance = square_sum / ( width * height ) - mean * mean;
+        CHECK( fabs( high_signature.component[0].mean - mean ) < 1.0 );
+        CHECK( fabs( high_signature.component[0].variance - variance ) < variance * 0.02 );
+    }
+
+    /* grayscale and fewer blocks than cells */
+    std::vector< uint8_t > small( 24 * 16 );
+    for( size_t i = 0; i < small.size(); i++ )
+    {
+        small[i] = (uint8_t)( ( i % 24 ) * 10 );
+    }
+    std::vector< uint8_t > encoded = encodeForTest( small, 24, 16, MAMEJPEG_FORMAT_Y_444, false, 90 );
+    mameJpeg_signature signature = computeSignatureForTest( encoded );
+    CHECK( signature.component_num == 1 );
+    CHECK( fabs( signature.component[0].mean - 115.0 ) < 1.0 );
+    CHECK( signature.ac_hash == ~0ull );
+
+    /* 9x9 blocks, only the last block column and row are bright and fill the last cells alone */
+    std::vector< uint8_t > uneven( 72 * 72 );
+    for( size_t i = 0; i < uneven.size(); i++ )
+    {
+        uneven[i] = ( 64 <= i % 72 || 64 <= i / 72 ) ? 240 : 16;
+    }
+    encoded = encodeForTest( uneven, 72, 72, MAMEJPEG_FORMAT_Y_444, false, 90 );
+    signature = computeSignatureForTest( encoded );
+    CHECK( signature.dc_hash == 0xff80808080808080ull );
+}
+
+static bool validateForTest( std::vector< uint8_t >& encoded, size_t* error_offset )
+{
+    mameJpeg_memory_callback_param info_input_param = { encoded.data(), 0, encoded.size() };
+    size_t work_buffer_size = 0;
+    if( !mameJpeg_getDecodeBufferSize( mameJpeg_input_from_memory_callback, &info_input_param, NULL, NULL, NULL, &work_buffer_size ) )
+    {
+        /* still run into the header error to get its offset */
+        work_buffer_size = 1 << 16;
+    }
+    std::vector< uint8_t > work_buffer( work_buffer_size );
+
+    mameJpeg_memory_callback_param input_param = { encoded.data(), 0, encoded.size() };
+    mameJpeg_context context[1];
+    REQUIRE( mameJpeg_initializeDecode( context, mameJpeg_input_from_memory_callback, &input_param, NULL, NULL, work_buffer.data(), work_buffer.size() ) );
+    return mameJpeg_validate( context, error_offset );
+}
+
+/* a flat 32x8 gray image with a restart marker after every MCU, each block has a DC difference of +1 */
+static std::vector< uint8_t > makeRestartJpegForTest( const std::vector< uint8_t >& restart_codes )
+{
+    std::vector< uint8_t > image( 32 * 8, 0x80 );
+    std::vector< uint8_t > encoded = encodeForTest( image, 32, 8, MAMEJPEG_FORMAT_Y_444, false, 50 );
+
+    size_t sos_pos = 2;
+    while( !( encoded[sos_pos] == 0xff && encoded[ sos_pos + 1 ] == 0xda ) )
+    {
+        sos_pos += 2 + ( ( encoded[ sos_pos + 2 ] << 8 ) | encoded[ sos_pos + 3 ] );
+    }
+    size_t scan_pos = sos_pos + 2 + ( ( encoded[ sos_pos + 2 ] << 8 ) | encoded[ sos_pos + 3 ] );
+
+    std::vector< uint8_t > restart( encoded.begin(), encoded.begin() + sos_pos );
+    restart.insert( restart.end(), { 0xff, 0xdd, 0x00, 0x04, 0x00, 0x01 } );
+    restart.insert( restart.end(), encoded.begin() + sos_pos, encoded.begin() + scan_pos );
+
+    /* DC category 1 "010", value bit "1", EOB "1010" */
+    restart.push_back( 0x5a );
+    for( uint8_t code : restart_codes )
+    {
+        restart.insert( restart.end(), { 0xff, code, 0x5a } );
+    }
+    restart.insert( restart.end(), { 0xff, 0xd9 } );
+    return restart;
+}
+
+TEST_CASE("Decode restart intervals", "[restart]")
+{
+    std::vector< uint8_t > restart = makeRestartJpegForTest( { 0xd0, 0xd1, 0xd2 } );
+
+    /* the prediction starts over at every marker, 128 + 1 * 16 / 8 */
+    std::vector< uint8_t > expect( 32 * 8, 130 );
+    CHECK( decodeForTest( restart ) == expect );
+
+    size_t error_offset = 0;
+    CHECK( validateForTest( restart, &error_offset ) );
+
+    SECTION("pushed in small chunks")
+    {
+        size_t work_buffer_size = 0;
+        mameJpeg_memory_callback_param info_input_param = { restart.data(), 0, restart.size() };
+        REQUIRE( mameJpeg_getDecodeBufferSize( mameJpeg_input_from_memory_callback, &info_input_param, NULL, NULL, NULL, &work_buffer_size ) );
+        std::vector< uint8_t > work_buffer( work_buffer_size );
+        std::vector< uint8_t > decoded( expect.size() );
+        mameJpeg_memory_callback_param output_param = { decoded.data(), 0, decoded.size() };
+        mameJpeg_context context[1];
+        REQUIRE( mameJpeg_initializePushDecode( context, mameJpeg_output_to_memory_callback, &output_param, work_buffer.data(), work_buffer.size() ) );
+
+        std::vector< uint8_t > pending;
+        size_t arrived = 0;
+        mameJpeg_status status = MAMEJPEG_STATUS_NEED_MORE_DATA;
+        while( status == MAMEJPEG_STATUS_NEED_MORE_DATA && arrived < restart.size() )
+        {
+            size_t chunk = std::min( (size_t)3, restart.size() - arrived );
+            pending.insert( pending.end(), restart.begin() + arrived, restart.begin() + arrived + chunk );
+            arrived += chunk;
+
+            size_t consumed = 0;
+            status = mameJpeg_decodePush( context, pending.data(), pending.size(), &consumed );
+            pending.erase( pending.begin(), pending.begin() + consumed );
+        }
+        CHECK( status == MAMEJPEG_STATUS_OK );
+        CHECK( decoded == expect );
+    }
+
+    SECTION("out of order marker")
+    {
+        std::vector< uint8_t > swapped = makeRestartJpegForTest( { 0xd0, 0xd2, 0xd1 } );
+        CHECK( !validateForTest( swapped, &error_offset ) );
+        CHECK( error_offset == restart.size() - 2 - 4 );
+        CHECK( decodeForTest( swapped ).empty() );
+    }
+
+    SECTION("missing marker")
+    {
+        std::vector< uint8_t > missing = makeRestartJpegForTest( { 0xd0, 0xd1 } );
+        missing.insert( missing.end() - 2, 0x5a );
+        CHECK( !validateForTest( missing, &error_offset ) );
+        CHECK( decodeForTest( missing ).empty() );
+    }
+}
+
+TEST_CASE("Validate without decoding pixels", "[validate]")
+{
+    const uint16_t width = 72;
+    const uint16_t height = 40;
+    std::vector< uint8_t > image( 3 * width * height );
+    for( size_t i = 0; i < image.size(); i++ )
+    {
+        image[i] = (uint8_t)( ( i * 37 ) ^ ( i >> 5 ) );
+    }
+
+    const mameJpeg_format formats[] = { MAMEJPEG_FORMAT_YCBCR_444, MAMEJPEG_FORMAT_YCBCR_420, MAMEJPEG_FORMAT_YCBCR_422h };
+    for( mameJpeg_format format : formats )
+    {
+        std::vector< uint8_t > encoded = encodeForTest( image, width, height, format, true, 85 );
+        size_t error_offset = 0;
+        REQUIRE( validateForTest( encoded, &error_offset ) );
+
+        /* truncated in the middle of the scan */
+        std::vector< uint8_t > truncated( encoded.begin(), encoded.begin() + encoded.size() / 2 );
+        CHECK( !validateForTest( truncated, &error_offset ) );
+        CHECK( error_offset == truncated.size() );
+
+        /* a marker inside the entropy coded data */
+        std::vector< uint8_t > corrupted( encoded );
+        size_t corrupted_pos = encoded.size() - encoded.size() / 4;
+        corrupted[ corrupted_pos ] = 0xff;
+        corrupted[ corrupted_pos + 1 ] = 0xd9;
+        CHECK( !validateForTest( corrupted, &error_offset ) );
+        CHECK( error_offset <= corrupted_pos + 2 );
+
+        /* bytes between the scan and EOI */
+        std::vector< uint8_t > trailing( encoded );
+        trailing.insert( trailing.end() - 2, 0x00 );
+        CHECK( !validateForTest( trailing, &error_offset ) );
+        CHECK( error_offset == trailing.size() - 2 );
+
+        /* truncated in the header */
+        std::vector< uint8_t > header_only( encoded.begin(), encoded.begin() + 100 );
+        CHECK( !validateForTest( header_only, &error_offset ) );
+        CHECK( error_offset <= header_only.size() );
+    }
+}
+
+static size_t findSegmentForTest( const std::vector< uint8_t >& encoded, uint8_t code )
+{
+    size_t pos = 2;
+    while( pos + 4 <= encoded.size() && encoded[ pos + 1 ] != code )
+    {
+        pos += 2 + ( ( encoded[ pos + 2 ] << 8 ) | encoded[ pos + 3 ] );
+    }
+    REQUIRE( pos + 4 <= encoded.size() );
+    return pos;
+}
+
+TEST_CASE("Validate rejects out of range header indices", "[validate]")
+{
+    const uint16_t width = 32;
+    const uint16_t height = 16;
+    std::vector< uint8_t > image( 3 * width * height, 0x60 );
+    std::vector< uint8_t > encoded = encodeForTest( image, width, height, MAMEJPEG_FORMAT_YCBCR_444, false, 90 );
+    size_t sof_pos = findSegmentForTest( encoded, 0xc0 );
+    size_t dht_pos = findSegmentForTest( encoded, 0xc4 );
+    size_t sos_pos = findSegmentForTest( encoded, 0xda );
+
+    /* position of a byte in the header and the value that makes it invalid */
+    const struct {
+        size_t pos;
+        uint8_t value;
+    } patches[] = {
+        { sof_pos + 4 + 6 + 2, 4 },    /* SOF quantization table of the first component */
+        { dht_pos + 4, 0x20 },         /* DHT class */
+        { dht_pos + 4, 0x02 },         /* DHT id */
+        { sos_pos + 5, 0 },            /* SOS component selector below 1 */
+        { sos_pos + 5, 4 },            /* SOS component selector above component_num */
+        { sos_pos + 6, 0x02 },         /* SOS AC table */
+        { sos_pos + 6, 0x20 },         /* SOS DC table */
+    };
+
+    size_t error_offset = 0;
+    REQUIRE( validateForTest( encoded, &error_offset ) );
+    for( const auto& patch : patches )
+    {
+        std::vector< uint8_t > corrupted( encoded );
+        corrupted[ patch.pos ] = patch.value;
+        INFO( "byte " << patch.pos << " set to " << (int)patch.value );
+        CHECK( !validateForTest( corrupted, &error_offset ) );
+        CHECK( error_offset == patch.pos + 1 );
+        CHECK( decodeForTest( corrupted ).empty() );
+    }
+}
+
+static uint64_t hashForTest( const std::vector< uint8_t >& bytes )
+{
+    /* FNV-1a */
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for( uint8_t byte : bytes )
+    {
+        hash = ( hash ^ byte ) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+TEST_CASE("Encode and decode byte for byte as before the block layout and huffman rewrites", "[regression]")
+{
+    /* recorded before the int16 block layout, the MCU row passes and the huffman rewrites, with the DCT fix applied */
+    struct {
+        uint8_t* data;
+        size_t size;
+        mameJpeg_format format;
+        size_t encoded_size;
+        uint64_t encoded_hash;
+    } patterns[] = {
+        { jpeg_test_pattern_grayscale_expect, sizeof( jpeg_test_pattern_grayscale_expect ), MAMEJPEG_FORMAT_Y_444, 511, 0xfa61a9a8cc3529f6ull },
+        { jpeg_test_pattern_color_444_expect, sizeof( jpeg_test_pattern_color_444_expect ), MAMEJPEG_FORMAT_YCBCR_444, 1067, 0x7ca91c8bd770fd70ull },
+        { jpeg_test_pattern_color_444_expect, sizeof( jpeg_test_pattern_color_444_expect ), MAMEJPEG_FORMAT_YCBCR_422v, 997, 0x9d4bc15fd784a166ull },
+        { jpeg_test_pattern_color_444_expect, sizeof( jpeg_test_pattern_color_444_expect ), MAMEJPEG_FORMAT_YCBCR_422h, 1022, 0xac8a4bf5fc636e6cull },
+        { jpeg_test_pattern_color_444_expect, sizeof( jpeg_test_pattern_color_444_expect ), MAMEJPEG_FORMAT_YCBCR_420, 913, 0xfdf0489f211fa31cull },
+    };
+    for( const auto& pattern : patterns )
+    {
+        std::vector< uint8_t > image( pattern.data, pattern.data + pattern.size );
+        std::vector< uint8_t > encoded = encodeForTest( image, 16, 16, pattern.format, false, 100 );
+        CHECK( encoded.size() == pattern.encoded_size );
+        CHECK( hashForTest( encoded ) == pattern.encoded_hash );
+    }
+
+    struct {
+        uint8_t* data;
+        size_t size;
+        size_t decoded_size;
+        uint64_t decoded_hash;
+    } jpegs[] = {
+        { jpeg_test_pattern_binary, sizeof( jpeg_test_pattern_binary ), 256, 0x29590dd171571bc9ull },
+        { jpeg_test_pattern_grayscale, sizeof( jpeg_test_pattern_grayscale ), 256, 0x286b263e8ab5ecddull },
+        { jpeg_test_pattern_color_444, sizeof( jpeg_test_pattern_color_444 ), 768, 0xd2e939ce4a05cb6dull },
+        { jpeg_test_pattern_color_422v, sizeof( jpeg_test_pattern_color_422v ), 768, 0xd10089fc94cc0b03ull },
+        { jpeg_test_pattern_color_422h, sizeof( jpeg_test_pattern_color_422h ), 768, 0x472ae1eb4475dc40ull },
+        { jpeg_test_pattern_color_420, sizeof( jpeg_test_pattern_color_420 ), 768, 0xcdb6de5984f3c026ull },
+    };
+    for( const auto& jpeg : jpegs )
+    {
+        std::vector< uint8_t > encoded( jpeg.data, jpeg.data + jpeg.size );
+        std::vector< uint8_t > decoded = decodeForTest( encoded );
+        CHECK( decoded.size() == jpeg.decoded_size );
+        CHECK( hashForTest( decoded ) == jpeg.decoded_hash );
+    }
+
+    /* partial MCUs at the edges, the encoder recorded after the bottom row padding fix and before the huffman rewrites */
+    const uint16_t width = 77;
+    const uint16_t height = 45;
+    struct {
+        mameJpeg_format format;
+        size_t encoded_size;
+        uint64_t encoded_hash;
+        uint64_t decoded_hash;
+    } edges[] = {
+        { MAMEJPEG_FORMAT_YCBCR_444, 16162, 0xe3bb55e682d27d59ull, 0x81ef8dcb26b35971ull },
+        { MAMEJPEG_FORMAT_YCBCR_422v, 10667, 0x7c3742f9e36e6c87ull, 0x7151ace064aa74dbull },
+        { MAMEJPEG_FORMAT_YCBCR_422h, 10670, 0x788e7f4aeb8ea930ull, 0xdb8e762877311f9dull },
+        { MAMEJPEG_FORMAT_YCBCR_420, 8113, 0x306fcdd95a0e346bull, 0x1131c1af95e1aa49ull },
+        { MAMEJPEG_FORMAT_Y_444, 6325, 0x95c8b39a9fd84c04ull, 0x5fcc4eda56c13077ull },
+    };
+    for( const auto& edge : edges )
+    {
+        const uint8_t components = mameJpeg_getComponentNum( edge.format );
+        std::vector< uint8_t > image( (size_t)components * width * height );
+        for( size_t i = 0; i < image.size(); i++ )
+        {
+            image[i] = (uint8_t)( ( i * i * 13 ) ^ ( i >> 2 ) );
+        }
+        std::vector< uint8_t > encoded = encodeForTest( image, width, height, edge.format, false, 100 );
+        CHECK( encoded.size() == edge.encoded_size );
+        CHECK( hashForTest( encoded ) == edge.encoded_hash );
+
+        std::vector< uint8_t > decoded = decodeForTest( encoded );
+        CHECK( decoded.size() == image.size() );
+        CHECK( hashForTest( decoded ) == edge.decoded_hash );
+    }
+}